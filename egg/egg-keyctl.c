@@ -0,0 +1,138 @@
+/* libsecret - GLib wrapper for Secret Service
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+/*
+ * Stores small secrets as "user" keys in the session keyring of the
+ * Linux kernel, where other processes of the same login session can
+ * find them. The raw system calls are used, so as not to depend on
+ * libkeyutils.
+ */
+
+#include "config.h"
+
+#include "egg-keyctl.h"
+
+#include "egg/egg-secure-memory.h"
+
+EGG_SECURE_DECLARE (egg_keyctl);
+
+#ifdef HAVE_LINUX_KEYCTL_H
+
+#include <linux/keyctl.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define KEY_TYPE "user"
+
+/* Only processes attached to the session keyring may use the key */
+#define KEY_PERM_POSSESSOR_ALL 0x3f000000
+
+static long
+key_search (const gchar *description)
+{
+	return syscall (SYS_keyctl, KEYCTL_SEARCH,
+			KEY_SPEC_SESSION_KEYRING,
+			KEY_TYPE, description, 0);
+}
+
+GBytes *
+egg_keyctl_lookup (const gchar *description)
+{
+	guint8 *buffer;
+	long serial;
+	long length;
+	long n_buffer;
+
+	serial = key_search (description);
+	if (serial < 0)
+		return NULL;
+
+	length = syscall (SYS_keyctl, KEYCTL_READ, serial, NULL, 0);
+	if (length <= 0)
+		return NULL;
+
+	/* The key might be updated between the two calls */
+	n_buffer = length;
+	buffer = egg_secure_alloc (n_buffer);
+	g_return_val_if_fail (buffer, NULL);
+
+	length = syscall (SYS_keyctl, KEYCTL_READ, serial, buffer, n_buffer);
+	if (length <= 0 || length > n_buffer) {
+		egg_secure_free (buffer);
+		return NULL;
+	}
+
+	return g_bytes_new_with_free_func (buffer, length,
+					   egg_secure_free, buffer);
+}
+
+gboolean
+egg_keyctl_store (const gchar *description,
+		  GBytes *payload,
+		  guint timeout)
+{
+	long serial;
+
+	serial = syscall (SYS_add_key, KEY_TYPE, description,
+			  g_bytes_get_data (payload, NULL),
+			  g_bytes_get_size (payload),
+			  KEY_SPEC_SESSION_KEYRING);
+	if (serial < 0) {
+		g_debug ("couldn't add key to the session keyring: %s",
+			 g_strerror (errno));
+		return FALSE;
+	}
+
+	if (syscall (SYS_keyctl, KEYCTL_SETPERM, serial,
+		     KEY_PERM_POSSESSOR_ALL) < 0 ||
+	    (timeout > 0 &&
+	     syscall (SYS_keyctl, KEYCTL_SET_TIMEOUT, serial, timeout) < 0)) {
+		g_debug ("couldn't restrict key in the session keyring: %s",
+			 g_strerror (errno));
+		syscall (SYS_keyctl, KEYCTL_REVOKE, serial);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void
+egg_keyctl_invalidate (const gchar *description)
+{
+	long serial;
+
+	serial = key_search (description);
+	if (serial >= 0)
+		syscall (SYS_keyctl, KEYCTL_REVOKE, serial);
+}
+
+#else /* HAVE_LINUX_KEYCTL_H */
+
+GBytes *
+egg_keyctl_lookup (const gchar *description)
+{
+	return NULL;
+}
+
+gboolean
+egg_keyctl_store (const gchar *description,
+		  GBytes *payload,
+		  guint timeout)
+{
+	return FALSE;
+}
+
+void
+egg_keyctl_invalidate (const gchar *description)
+{
+}
+
+#endif /* HAVE_LINUX_KEYCTL_H */
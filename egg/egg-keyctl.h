@@ -0,0 +1,24 @@
+/* libsecret - GLib wrapper for Secret Service
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#ifndef EGG_KEYCTL_H_
+#define EGG_KEYCTL_H_
+
+#include <glib.h>
+
+GBytes   *egg_keyctl_lookup     (const gchar *description);
+
+gboolean  egg_keyctl_store      (const gchar *description,
+                                 GBytes *payload,
+                                 guint timeout);
+
+void      egg_keyctl_invalidate (const gchar *description);
+
+#endif /* EGG_KEYCTL_H_ */
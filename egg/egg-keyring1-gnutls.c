@@ -24,6 +24,7 @@ EGG_SECURE_DECLARE (egg_keyring1);
 #define PBKDF2_HASH_ALGO GNUTLS_MAC_SHA256
 #define MAC_ALGO GNUTLS_MAC_SHA256
 #define CIPHER_ALGO GNUTLS_CIPHER_AES_128_CBC
+#define AEAD_ALGO GNUTLS_CIPHER_AES_128_GCM
 
 void
 egg_keyring1_create_nonce (guint8 *nonce,
@@ -65,21 +66,100 @@ egg_keyring1_derive_key (const char *password,
 					   buffer);
 }
 
+/* The HMAC state keyed once, which is cloned for each use, and the
+ * ciphers with their key schedule, which need the lock */
+struct _EggKeyring1Context {
+	gint refs;
+	GMutex mutex;
+	gnutls_hmac_hd_t mac;
+	gnutls_cipher_hd_t cipher;
+	gnutls_aead_cipher_hd_t aead;
+};
+
+EggKeyring1Context *
+egg_keyring1_context_new (GBytes *key)
+{
+	EggKeyring1Context *context;
+	guint8 iv[IV_SIZE] = { 0, };
+	gnutls_datum_t key_datum, iv_datum;
+	gsize n_secret;
+	int ret;
+
+	key_datum.data = (void *)g_bytes_get_data (key, &n_secret);
+	key_datum.size = n_secret;
+
+	/* The IV is set again for each use */
+	iv_datum.data = iv;
+	iv_datum.size = IV_SIZE;
+
+	context = g_new0 (EggKeyring1Context, 1);
+	context->refs = 1;
+	g_mutex_init (&context->mutex);
+
+	ret = gnutls_hmac_init (&context->mac, MAC_ALGO,
+				key_datum.data, key_datum.size);
+	if (ret < 0)
+		goto fail;
+
+	ret = gnutls_cipher_init (&context->cipher, CIPHER_ALGO,
+				  &key_datum, &iv_datum);
+	if (ret < 0)
+		goto fail;
+
+	ret = gnutls_aead_cipher_init (&context->aead, AEAD_ALGO, &key_datum);
+	if (ret < 0)
+		goto fail;
+
+	return context;
+
+ fail:
+	egg_keyring1_context_unref (context);
+	return NULL;
+}
+
+EggKeyring1Context *
+egg_keyring1_context_ref (EggKeyring1Context *context)
+{
+	g_atomic_int_inc (&context->refs);
+	return context;
+}
+
+void
+egg_keyring1_context_unref (EggKeyring1Context *context)
+{
+	if (context == NULL || !g_atomic_int_dec_and_test (&context->refs))
+		return;
+
+	if (context->mac)
+		gnutls_hmac_deinit (context->mac, NULL);
+	if (context->cipher)
+		gnutls_cipher_deinit (context->cipher);
+	if (context->aead)
+		gnutls_aead_cipher_deinit (context->aead);
+	g_mutex_clear (&context->mutex);
+	g_free (context);
+}
+
 gboolean
-egg_keyring1_calculate_mac (GBytes *key,
+egg_keyring1_calculate_mac (EggKeyring1Context *context,
 			    const guint8 *value,
 			    gsize n_value,
 			    guint8 *buffer)
 {
-	return gnutls_hmac_fast (MAC_ALGO,
-				 g_bytes_get_data (key, NULL),
-				 g_bytes_get_size (key),
-				 value, n_value,
-				 buffer) >= 0;
+	gnutls_hmac_hd_t hd;
+	int ret;
+
+	hd = gnutls_hmac_copy (context->mac);
+	if (hd == NULL)
+		return FALSE;
+
+	ret = gnutls_hmac (hd, value, n_value);
+	gnutls_hmac_deinit (hd, buffer);
+	return ret >= 0;
 }
 
 gboolean
-egg_keyring1_verify_mac (GBytes *key,
+egg_keyring1_verify_mac (EggKeyring1Context *context,
 			 const guint8 *value,
 			 gsize n_value,
 			 const guint8 *data)
@@ -88,7 +168,7 @@ egg_keyring1_verify_mac (GBytes *key,
 	guint8 status = 0;
 	gsize i;
 
-	if (!egg_keyring1_calculate_mac (key, value, n_value, buffer)) {
+	if (!egg_keyring1_calculate_mac (context, value, n_value, buffer)) {
 		return FALSE;
 	}
 
@@ -100,57 +180,90 @@ egg_keyring1_verify_mac (GBytes *key,
 }
 
 gboolean
-egg_keyring1_decrypt (GBytes *key,
+egg_keyring1_decrypt (EggKeyring1Context *context,
 		      guint8 *data,
 		      gsize n_data)
 {
-	gnutls_cipher_hd_t hd = NULL;
 	int ret;
-	gsize n_secret;
-	gnutls_datum_t key_datum, iv_datum;
 
-	key_datum.data = (void *)g_bytes_get_data (key, &n_secret);
-	key_datum.size = n_secret;
+	g_mutex_lock (&context->mutex);
+	gnutls_cipher_set_iv (context->cipher, data + n_data, IV_SIZE);
+	ret = gnutls_cipher_decrypt2 (context->cipher, data, n_data, data, n_data);
+	g_mutex_unlock (&context->mutex);
 
-	iv_datum.data = data + n_data;
-	iv_datum.size = IV_SIZE;
-
-	ret = gnutls_cipher_init (&hd, CIPHER_ALGO, &key_datum, &iv_datum);
-	if (ret < 0) {
-		return FALSE;
-	}
-
-	ret = gnutls_cipher_decrypt2 (hd, data, n_data, data, n_data);
-	if (ret < 0) {
-		gnutls_cipher_deinit (hd);
-		return FALSE;
-	}
-
-	gnutls_cipher_deinit (hd);
-	return TRUE;
+	return ret < 0 ? FALSE : TRUE;
 }
 
 gboolean
-egg_keyring1_encrypt (GBytes *key,
+egg_keyring1_encrypt (EggKeyring1Context *context,
 		      guint8 *data,
 		      gsize n_data)
 {
-	gnutls_cipher_hd_t hd = NULL;
 	int ret;
-	gsize n_secret;
-	gnutls_datum_t key_datum, iv_datum;
 
-	key_datum.data = (void *)g_bytes_get_data (key, &n_secret);
-	key_datum.size = n_secret;
+	egg_keyring1_create_nonce (data + n_data, IV_SIZE);
 
-	iv_datum.data = data + n_data;
-	iv_datum.size = IV_SIZE;
-	egg_keyring1_create_nonce (iv_datum.data, iv_datum.size);
+	g_mutex_lock (&context->mutex);
+	gnutls_cipher_set_iv (context->cipher, data + n_data, IV_SIZE);
+	ret = gnutls_cipher_encrypt2 (context->cipher, data, n_data, data, n_data);
+	g_mutex_unlock (&context->mutex);
 
-	ret = gnutls_cipher_init (&hd, CIPHER_ALGO, &key_datum, &iv_datum);
-	g_return_val_if_fail (ret >= 0, FALSE);
+	return ret < 0 ? FALSE : TRUE;
+}
+
+gboolean
+egg_keyring1_aead_decrypt (EggKeyring1Context *context,
+			   const guint8 *aad,
+			   gsize n_aad,
+			   guint8 *data,
+			   gsize n_data)
+{
+	int ret;
+	giovec_t auth_iov, iov;
+
+	auth_iov.iov_base = (void *)aad;
+	auth_iov.iov_len = n_aad;
+	iov.iov_base = data + AEAD_NONCE_SIZE;
+	iov.iov_len = n_data;
+
+	g_mutex_lock (&context->mutex);
+	ret = gnutls_aead_cipher_decryptv2 (context->aead,
+					    data, AEAD_NONCE_SIZE,
+					    &auth_iov, 1,
+					    &iov, 1,
+					    data + AEAD_NONCE_SIZE + n_data,
+					    AEAD_TAG_SIZE);
+	g_mutex_unlock (&context->mutex);
 
-	ret = gnutls_cipher_encrypt2 (hd, data, n_data, data, n_data);
-	gnutls_cipher_deinit (hd);
 	return ret < 0 ? FALSE : TRUE;
 }
+
+gboolean
+egg_keyring1_aead_encrypt (EggKeyring1Context *context,
+			   const guint8 *aad,
+			   gsize n_aad,
+			   guint8 *data,
+			   gsize n_data)
+{
+	int ret;
+	giovec_t auth_iov, iov;
+	size_t tag_size = AEAD_TAG_SIZE;
+
+	egg_keyring1_create_nonce (data, AEAD_NONCE_SIZE);
+
+	auth_iov.iov_base = (void *)aad;
+	auth_iov.iov_len = n_aad;
+	iov.iov_base = data + AEAD_NONCE_SIZE;
+	iov.iov_len = n_data;
+
+	g_mutex_lock (&context->mutex);
+	ret = gnutls_aead_cipher_encryptv2 (context->aead,
+					    data, AEAD_NONCE_SIZE,
+					    &auth_iov, 1,
+					    &iov, 1,
+					    data + AEAD_NONCE_SIZE + n_data,
+					    &tag_size);
+	g_mutex_unlock (&context->mutex);
+
+	return ret < 0 || tag_size != AEAD_TAG_SIZE ? FALSE : TRUE;
+}
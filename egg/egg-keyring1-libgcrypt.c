@@ -21,9 +21,10 @@
 EGG_SECURE_DECLARE (egg_keyring1);
 
 #include <gcrypt.h>
+#include <string.h>
 
 #define PBKDF2_HASH_ALGO GCRY_MD_SHA256
-#define MAC_ALGO GCRY_MAC_HMAC_SHA256
+#define MAC_ALGO GCRY_MD_SHA256
 #define CIPHER_ALGO GCRY_CIPHER_AES128
 
 void
@@ -63,46 +64,110 @@ egg_keyring1_derive_key (const gchar *password,
 					   buffer);
 }
 
-gboolean
-egg_keyring1_calculate_mac (GBytes *key,
-			    const guint8 *value,
-			    gsize n_value,
-			    guint8 *buffer)
+/* The HMAC state keyed once, which is cloned for each use, and the
+ * ciphers with their key schedule, which need the lock */
+struct _EggKeyring1Context {
+	gint refs;
+	GMutex mutex;
+	gcry_md_hd_t mac;
+	gcry_cipher_hd_t cipher;
+	gcry_cipher_hd_t aead;
+};
+
+EggKeyring1Context *
+egg_keyring1_context_new (GBytes *key)
 {
-	gcry_mac_hd_t hd;
+	EggKeyring1Context *context;
 	gcry_error_t gcry;
 	gconstpointer secret;
 	gsize n_secret;
-	gboolean ret = FALSE;
-
-	gcry = gcry_mac_open (&hd, MAC_ALGO, 0, NULL);
-	g_return_val_if_fail (gcry == 0, FALSE);
 
 	secret = g_bytes_get_data (key, &n_secret);
-	gcry = gcry_mac_setkey (hd, secret, n_secret);
+
+	context = g_new0 (EggKeyring1Context, 1);
+	context->refs = 1;
+	g_mutex_init (&context->mutex);
+
+	gcry = gcry_md_open (&context->mac, MAC_ALGO,
+			     GCRY_MD_FLAG_HMAC | GCRY_MD_FLAG_SECURE);
 	if (gcry != 0)
-		goto out;
+		goto fail;
 
-	gcry = gcry_mac_write (hd, value, n_value);
+	gcry = gcry_md_setkey (context->mac, secret, n_secret);
 	if (gcry != 0)
-		goto out;
+		goto fail;
 
-	n_value = MAC_SIZE;
-	gcry = gcry_mac_read (hd, buffer, &n_value);
+	gcry = gcry_cipher_open (&context->cipher, CIPHER_ALGO,
+				 GCRY_CIPHER_MODE_CBC, GCRY_CIPHER_SECURE);
 	if (gcry != 0)
-		goto out;
+		goto fail;
 
-	if (n_value != MAC_SIZE)
-		goto out;
+	gcry = gcry_cipher_setkey (context->cipher, secret, n_secret);
+	if (gcry != 0)
+		goto fail;
 
-	ret = TRUE;
- out:
-	gcry_mac_close (hd);
-	return ret;
+	gcry = gcry_cipher_open (&context->aead, CIPHER_ALGO,
+				 GCRY_CIPHER_MODE_GCM, GCRY_CIPHER_SECURE);
+	if (gcry != 0)
+		goto fail;
+
+	gcry = gcry_cipher_setkey (context->aead, secret, n_secret);
+	if (gcry != 0)
+		goto fail;
+
+	return context;
+
+ fail:
+	egg_keyring1_context_unref (context);
+	return NULL;
+}
+
+EggKeyring1Context *
+egg_keyring1_context_ref (EggKeyring1Context *context)
+{
+	g_atomic_int_inc (&context->refs);
+	return context;
+}
+
+void
+egg_keyring1_context_unref (EggKeyring1Context *context)
+{
+	if (context == NULL || !g_atomic_int_dec_and_test (&context->refs))
+		return;
+
+	gcry_md_close (context->mac);
+	gcry_cipher_close (context->cipher);
+	gcry_cipher_close (context->aead);
+	g_mutex_clear (&context->mutex);
+	g_free (context);
+}
+
+gboolean
+egg_keyring1_calculate_mac (EggKeyring1Context *context,
+			    const guint8 *value,
+			    gsize n_value,
+			    guint8 *buffer)
+{
+	gcry_md_hd_t hd;
+	gcry_error_t gcry;
+	unsigned char *digest;
+
+	gcry = gcry_md_copy (&hd, context->mac);
+	if (gcry != 0)
+		return FALSE;
+
+	gcry_md_write (hd, value, n_value);
+
+	digest = gcry_md_read (hd, MAC_ALGO);
+	if (digest != NULL)
+		memcpy (buffer, digest, MAC_SIZE);
+
+	gcry_md_close (hd);
+	return digest != NULL;
 }
 
 gboolean
-egg_keyring1_verify_mac (GBytes *key,
+egg_keyring1_verify_mac (EggKeyring1Context *context,
 			 const guint8 *value,
 			 gsize n_value,
 			 const guint8 *data)
@@ -111,7 +176,7 @@ egg_keyring1_verify_mac (GBytes *key,
 	guint8 status = 0;
 	gsize i;
 
-	if (!egg_keyring1_calculate_mac (key, value, n_value, buffer)) {
+	if (!egg_keyring1_calculate_mac (context, value, n_value, buffer)) {
 		return FALSE;
 	}
 
@@ -123,71 +188,103 @@ egg_keyring1_verify_mac (GBytes *key,
 }
 
 gboolean
-egg_keyring1_decrypt (GBytes *key,
+egg_keyring1_decrypt (EggKeyring1Context *context,
 		      guint8 *data,
 		      gsize n_data)
 {
-	gcry_cipher_hd_t hd;
 	gcry_error_t gcry;
-	gconstpointer secret;
-	gsize n_secret;
-	gboolean ret = FALSE;
 
-	gcry = gcry_cipher_open (&hd, CIPHER_ALGO, GCRY_CIPHER_MODE_CBC, 0);
-	if (gcry != 0)
-		goto out;
+	g_mutex_lock (&context->mutex);
 
-	secret = g_bytes_get_data (key, &n_secret);
-	gcry = gcry_cipher_setkey (hd, secret, n_secret);
+	gcry = gcry_cipher_setiv (context->cipher, data + n_data, IV_SIZE);
+	if (gcry == 0)
+		gcry = gcry_cipher_decrypt (context->cipher, data, n_data, NULL, 0);
+
+	g_mutex_unlock (&context->mutex);
+
+	return gcry == 0;
+}
+
+gboolean
+egg_keyring1_encrypt (EggKeyring1Context *context,
+		      guint8 *data,
+		      gsize n_data)
+{
+	gcry_error_t gcry;
+
+	egg_keyring1_create_nonce (data + n_data, IV_SIZE);
+
+	g_mutex_lock (&context->mutex);
+
+	gcry = gcry_cipher_setiv (context->cipher, data + n_data, IV_SIZE);
+	if (gcry == 0)
+		gcry = gcry_cipher_encrypt (context->cipher, data, n_data, NULL, 0);
+
+	g_mutex_unlock (&context->mutex);
+
+	return gcry == 0;
+}
+
+gboolean
+egg_keyring1_aead_decrypt (EggKeyring1Context *context,
+			   const guint8 *aad,
+			   gsize n_aad,
+			   guint8 *data,
+			   gsize n_data)
+{
+	gcry_error_t gcry;
+
+	g_mutex_lock (&context->mutex);
+
+	gcry = gcry_cipher_setiv (context->aead, data, AEAD_NONCE_SIZE);
 	if (gcry != 0)
 		goto out;
 
-	gcry = gcry_cipher_setiv (hd, data + n_data, IV_SIZE);
+	gcry = gcry_cipher_authenticate (context->aead, aad, n_aad);
 	if (gcry != 0)
 		goto out;
 
-	gcry = gcry_cipher_decrypt (hd, data, n_data, NULL, 0);
+	gcry = gcry_cipher_decrypt (context->aead, data + AEAD_NONCE_SIZE, n_data, NULL, 0);
 	if (gcry != 0)
 		goto out;
 
-	ret = TRUE;
+	gcry = gcry_cipher_checktag (context->aead, data + AEAD_NONCE_SIZE + n_data,
+				     AEAD_TAG_SIZE);
+
  out:
-	gcry_cipher_close (hd);
-	return ret;
+	g_mutex_unlock (&context->mutex);
+	return gcry == 0;
 }
 
 gboolean
-egg_keyring1_encrypt (GBytes *key,
-		      guint8 *data,
-		      gsize n_data)
+egg_keyring1_aead_encrypt (EggKeyring1Context *context,
+			   const guint8 *aad,
+			   gsize n_aad,
+			   guint8 *data,
+			   gsize n_data)
 {
-	gcry_cipher_hd_t hd;
 	gcry_error_t gcry;
-	gconstpointer secret;
-	gsize n_secret;
-	gboolean ret = FALSE;
 
-	gcry = gcry_cipher_open (&hd, CIPHER_ALGO, GCRY_CIPHER_MODE_CBC, 0);
-	if (gcry != 0)
-		goto out;
+	egg_keyring1_create_nonce (data, AEAD_NONCE_SIZE);
 
-	secret = g_bytes_get_data (key, &n_secret);
-	gcry = gcry_cipher_setkey (hd, secret, n_secret);
+	g_mutex_lock (&context->mutex);
+
+	gcry = gcry_cipher_setiv (context->aead, data, AEAD_NONCE_SIZE);
 	if (gcry != 0)
 		goto out;
 
-	egg_keyring1_create_nonce (data + n_data, IV_SIZE);
-
-	gcry = gcry_cipher_setiv (hd, data + n_data, IV_SIZE);
+	gcry = gcry_cipher_authenticate (context->aead, aad, n_aad);
 	if (gcry != 0)
 		goto out;
 
-	gcry = gcry_cipher_encrypt (hd, data, n_data, NULL, 0);
+	gcry = gcry_cipher_encrypt (context->aead, data + AEAD_NONCE_SIZE, n_data, NULL, 0);
 	if (gcry != 0)
 		goto out;
 
-	ret = TRUE;
+	gcry = gcry_cipher_gettag (context->aead, data + AEAD_NONCE_SIZE + n_data,
+				   AEAD_TAG_SIZE);
+
  out:
-	gcry_cipher_close (hd);
-	return ret;
+	g_mutex_unlock (&context->mutex);
+	return gcry == 0;
 }
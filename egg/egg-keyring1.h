@@ -26,6 +26,14 @@
 #define KEY_SIZE 16
 #define IV_SIZE CIPHER_BLOCK_SIZE
 
+#define AEAD_NONCE_SIZE 12
+#define AEAD_TAG_SIZE 16
+
+/* Holds what can be prepared from a key ahead of use, so that it isn't
+ * repeated for every item. It may be used from several threads, and is
+ * reference counted so that it can outlive a change of the key */
+typedef struct _EggKeyring1Context EggKeyring1Context;
+
 void     egg_keyring1_create_nonce  (guint8 *nonce,
                                      gsize nonce_size);
 
@@ -34,21 +42,43 @@ GBytes  *egg_keyring1_derive_key    (const char *password,
                                      GBytes *salt,
                                      guint32 iteration_count);
 
-gboolean egg_keyring1_calculate_mac (GBytes *key,
+EggKeyring1Context *
+         egg_keyring1_context_new   (GBytes *key);
+
+EggKeyring1Context *
+         egg_keyring1_context_ref   (EggKeyring1Context *context);
+
+void     egg_keyring1_context_unref (EggKeyring1Context *context);
+
+gboolean egg_keyring1_calculate_mac (EggKeyring1Context *context,
                                      const guint8 *value,
 				     gsize n_value,
                                      guint8 *buffer);
 
-gboolean egg_keyring1_verify_mac    (GBytes *key,
+gboolean egg_keyring1_verify_mac    (EggKeyring1Context *context,
                                      const guint8 *value,
 				     gsize n_value,
                                      const guint8 *data);
 
-gboolean egg_keyring1_decrypt       (GBytes *key,
+gboolean egg_keyring1_decrypt       (EggKeyring1Context *context,
+                                     guint8 *data,
+                                     gsize n_data);
+
+gboolean egg_keyring1_encrypt       (EggKeyring1Context *context,
+                                     guint8 *data,
+                                     gsize n_data);
+
+/* The data is laid out as nonce, text and tag, n_data being the size of
+ * the text, which is encrypted or decrypted in place */
+gboolean egg_keyring1_aead_decrypt  (EggKeyring1Context *context,
+                                     const guint8 *aad,
+                                     gsize n_aad,
                                      guint8 *data,
                                      gsize n_data);
 
-gboolean egg_keyring1_encrypt       (GBytes *key,
+gboolean egg_keyring1_aead_encrypt  (EggKeyring1Context *context,
+                                     const guint8 *aad,
+                                     gsize n_aad,
                                      guint8 *data,
                                      gsize n_data);
 
@@ -0,0 +1,70 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/* test-keyctl.c: Test egg-keyctl.c
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published
+   by the Free Software Foundation; either version 2.1 of the licence or (at
+   your option) any later version.
+
+   See the included COPYING file for more information.
+*/
+
+#include "config.h"
+
+#undef G_DISABLE_ASSERT
+
+#include "egg/egg-keyctl.h"
+#include "egg/egg-secure-memory.h"
+#include "egg/egg-testing.h"
+
+#include <unistd.h>
+
+EGG_SECURE_DEFINE_GLIB_GLOBALS ();
+
+static void
+test_store_lookup (void)
+{
+	const guint8 data[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+	GBytes *payload;
+	GBytes *found;
+	gchar *description;
+
+	description = g_strdup_printf ("libsecret:test-keyctl:%d", (int) getpid ());
+	payload = g_bytes_new_static (data, sizeof (data));
+
+	if (!egg_keyctl_store (description, payload, 30)) {
+		g_test_skip ("session keyring not available");
+		g_bytes_unref (payload);
+		g_free (description);
+		return;
+	}
+
+	found = egg_keyctl_lookup (description);
+	g_assert_nonnull (found);
+	g_assert_true (g_bytes_equal (found, payload));
+	g_bytes_unref (found);
+
+	egg_keyctl_invalidate (description);
+	found = egg_keyctl_lookup (description);
+	g_assert_null (found);
+
+	g_bytes_unref (payload);
+	g_free (description);
+}
+
+static void
+test_lookup_missing (void)
+{
+	g_assert_null (egg_keyctl_lookup ("libsecret:test-keyctl:does-not-exist"));
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/keyctl/store-lookup", test_store_lookup);
+	g_test_add_func ("/keyctl/lookup-missing", test_lookup_missing);
+
+	return g_test_run ();
+}
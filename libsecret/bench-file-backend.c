@@ -0,0 +1,364 @@
+/* Measures the file backend on a generated keyring, and prints the
+ * results as a single line of JSON, so that runs can be compared */
+
+#include "config.h"
+
+#undef G_DISABLE_ASSERT
+
+#include "secret-backend.h"
+#include "secret-password.h"
+
+#include "egg/egg-keyring1.h"
+#include "egg/egg-testing.h"
+
+#include <glib/gstdio.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define MAX_ATTRIBUTES 8
+
+static const SecretSchema BENCH_SCHEMA = {
+	"org.freedesktop.Secret.Bench",
+	SECRET_SCHEMA_NONE,
+	{
+		{ "number", SECRET_SCHEMA_ATTRIBUTE_INTEGER },
+		{ "attr1", SECRET_SCHEMA_ATTRIBUTE_STRING },
+		{ "attr2", SECRET_SCHEMA_ATTRIBUTE_STRING },
+		{ "attr3", SECRET_SCHEMA_ATTRIBUTE_STRING },
+		{ "attr4", SECRET_SCHEMA_ATTRIBUTE_STRING },
+		{ "attr5", SECRET_SCHEMA_ATTRIBUTE_STRING },
+		{ "attr6", SECRET_SCHEMA_ATTRIBUTE_STRING },
+		{ "attr7", SECRET_SCHEMA_ATTRIBUTE_STRING },
+	}
+};
+
+static gint n_items = 1000;
+static gint n_attributes = 2;
+static gint secret_size = 32;
+static gint n_lookups = 1000;
+static gint n_writes = 10;
+static gboolean random_secrets = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "items", 'n', 0, G_OPTION_ARG_INT, &n_items,
+	  "Number of items in the keyring", "N" },
+	{ "attributes", 'a', 0, G_OPTION_ARG_INT, &n_attributes,
+	  "Number of attributes of each item, up to 8", "N" },
+	{ "secret-size", 's', 0, G_OPTION_ARG_INT, &secret_size,
+	  "Size of each secret in bytes", "BYTES" },
+	{ "lookups", 'l', 0, G_OPTION_ARG_INT, &n_lookups,
+	  "Number of lookups to average", "N" },
+	{ "writes", 'w', 0, G_OPTION_ARG_INT, &n_writes,
+	  "Number of replaces and clears to average", "N" },
+	{ "random", 'r', 0, G_OPTION_ARG_NONE, &random_secrets,
+	  "Fill secrets with random characters, which hardly compress", NULL },
+	{ NULL }
+};
+
+static GHashTable *
+build_attributes (gint number)
+{
+	GHashTable *attributes;
+	gint i;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("number"), g_strdup_printf ("%d", number));
+	for (i = 1; i < n_attributes; i++)
+		g_hash_table_insert (attributes, g_strdup_printf ("attr%d", i),
+				     g_strdup_printf ("value %d of item %d", i, number));
+
+	return attributes;
+}
+
+static gchar *
+build_secret (gint number)
+{
+	gchar *secret;
+	gchar *prefix;
+	gsize n_prefix;
+
+	if (random_secrets) {
+		gint i;
+
+		secret = g_malloc (secret_size + 1);
+		for (i = 0; i < secret_size; i++)
+			secret[i] = g_random_int_range (33, 127);
+		secret[secret_size] = '\0';
+	} else {
+		secret = g_strnfill (secret_size, 'x');
+	}
+	prefix = g_strdup_printf ("%d:", number);
+	n_prefix = MIN (strlen (prefix), (gsize) secret_size);
+	memcpy (secret, prefix, n_prefix);
+	g_free (prefix);
+
+	return secret;
+}
+
+static gdouble
+elapsed (gint64 start)
+{
+	return (g_get_monotonic_time () - start) / (gdouble) G_TIME_SPAN_MILLISECOND;
+}
+
+/* Storing all of the items at once writes the keyring file once */
+static gdouble
+generate_keyring (void)
+{
+	GList *list = NULL;
+	GPtrArray *errors = NULL;
+	GError *error = NULL;
+	GHashTable *attributes;
+	gchar *secret;
+	gint64 start;
+	gboolean ret;
+	gint i;
+
+	for (i = n_items - 1; i >= 0; i--) {
+		attributes = build_attributes (i);
+		secret = build_secret (i);
+		list = g_list_prepend (list, secret_password_entry_new (&BENCH_SCHEMA,
+									attributes,
+									NULL,
+									"Bench item",
+									secret));
+		g_free (secret);
+		g_hash_table_unref (attributes);
+	}
+
+	start = g_get_monotonic_time ();
+	ret = secret_password_store_many_sync (list, NULL, &errors, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	g_list_free_full (list, (GDestroyNotify) secret_password_entry_unref);
+	g_ptr_array_unref (errors);
+
+	return elapsed (start);
+}
+
+static gdouble
+measure_derive_key (void)
+{
+	guint8 salt[SALT_SIZE];
+	GBytes *bytes;
+	GBytes *key;
+	gint64 start;
+
+	egg_keyring1_create_nonce (salt, sizeof (salt));
+	bytes = g_bytes_new (salt, sizeof (salt));
+
+	start = g_get_monotonic_time ();
+	key = egg_keyring1_derive_key ("password", 8, bytes, ITERATION_COUNT);
+	g_assert_nonnull (key);
+
+	g_bytes_unref (key);
+	g_bytes_unref (bytes);
+	return elapsed (start);
+}
+
+static gdouble
+lookup (gint number)
+{
+	GHashTable *attributes;
+	GError *error = NULL;
+	gchar *password;
+	gint64 start;
+
+	attributes = build_attributes (number);
+	start = g_get_monotonic_time ();
+	password = secret_password_lookupv_sync (&BENCH_SCHEMA, attributes, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (password);
+
+	secret_password_free (password);
+	g_hash_table_unref (attributes);
+	return elapsed (start);
+}
+
+/* Dropping the backend makes the next call read the keyring file and
+ * derive the key again */
+static gdouble
+measure_load (void)
+{
+	_secret_backend_uncache_instance ();
+	return lookup (0);
+}
+
+static gdouble
+measure_lookup (void)
+{
+	gdouble total = 0;
+	gint i;
+
+	for (i = 0; i < n_lookups; i++)
+		total += lookup (g_random_int_range (0, n_items));
+
+	return total / n_lookups;
+}
+
+static gdouble
+measure_search_all (void)
+{
+	GHashTable *attributes;
+	GError *error = NULL;
+	GList *items;
+	gint64 start;
+	gdouble ret;
+
+	attributes = g_hash_table_new (g_str_hash, g_str_equal);
+	start = g_get_monotonic_time ();
+	items = secret_password_searchv_sync (&BENCH_SCHEMA, attributes,
+					      SECRET_SEARCH_ALL, NULL, &error);
+	ret = elapsed (start);
+	g_assert_no_error (error);
+	g_assert_cmpuint (g_list_length (items), ==, n_items);
+
+	g_list_free_full (items, g_object_unref);
+	g_hash_table_unref (attributes);
+	return ret;
+}
+
+static gdouble
+measure_replace (void)
+{
+	GHashTable *attributes;
+	GError *error = NULL;
+	gdouble total = 0;
+	gchar *secret;
+	gint64 start;
+	gboolean ret;
+	gint i;
+
+	for (i = 0; i < n_writes; i++) {
+		attributes = build_attributes (i % n_items);
+		secret = build_secret (n_items + i);
+		start = g_get_monotonic_time ();
+		ret = secret_password_storev_sync (&BENCH_SCHEMA, attributes, NULL,
+						   "Replaced item", secret, NULL, &error);
+		total += elapsed (start);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+		g_free (secret);
+		g_hash_table_unref (attributes);
+	}
+
+	return total / n_writes;
+}
+
+static gdouble
+measure_clear (void)
+{
+	GHashTable *attributes;
+	GError *error = NULL;
+	gdouble total = 0;
+	gint64 start;
+	gboolean ret;
+	gint i;
+
+	for (i = 0; i < n_writes; i++) {
+		attributes = build_attributes (n_items - 1 - i);
+		start = g_get_monotonic_time ();
+		ret = secret_password_clearv_sync (&BENCH_SCHEMA, attributes, NULL, &error);
+		total += elapsed (start);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+		g_hash_table_unref (attributes);
+	}
+
+	return total / n_writes;
+}
+
+int
+main (int argc, char **argv)
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	struct rusage usage;
+	gchar *directory = NULL;
+	gchar *path;
+	GStatBuf st;
+	gdouble generate_ms;
+	gdouble derive_ms;
+	gdouble load_ms;
+	gdouble lookup_ms;
+	gdouble search_all_ms;
+	gdouble replace_ms;
+	gdouble clear_ms;
+	const gchar *envvar;
+	gboolean compress;
+
+	g_set_prgname ("bench-file-backend");
+
+	context = g_option_context_new ("- benchmark the file backend");
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		g_option_context_free (context);
+		return 2;
+	}
+	g_option_context_free (context);
+
+	if (n_items < 1 || n_attributes < 1 || n_attributes > MAX_ATTRIBUTES ||
+	    secret_size < 1 || n_lookups < 1 || n_writes < 1 || n_writes > n_items) {
+		g_printerr ("invalid arguments\n");
+		return 2;
+	}
+
+	/* A keyring given in the environment is added to, otherwise one
+	 * is generated in a scratch directory */
+	g_setenv ("SECRET_BACKEND", "file", TRUE);
+	g_setenv ("SECRET_FILE_TEST_PASSWORD", "password", FALSE);
+	if (g_getenv ("SECRET_FILE_TEST_PATH") == NULL) {
+		directory = egg_tests_create_scratch_directory (NULL, NULL);
+		path = g_build_filename (directory, "default.keyring", NULL);
+		g_setenv ("SECRET_FILE_TEST_PATH", path, TRUE);
+		g_free (path);
+	}
+	path = g_strdup (g_getenv ("SECRET_FILE_TEST_PATH"));
+	envvar = g_getenv ("SECRET_FILE_COMPRESS");
+	compress = envvar != NULL && *envvar != '\0' && g_strcmp0 (envvar, "0") != 0;
+
+	generate_ms = generate_keyring ();
+	g_assert_cmpint (g_stat (path, &st), ==, 0);
+
+	derive_ms = measure_derive_key ();
+	load_ms = measure_load ();
+	lookup_ms = measure_lookup ();
+	search_all_ms = measure_search_all ();
+	replace_ms = measure_replace ();
+	clear_ms = measure_clear ();
+
+	getrusage (RUSAGE_SELF, &usage);
+
+	g_print ("{\"benchmark\": \"file-backend\", "
+		 "\"items\": %d, \"attributes\": %d, \"secret_size\": %d, "
+		 "\"random\": %s, \"compress\": %s, "
+		 "\"file_size\": %" G_GUINT64_FORMAT ", "
+		 "\"generate_ms\": %.3f, \"write_mb_per_s\": %.3f, "
+		 "\"derive_key_ms\": %.3f, \"load_ms\": %.3f, "
+		 "\"lookup_ms\": %.3f, \"search_all_ms\": %.3f, "
+		 "\"replace_ms\": %.3f, \"clear_ms\": %.3f, "
+		 "\"peak_rss_kb\": %ld}\n",
+		 n_items, n_attributes, secret_size,
+		 random_secrets ? "true" : "false",
+		 compress ? "true" : "false",
+		 (guint64) st.st_size,
+		 generate_ms, st.st_size / (1024.0 * 1024.0) / (generate_ms / 1000.0),
+		 derive_ms, load_ms,
+		 lookup_ms, search_all_ms,
+		 replace_ms, clear_ms,
+		 usage.ru_maxrss);
+
+	_secret_backend_uncache_instance ();
+	if (directory != NULL) {
+		egg_tests_remove_scratch_directory (directory);
+		g_free (directory);
+	}
+	g_free (path);
+
+	return 0;
+}
@@ -94,6 +94,13 @@ secret_backend_default_init (SecretBackendInterface *iface)
 					 G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 }
 
+G_DEFINE_INTERFACE (SecretBatchBackend, _secret_batch_backend, SECRET_TYPE_BACKEND);
+
+static void
+_secret_batch_backend_default_init (SecretBatchBackendInterface *iface)
+{
+}
+
 void
 _secret_backend_ensure_extension_point (void)
 {
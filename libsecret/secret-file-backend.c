@@ -30,6 +30,8 @@ EGG_SECURE_DECLARE (secret_file_backend);
 #include <gio/gunixinputstream.h>
 #include <glib-unix.h>
 
+#include <string.h>
+
 #define PORTAL_BUS_NAME "org.freedesktop.portal.Desktop"
 #define PORTAL_OBJECT_PATH "/org/freedesktop/portal/desktop"
 #define PORTAL_REQUEST_INTERFACE "org.freedesktop.portal.Request"
@@ -37,18 +39,48 @@ EGG_SECURE_DECLARE (secret_file_backend);
 #define PORTAL_SECRET_INTERFACE "org.freedesktop.portal.Secret"
 #define PORTAL_SECRET_VERSION 1
 
+#define COLLECTION_FILE_SUFFIX ".keyring"
+
 static void secret_file_backend_async_initable_iface (GAsyncInitableIface *iface);
 static void secret_file_backend_backend_iface (SecretBackendInterface *iface);
+static void secret_file_backend_batch_backend_iface (SecretBatchBackendInterface *iface);
 
 struct _SecretFileBackend {
 	GObject parent;
-	SecretFileCollection *collection;
 	SecretServiceFlags init_flags;
+
+	/* Each collection is stored in its own file in this directory,
+	 * and all of them are encrypted with the same password */
+	GFile *directory;
+	gchar *default_name;
+	SecretValue *password;
+
+	/* Protects the state below, which is used from the threads
+	 * collections are opened in */
+	GMutex collections_lock;
+	/* file name → SecretFileCollection, opened on first use */
+	GHashTable *collections;
+	/* set of file names being opened, signalled with opened */
+	GHashTable *opening;
+	GCond opened;
+	/* the files of all collections as last listed, until the watch
+	 * on the directory tells that it changed */
+	GPtrArray *names;
+	SecretFileWatch *directory_watch;
+	/* set of file names which couldn't be opened, skipped until
+	 * the directory changes */
+	GHashTable *broken;
+
+	/* GMainContext → CommitQueue, callers in different main contexts
+	 * or threads commit their changes independently */
+	GMutex commit_lock;
+	GHashTable *commits;
 };
 
 G_DEFINE_TYPE_WITH_CODE (SecretFileBackend, secret_file_backend, G_TYPE_OBJECT,
 			 G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE, secret_file_backend_async_initable_iface);
 			 G_IMPLEMENT_INTERFACE (SECRET_TYPE_BACKEND, secret_file_backend_backend_iface);
+			 G_IMPLEMENT_INTERFACE (SECRET_TYPE_BATCH_BACKEND, secret_file_backend_batch_backend_iface);
 			 _secret_backend_ensure_extension_point ();
 			 g_io_extension_point_implement (SECRET_BACKEND_EXTENSION_POINT_NAME,
 							 g_define_type_id,
@@ -61,6 +93,79 @@ enum {
 	PROP_FLAGS
 };
 
+/* Whether the boolean option in the environment variable NAME is
+ * set, any value other than "0" counting as set */
+static gboolean
+env_flag (const gchar *name,
+	  gboolean def)
+{
+	const char *envvar;
+
+	envvar = g_getenv (name);
+	if (envvar == NULL || *envvar == '\0')
+		return def;
+
+	return g_strcmp0 (envvar, "0") != 0;
+}
+
+/* How long the derived key may be kept in the session keyring, so
+ * that other processes in the same session don't need to derive it */
+static guint
+key_cache_timeout (void)
+{
+	const char *envvar;
+	gchar *end = NULL;
+	guint64 value;
+
+	envvar = g_getenv ("SECRET_FILE_KEY_CACHE_TIMEOUT");
+	if (envvar == NULL || *envvar == '\0')
+		return 0;
+
+	value = g_ascii_strtoull (envvar, &end, 10);
+	if (*end != '\0' || value > G_MAXUINT)
+		return 0;
+
+	return value;
+}
+
+/* When written keyring files are synced to disk: "always" before
+ * they replace the old ones, "batched" at most every
+ * SECRET_FILE_SYNC_INTERVAL milliseconds, or "none" at all, which
+ * is only safe on a file system that doesn't survive a reboot */
+static SecretFileDurability
+durability (void)
+{
+	const char *envvar;
+
+	envvar = g_getenv ("SECRET_FILE_DURABILITY");
+	if (g_strcmp0 (envvar, "batched") == 0)
+		return SECRET_FILE_DURABILITY_BATCHED;
+	if (g_strcmp0 (envvar, "none") == 0)
+		return SECRET_FILE_DURABILITY_NONE;
+	if (envvar != NULL && *envvar != '\0' && g_strcmp0 (envvar, "always") != 0)
+		g_message ("unknown durability \"%s\", using \"always\"", envvar);
+
+	return SECRET_FILE_DURABILITY_ALWAYS;
+}
+
+static guint
+sync_interval (void)
+{
+	const char *envvar;
+	gchar *end = NULL;
+	guint64 value;
+
+	envvar = g_getenv ("SECRET_FILE_SYNC_INTERVAL");
+	if (envvar == NULL || *envvar == '\0')
+		return DEFAULT_SYNC_INTERVAL;
+
+	value = g_ascii_strtoull (envvar, &end, 10);
+	if (*end != '\0' || value > G_MAXUINT)
+		return DEFAULT_SYNC_INTERVAL;
+
+	return value;
+}
+
 /* Gets the GFile for this backend and makes sure the parent dirs exist */
 static GFile *
 get_secret_file (GCancellable *cancellable, GError **error)
@@ -109,6 +214,16 @@ get_secret_file (GCancellable *cancellable, GError **error)
 static void
 secret_file_backend_init (SecretFileBackend *self)
 {
+	self->collections = g_hash_table_new_full (g_str_hash, g_str_equal,
+						   g_free, g_object_unref);
+	self->opening = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, NULL);
+	self->broken = g_hash_table_new_full (g_str_hash, g_str_equal,
+					      g_free, NULL);
+	g_mutex_init (&self->collections_lock);
+	g_cond_init (&self->opened);
+	g_mutex_init (&self->commit_lock);
+	self->commits = g_hash_table_new (NULL, NULL);
 }
 
 static void
@@ -152,7 +267,23 @@ secret_file_backend_finalize (GObject *object)
 {
 	SecretFileBackend *self = SECRET_FILE_BACKEND (object);
 
-	g_clear_object (&self->collection);
+	g_clear_object (&self->directory);
+	g_free (self->default_name);
+	g_clear_pointer (&self->password, secret_value_unref);
+	g_hash_table_unref (self->collections);
+
+	/* Pending tasks keep the backend alive */
+	g_warn_if_fail (g_hash_table_size (self->opening) == 0);
+	g_hash_table_unref (self->opening);
+	g_clear_pointer (&self->names, g_ptr_array_unref);
+	if (self->directory_watch != NULL)
+		_secret_file_watch_free (self->directory_watch);
+	g_hash_table_unref (self->broken);
+	g_mutex_clear (&self->collections_lock);
+	g_cond_clear (&self->opened);
+	g_warn_if_fail (g_hash_table_size (self->commits) == 0);
+	g_hash_table_unref (self->commits);
+	g_mutex_clear (&self->commit_lock);
 
 	G_OBJECT_CLASS (secret_file_backend_parent_class)->finalize (object);
 }
@@ -175,30 +306,6 @@ secret_file_backend_class_init (SecretFileBackendClass *klass)
 	g_object_class_override_property (object_class, PROP_FLAGS, "flags");
 }
 
-static void
-on_collection_new_async (GObject *source_object,
-			 GAsyncResult *result,
-			 gpointer user_data)
-{
-	GTask *task = G_TASK (user_data);
-	SecretFileBackend *self = g_task_get_source_object (task);
-	GObject *object;
-	GError *error = NULL;
-
-	object = g_async_initable_new_finish (G_ASYNC_INITABLE (source_object),
-					      result,
-					      &error);
-	if (object == NULL) {
-		g_task_return_error (task, error);
-		g_object_unref (task);
-		return;
-	}
-
-	self->collection = SECRET_FILE_COLLECTION (object);
-	g_task_return_boolean (task, TRUE);
-	g_object_unref (task);
-}
-
 typedef struct {
 	gint io_priority;
 	GFile *file;
@@ -242,9 +349,9 @@ on_read_all (GObject *source_object,
 {
 	GInputStream *stream = G_INPUT_STREAM (source_object);
 	GTask *task = G_TASK (user_data);
+	SecretFileBackend *self = g_task_get_source_object (task);
 	InitClosure *init = g_task_get_task_data (task);
 	gsize bytes_read;
-	SecretValue *password;
 	GError *error = NULL;
 
 	if (!g_input_stream_read_all_finish (stream, result, &bytes_read,
@@ -263,17 +370,9 @@ on_read_all (GObject *source_object,
 		return;
 	}
 
-	password = secret_value_new (init->buffer, bytes_read, "text/plain");
-	g_async_initable_new_async (SECRET_TYPE_FILE_COLLECTION,
-				    init->io_priority,
-				    g_task_get_cancellable (task),
-				    on_collection_new_async,
-				    task,
-				    "file", g_object_ref (init->file),
-				    "password", password,
-				    NULL);
-	g_object_unref (init->file);
-	secret_value_unref (password);
+	self->password = secret_value_new (init->buffer, bytes_read, "text/plain");
+	g_task_return_boolean (task, TRUE);
+	g_object_unref (task);
 }
 
 static void
@@ -564,9 +663,9 @@ secret_file_backend_real_init_async (GAsyncInitable *initable,
 				     GAsyncReadyCallback callback,
 				     gpointer user_data)
 {
+	SecretFileBackend *self = SECRET_FILE_BACKEND (initable);
 	const char *envvar = NULL;
 	GFile *file = NULL;
-	SecretValue *password;
 	GTask *task;
 	GError *error = NULL;
 	InitClosure *init;
@@ -580,19 +679,16 @@ secret_file_backend_real_init_async (GAsyncInitable *initable,
 		return;
 	}
 
+	/* The collections themselves are only opened once used */
+	self->directory = g_file_get_parent (file);
+	self->default_name = g_file_get_basename (file);
+
 	envvar = g_getenv ("SECRET_FILE_TEST_PASSWORD");
 	if (envvar != NULL && *envvar != '\0') {
-		password = secret_value_new (envvar, -1, "text/plain");
-		g_async_initable_new_async (SECRET_TYPE_FILE_COLLECTION,
-					    io_priority,
-					    cancellable,
-					    on_collection_new_async,
-					    task,
-					    "file", file,
-					    "password", password,
-					    NULL);
+		self->password = secret_value_new (envvar, -1, "text/plain");
 		g_object_unref (file);
-		secret_value_unref (password);
+		g_task_return_boolean (task, TRUE);
+		g_object_unref (task);
 	} else if (g_file_test ("/.flatpak-info", G_FILE_TEST_EXISTS) || g_getenv ("SNAP_NAME") != NULL) {
 		init = g_new0 (InitClosure, 1);
 		init->io_priority = io_priority;
@@ -615,19 +711,12 @@ secret_file_backend_real_init_async (GAsyncInitable *initable,
 		}
 
 		data = g_bytes_get_data (decrypted, &size);
-		password = secret_value_new (data,size, "text/plain");
+		self->password = secret_value_new (data,size, "text/plain");
 		g_bytes_unref (decrypted);
-		g_async_initable_new_async (SECRET_TYPE_FILE_COLLECTION,
-					    io_priority,
-					    cancellable,
-					    on_collection_new_async,
-					    task,
-					    "file", file,
-					    "password", password,
-					    NULL);
 
 		g_object_unref (file);
-		secret_value_unref (password);
+		g_task_return_boolean (task, TRUE);
+		g_object_unref (task);
 		return;
 #else
 		g_task_return_new_error (task,
@@ -656,259 +745,1409 @@ secret_file_backend_async_initable_iface (GAsyncInitableIface *iface)
 	iface->init_finish = secret_file_backend_real_init_finish;
 }
 
+/* Maps the name of a collection, or its object path, to its file */
+static gchar *
+collection_file_name (SecretFileBackend *self,
+		      const gchar *collection,
+		      GError **error)
+{
+	const gchar *name = collection;
+	const gchar *p;
+
+	if (name != NULL && g_str_has_prefix (name, SECRET_ALIAS_PREFIX))
+		name += strlen (SECRET_ALIAS_PREFIX);
+	else if (name != NULL && name[0] == '/')
+		name = strrchr (name, '/') + 1;
+
+	if (name == NULL || g_str_equal (name, SECRET_COLLECTION_DEFAULT))
+		return g_strdup (self->default_name);
+
+	for (p = name; *p != '\0'; p++) {
+		if (!g_ascii_isalnum (*p) && *p != '_' && *p != '-')
+			break;
+	}
+
+	if (*name == '\0' || *p != '\0') {
+		g_set_error (error,
+			     SECRET_ERROR,
+			     SECRET_ERROR_NO_SUCH_OBJECT,
+			     "invalid collection name: %s", collection);
+		return NULL;
+	}
+
+	return g_strconcat (name, COLLECTION_FILE_SUFFIX, NULL);
+}
+
+/* Returns a new reference, or NULL if the collection isn't open yet */
+static SecretFileCollection *
+lookup_collection (SecretFileBackend *self,
+		   const gchar *name)
+{
+	SecretFileCollection *collection;
+
+	g_mutex_lock (&self->collections_lock);
+	collection = g_hash_table_lookup (self->collections, name);
+	if (collection != NULL)
+		g_object_ref (collection);
+	g_mutex_unlock (&self->collections_lock);
+
+	return collection;
+}
+
+/* Runs in a thread. Callers opening the same collection wait for each
+ * other here, so that none of them depends on the main context of the
+ * one which got there first */
 static void
-on_collection_write (GObject *source_object,
-		     GAsyncResult *result,
-		     gpointer user_data)
+open_collection_thread (GTask *task,
+			gpointer source_object,
+			gpointer task_data,
+			GCancellable *cancellable)
+{
+	SecretFileBackend *self = source_object;
+	const gchar *name = task_data;
+	SecretFileCollection *collection;
+	GError *error = NULL;
+	GFile *file;
+
+	g_mutex_lock (&self->collections_lock);
+	while (g_hash_table_contains (self->opening, name))
+		g_cond_wait (&self->opened, &self->collections_lock);
+	collection = g_hash_table_lookup (self->collections, name);
+	if (collection != NULL)
+		g_object_ref (collection);
+	else
+		g_hash_table_add (self->opening, g_strdup (name));
+	g_mutex_unlock (&self->collections_lock);
+
+	if (collection != NULL) {
+		g_task_return_pointer (task, collection, g_object_unref);
+		return;
+	}
+
+	/* SECRET_FILE_JOURNAL appends changes to a journal instead of
+	 * rewriting the whole file each time. SECRET_FILE_UPGRADE
+	 * rewrites files in an older format in the latest one, and
+	 * SECRET_FILE_INDEX stores an index of the attributes with the
+	 * items, neither of which older versions of libsecret can read.
+	 *
+	 * SECRET_FILE_COMPRESS compresses large secrets before they are
+	 * encrypted in upgraded files. Note that zlib allocates its
+	 * state, including the window holding the plaintext of the
+	 * secret, in ordinary memory, which may be swapped out and isn't
+	 * wiped once freed, which is why it is off by default */
+	file = g_file_get_child (self->directory, name);
+	collection = g_initable_new (SECRET_TYPE_FILE_COLLECTION,
+				     cancellable,
+				     &error,
+				     "file", file,
+				     "password", self->password,
+				     "journal", env_flag ("SECRET_FILE_JOURNAL", FALSE),
+				     "key-cache-timeout", key_cache_timeout (),
+				     "upgrade", env_flag ("SECRET_FILE_UPGRADE", FALSE),
+				     "durability", durability (),
+				     "sync-interval", sync_interval (),
+				     "index", env_flag ("SECRET_FILE_INDEX", FALSE),
+				     "compress", env_flag ("SECRET_FILE_COMPRESS", FALSE),
+				     NULL);
+	g_object_unref (file);
+
+	/* After a failure, those waiting try again themselves */
+	g_mutex_lock (&self->collections_lock);
+	if (collection != NULL)
+		g_hash_table_insert (self->collections, g_strdup (name),
+				     g_object_ref (collection));
+	g_hash_table_remove (self->opening, name);
+	g_cond_broadcast (&self->opened);
+	g_mutex_unlock (&self->collections_lock);
+
+	if (collection != NULL)
+		g_task_return_pointer (task, collection, g_object_unref);
+	else
+		g_task_return_error (task, error);
+}
+
+static void
+on_collection_refresh (GObject *source_object,
+		       GAsyncResult *result,
+		       gpointer user_data)
 {
 	SecretFileCollection *collection =
 		SECRET_FILE_COLLECTION (source_object);
 	GTask *task = G_TASK (user_data);
 	GError *error = NULL;
 
-	if (!secret_file_collection_write_finish (collection, result, &error)) {
+	if (secret_file_collection_refresh_finish (collection, result, &error))
+		g_task_return_pointer (task, g_object_ref (collection), g_object_unref);
+	else
 		g_task_return_error (task, error);
-		g_object_unref (task);
-		return;
-	}
-
-	g_task_return_boolean (task, TRUE);
 	g_object_unref (task);
 }
 
+/* Opens the collection stored in the named file on first use, and
+ * otherwise makes sure it is up to date with the file */
 static void
-secret_file_backend_real_store (SecretBackend *backend,
-				const SecretSchema *schema,
-				GHashTable *attributes,
-				const gchar *collection,
-				const gchar *label,
-				SecretValue *value,
-				GCancellable *cancellable,
-				GAsyncReadyCallback callback,
-				gpointer user_data)
+ensure_collection (SecretFileBackend *self,
+		   const gchar *name,
+		   GCancellable *cancellable,
+		   GAsyncReadyCallback callback,
+		   gpointer user_data)
 {
-	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
+	SecretFileCollection *collection;
 	GTask *task;
-	GError *error = NULL;
-
-	/* Warnings raised already */
-	if (schema != NULL && !_secret_attributes_validate (schema, attributes, G_STRFUNC, FALSE))
-		return;
 
 	task = g_task_new (self, cancellable, callback, user_data);
 
-	if (!secret_file_collection_replace (self->collection,
-					     attributes,
-					     label,
-					     value,
-					     &error)) {
-		g_task_return_error (task, error);
-		g_object_unref (task);
+	collection = lookup_collection (self, name);
+	if (collection != NULL) {
+		secret_file_collection_refresh (collection, cancellable,
+						on_collection_refresh, task);
+		g_object_unref (collection);
 		return;
 	}
 
-	secret_file_collection_write (self->collection,
-				      cancellable,
-				      on_collection_write,
-				      task);
+	g_task_set_task_data (task, g_strdup (name), g_free);
+	g_task_run_in_thread (task, open_collection_thread);
+	g_object_unref (task);
 }
 
-static gboolean
-secret_file_backend_real_store_finish (SecretBackend *backend,
-				       GAsyncResult *result,
-				       GError **error)
+static SecretFileCollection *
+ensure_collection_finish (SecretFileBackend *self,
+			  GAsyncResult *result,
+			  GError **error)
 {
-	g_return_val_if_fail (g_task_is_valid (result, backend), FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, self), NULL);
 
-	return g_task_propagate_boolean (G_TASK (result), error);
+	return g_task_propagate_pointer (G_TASK (result), error);
 }
 
-static void
-on_retrieve_secret (GObject *source_object,
-		    GAsyncResult *result,
-		    gpointer user_data)
+static gint
+compare_names (gconstpointer a,
+	       gconstpointer b)
 {
-	SecretRetrievable *retrievable = SECRET_RETRIEVABLE (source_object);
-	GTask *task = G_TASK (user_data);
-	SecretValue *value;
-	GError *error;
-
-	value = secret_retrievable_retrieve_secret_finish (retrievable,
-							   result,
-							   &error);
-	g_object_unref (retrievable);
-	if (value == NULL) {
-		g_task_return_error (task, error);
-		g_object_unref (task);
-	}
-	g_task_return_pointer (task, value, secret_value_unref);
-	g_object_unref (task);
+	return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
 }
 
+/* Lists the files of all collections, with the default one first */
 static void
-secret_file_backend_real_lookup (SecretBackend *backend,
-				 const SecretSchema *schema,
-				 GHashTable *attributes,
-				 GCancellable *cancellable,
-				 GAsyncReadyCallback callback,
-				 gpointer user_data)
+list_collections_thread (GTask *task,
+			 gpointer source_object,
+			 gpointer task_data,
+			 GCancellable *cancellable)
 {
-	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
-	GTask *task;
-	GList *matches;
-	GVariant *variant;
-	SecretFileItem *item;
+	SecretFileBackend *self = source_object;
+	GFileEnumerator *enumerator;
+	GFileInfo *info;
+	GPtrArray *names;
 	GError *error = NULL;
 
-	/* Warnings raised already */
-	if (schema != NULL && !_secret_attributes_validate (schema, attributes, G_STRFUNC, TRUE))
-		return;
-
-	task = g_task_new (self, cancellable, callback, user_data);
-
-	matches = secret_file_collection_search (self->collection, attributes);
-
-	if (matches == NULL) {
-		g_task_return_pointer (task, NULL, NULL);
-		g_object_unref (task);
-		return;
+	names = g_ptr_array_new_with_free_func (g_free);
+
+	/* Watch before listing, so that nothing added meanwhile is missed */
+	g_mutex_lock (&self->collections_lock);
+	if (self->directory_watch == NULL)
+		self->directory_watch = _secret_file_watch_directory (self->directory,
+								      COLLECTION_FILE_SUFFIX);
+	g_mutex_unlock (&self->collections_lock);
+
+	enumerator = g_file_enumerate_children (self->directory,
+						G_FILE_ATTRIBUTE_STANDARD_NAME ","
+						G_FILE_ATTRIBUTE_STANDARD_TYPE,
+						G_FILE_QUERY_INFO_NONE,
+						cancellable,
+						&error);
+	while (enumerator != NULL &&
+	       (info = g_file_enumerator_next_file (enumerator, cancellable, &error)) != NULL) {
+		const gchar *name = g_file_info_get_name (info);
+
+		if (g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR &&
+		    name[0] != '.' &&
+		    g_str_has_suffix (name, COLLECTION_FILE_SUFFIX) &&
+		    !g_str_equal (name, self->default_name))
+			g_ptr_array_add (names, g_strdup (name));
+		g_object_unref (info);
 	}
+	g_clear_object (&enumerator);
 
-	variant = g_variant_ref (matches->data);
-	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
-
-	item = _secret_file_item_decrypt (variant, self->collection, &error);
-	g_variant_unref (variant);
-	if (item == NULL) {
+	if (error != NULL &&
+	    !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+		g_ptr_array_unref (names);
 		g_task_return_error (task, error);
-		g_object_unref (task);
 		return;
 	}
+	g_clear_error (&error);
+
+	g_ptr_array_sort (names, compare_names);
+	g_ptr_array_insert (names, 0, g_strdup (self->default_name));
 
-	secret_retrievable_retrieve_secret (SECRET_RETRIEVABLE (item),
-					    cancellable,
-					    on_retrieve_secret,
-					    task);
+	g_mutex_lock (&self->collections_lock);
+	g_clear_pointer (&self->names, g_ptr_array_unref);
+	self->names = g_ptr_array_ref (names);
+	g_mutex_unlock (&self->collections_lock);
+
+	g_task_return_pointer (task, names, (GDestroyNotify) g_ptr_array_unref);
 }
 
-static SecretValue *
-secret_file_backend_real_lookup_finish (SecretBackend *backend,
-					GAsyncResult *result,
-					GError **error)
+/* Returns the files of all collections as last listed, or NULL if the
+ * directory has to be listed again */
+static GPtrArray *
+lookup_collection_names (SecretFileBackend *self)
 {
-	g_return_val_if_fail (g_task_is_valid (result, backend), NULL);
+	GPtrArray *names = NULL;
 
-	return g_task_propagate_pointer (G_TASK (result), error);
+	g_mutex_lock (&self->collections_lock);
+	if (self->directory_watch != NULL &&
+	    _secret_file_watch_check_stale (self->directory_watch)) {
+		g_clear_pointer (&self->names, g_ptr_array_unref);
+		g_hash_table_remove_all (self->broken);
+	}
+	if (self->names != NULL)
+		names = g_ptr_array_ref (self->names);
+	g_mutex_unlock (&self->collections_lock);
+
+	return names;
 }
 
+typedef struct {
+	GPtrArray *names;
+	guint pending;
+	GError *error;
+} EnsureAllClosure;
+
 static void
-secret_file_backend_real_clear (SecretBackend *backend,
-				const SecretSchema *schema,
-				GHashTable *attributes,
-				GCancellable *cancellable,
-				GAsyncReadyCallback callback,
-				gpointer user_data)
+ensure_all_closure_free (gpointer data)
 {
-	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
-	GTask *task;
-	GError *error = NULL;
-	gboolean ret;
+	EnsureAllClosure *closure = data;
 
-	/* Warnings raised already */
-	if (schema != NULL && !_secret_attributes_validate (schema, attributes, G_STRFUNC, TRUE))
-		return;
+	g_clear_pointer (&closure->names, g_ptr_array_unref);
+	g_clear_error (&closure->error);
+	g_free (closure);
+}
 
-	task = g_task_new (self, cancellable, callback, user_data);
+typedef struct {
+	GTask *task;
+	gchar *name;
+} EnsureAllOpen;
 
-	ret = secret_file_collection_clear (self->collection, attributes, &error);
-	if (error != NULL) {
-		g_task_return_error (task, error);
+static void
+ensure_all_done (SecretFileBackend *self,
+		 GTask *task)
+{
+	EnsureAllClosure *closure = g_task_get_task_data (task);
+	SecretFileCollection *collection;
+	GPtrArray *collections;
+	guint i;
+
+	if (closure->error != NULL) {
+		g_task_return_error (task, g_steal_pointer (&closure->error));
 		g_object_unref (task);
 		return;
 	}
 
-	/* No need to write as nothing has been removed. */
-	if (!ret) {
-		g_task_return_boolean (task, FALSE);
-		g_object_unref (task);
-		return;
+	collections = g_ptr_array_new_with_free_func (g_object_unref);
+	for (i = 0; i < closure->names->len; i++) {
+		const gchar *name = g_ptr_array_index (closure->names, i);
+		gboolean broken;
+
+		g_mutex_lock (&self->collections_lock);
+		broken = g_hash_table_contains (self->broken, name);
+		g_mutex_unlock (&self->collections_lock);
+
+		collection = broken ? NULL : lookup_collection (self, name);
+		if (collection != NULL)
+			g_ptr_array_add (collections, collection);
 	}
 
-	secret_file_collection_write (self->collection,
-				      cancellable,
-				      on_collection_write,
-				      task);
+	g_task_return_pointer (task, collections, (GDestroyNotify) g_ptr_array_unref);
+	g_object_unref (task);
 }
 
-static gboolean
-secret_file_backend_real_clear_finish (SecretBackend *backend,
-				       GAsyncResult *result,
-				       GError **error)
+static void
+on_ensure_all_collection (GObject *source_object,
+			  GAsyncResult *result,
+			  gpointer user_data)
 {
-	g_return_val_if_fail (g_task_is_valid (result, backend), FALSE);
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	EnsureAllOpen *open = user_data;
+	GTask *task = open->task;
+	EnsureAllClosure *closure = g_task_get_task_data (task);
+	SecretFileCollection *collection;
+	GError *error = NULL;
 
-	return g_task_propagate_boolean (G_TASK (result), error);
+	/* Other keyrings may be found next to the default one, such as
+	 * those of gnome-keyring, which must not break every lookup */
+	collection = ensure_collection_finish (self, result, &error);
+	if (collection != NULL) {
+		g_object_unref (collection);
+	} else if (g_str_equal (open->name, self->default_name)) {
+		closure->error = error;
+	} else {
+		g_message ("skipping collection %s: %s", open->name, error->message);
+		g_mutex_lock (&self->collections_lock);
+		g_hash_table_add (self->broken, g_steal_pointer (&open->name));
+		g_mutex_unlock (&self->collections_lock);
+		g_error_free (error);
+	}
+
+	g_free (open->name);
+	g_free (open);
+
+	if (--closure->pending == 0)
+		ensure_all_done (self, task);
 }
 
 static void
-unref_objects (gpointer data)
+ensure_all_names (SecretFileBackend *self,
+		  GTask *task)
 {
-	GList *list = data;
-
-	g_list_free_full (list, g_object_unref);
+	EnsureAllClosure *closure = g_task_get_task_data (task);
+	GPtrArray *names;
+	guint i;
+
+	/* Collections which couldn't be opened are left out */
+	names = g_ptr_array_new ();
+	g_mutex_lock (&self->collections_lock);
+	for (i = 0; i < closure->names->len; i++) {
+		gchar *name = g_ptr_array_index (closure->names, i);
+		if (!g_hash_table_contains (self->broken, name))
+			g_ptr_array_add (names, name);
+	}
+	g_mutex_unlock (&self->collections_lock);
+
+	closure->pending = names->len;
+	for (i = 0; i < names->len; i++) {
+		EnsureAllOpen *open = g_new0 (EnsureAllOpen, 1);
+		open->task = task;
+		open->name = g_strdup (g_ptr_array_index (names, i));
+		ensure_collection (self, open->name,
+				   g_task_get_cancellable (task),
+				   on_ensure_all_collection, open);
+	}
+	g_ptr_array_unref (names);
 }
 
 static void
-secret_file_backend_real_search (SecretBackend *backend,
-				 const SecretSchema *schema,
-				 GHashTable *attributes,
-				 SecretSearchFlags flags,
-				 GCancellable *cancellable,
-				 GAsyncReadyCallback callback,
-				 gpointer user_data)
+on_list_collections (GObject *source_object,
+		     GAsyncResult *result,
+		     gpointer user_data)
 {
-	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
-	GTask *task;
-	GList *matches;
-	GList *results = NULL;
-	GList *l;
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	GTask *task = G_TASK (user_data);
+	EnsureAllClosure *closure = g_task_get_task_data (task);
 	GError *error = NULL;
 
-	/* Warnings raised already */
-	if (schema != NULL && !_secret_attributes_validate (schema, attributes, G_STRFUNC, FALSE))
+	closure->names = g_task_propagate_pointer (G_TASK (result), &error);
+	if (closure->names == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
 		return;
+	}
+
+	ensure_all_names (self, task);
+}
+
+/* Lookups, searches and removals go through all collections */
+static void
+ensure_all_collections (SecretFileBackend *self,
+			GCancellable *cancellable,
+			GAsyncReadyCallback callback,
+			gpointer user_data)
+{
+	EnsureAllClosure *closure;
+	GTask *task;
+	GTask *list_task;
 
 	task = g_task_new (self, cancellable, callback, user_data);
+	closure = g_new0 (EnsureAllClosure, 1);
+	g_task_set_task_data (task, closure, ensure_all_closure_free);
 
-	matches = secret_file_collection_search (self->collection, attributes);
-	for (l = matches; l; l = g_list_next (l)) {
-		SecretFileItem *item = _secret_file_item_decrypt (l->data, self->collection, &error);
-		if (item == NULL) {
-			g_task_return_error (task, error);
-			g_object_unref (task);
-			return;
-		}
-		results = g_list_append (results, item);
+	/* Only list the directory again once something changed in it */
+	closure->names = lookup_collection_names (self);
+	if (closure->names != NULL) {
+		ensure_all_names (self, task);
+		return;
 	}
-	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
 
-	g_task_return_pointer (task, results, unref_objects);
-	g_object_unref (task);
+	list_task = g_task_new (self, cancellable, on_list_collections, task);
+	g_task_run_in_thread (list_task, list_collections_thread);
+	g_object_unref (list_task);
 }
 
-static GList *
-secret_file_backend_real_search_finish (SecretBackend *backend,
-					GAsyncResult *result,
-					GError **error)
+static GPtrArray *
+ensure_all_collections_finish (SecretFileBackend *self,
+			       GAsyncResult *result,
+			       GError **error)
 {
-	g_return_val_if_fail (g_task_is_valid (result, backend), NULL);
+	g_return_val_if_fail (g_task_is_valid (result, self), NULL);
 
 	return g_task_propagate_pointer (G_TASK (result), error);
 }
 
-static void
-secret_file_backend_backend_iface (SecretBackendInterface *iface)
-{
+typedef struct _CommitQueue CommitQueue;
+
+/* Changes made during the same main loop iteration, or while a write
+ * is in progress, are written to disk together and the tasks waiting
+ * for them all complete off that single write of each collection */
+typedef struct {
+	CommitQueue *queue;
+	GPtrArray *tasks;
+	/* set of changed collections */
+	GHashTable *collections;
+	guint pending;
+	GError *error;
+} CommitBatch;
+
+/* The batches of one main context. Only that context touches the
+ * batches, but the queues themselves are looked up by callers in
+ * any thread, under the commit lock. A write in progress only holds
+ * back the batches of the context it was started from: the writes
+ * complete in the threads doing them, so a synchronous call never
+ * waits on a main context it doesn't run */
+struct _CommitQueue {
+	SecretFileBackend *self;
+	GMainContext *context;
+	/* the batch still accepting changes */
+	CommitBatch *accepting;
+	/* batches waiting for the write in progress */
+	GQueue ready;
+	gboolean writing;
+};
+
+static void
+commit_batch_free (CommitBatch *batch)
+{
+	g_ptr_array_unref (batch->tasks);
+	g_hash_table_unref (batch->collections);
+	g_clear_error (&batch->error);
+	g_free (batch);
+}
+
+/* Called with the commit lock held */
+static void
+commit_queue_release (CommitQueue *queue)
+{
+	if (queue->accepting != NULL || queue->writing ||
+	    !g_queue_is_empty (&queue->ready))
+		return;
+
+	g_hash_table_remove (queue->self->commits, queue->context);
+	g_main_context_unref (queue->context);
+	g_free (queue);
+}
+
+static void commit_batch_schedule (CommitBatch *batch);
+
+static void
+on_commit_write (GObject *source_object,
+		 GAsyncResult *result,
+		 gpointer user_data)
+{
+	SecretFileCollection *collection =
+		SECRET_FILE_COLLECTION (source_object);
+	CommitBatch *batch = user_data;
+	CommitQueue *queue = batch->queue;
+	SecretFileBackend *self = queue->self;
+	CommitBatch *next;
+	GError *error = NULL;
+	guint i;
+
+	if (!secret_file_collection_write_finish (collection, result, &error)) {
+		if (batch->error == NULL)
+			batch->error = error;
+		else
+			g_error_free (error);
+	}
+
+	if (--batch->pending > 0)
+		return;
+
+	g_mutex_lock (&self->commit_lock);
+	queue->writing = FALSE;
+	next = g_queue_pop_head (&queue->ready);
+	if (next != NULL)
+		commit_batch_schedule (next);
+	else
+		commit_queue_release (queue);
+	g_mutex_unlock (&self->commit_lock);
+
+	for (i = 0; i < batch->tasks->len; i++) {
+		GTask *task = g_ptr_array_index (batch->tasks, i);
+
+		if (batch->error != NULL)
+			g_task_return_error (task, g_error_copy (batch->error));
+		else
+			g_task_return_boolean (task, TRUE);
+	}
+
+	commit_batch_free (batch);
+}
+
+static gboolean
+on_commit_idle (gpointer user_data)
+{
+	CommitBatch *batch = user_data;
+	CommitQueue *queue = batch->queue;
+	SecretFileBackend *self = queue->self;
+	GHashTableIter iter;
+	gpointer collection;
+
+	g_mutex_lock (&self->commit_lock);
+
+	/* Stop accepting changes, they go into the next batch */
+	if (queue->accepting == batch)
+		queue->accepting = NULL;
+
+	if (queue->writing) {
+		g_queue_push_tail (&queue->ready, batch);
+		g_mutex_unlock (&self->commit_lock);
+		return G_SOURCE_REMOVE;
+	}
+
+	queue->writing = TRUE;
+	g_mutex_unlock (&self->commit_lock);
+
+	/* Not cancellable, as other callers depend on the same write */
+	batch->pending = g_hash_table_size (batch->collections);
+	g_debug ("writing %u changes to %u collections",
+		 batch->tasks->len, batch->pending);
+	g_hash_table_iter_init (&iter, batch->collections);
+	while (g_hash_table_iter_next (&iter, &collection, NULL))
+		secret_file_collection_write (collection,
+					      NULL,
+					      on_commit_write,
+					      batch);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+commit_batch_schedule (CommitBatch *batch)
+{
+	GSource *source;
+
+	source = g_idle_source_new ();
+	g_source_set_priority (source, G_PRIORITY_DEFAULT);
+	g_source_set_callback (source, on_commit_idle, batch, NULL);
+	g_source_attach (source, batch->queue->context);
+	g_source_unref (source);
+}
+
+/* Completes the task once the changes made so far to the collections
+ * are on disk */
+static void
+queue_commit (SecretFileBackend *self,
+	      GTask *task,
+	      GPtrArray *collections)
+{
+	GMainContext *context = g_task_get_context (task);
+	CommitQueue *queue;
+	CommitBatch *batch;
+	guint i;
+
+	g_mutex_lock (&self->commit_lock);
+
+	queue = g_hash_table_lookup (self->commits, context);
+	if (queue == NULL) {
+		queue = g_new0 (CommitQueue, 1);
+		queue->self = self;
+		queue->context = g_main_context_ref (context);
+		g_queue_init (&queue->ready);
+		g_hash_table_insert (self->commits, context, queue);
+	}
+
+	batch = queue->accepting;
+	if (batch == NULL) {
+		batch = g_new0 (CommitBatch, 1);
+		batch->queue = queue;
+		batch->tasks = g_ptr_array_new_with_free_func (g_object_unref);
+		batch->collections = g_hash_table_new_full (NULL, NULL,
+							    g_object_unref,
+							    NULL);
+		queue->accepting = batch;
+		commit_batch_schedule (batch);
+	}
+
+	g_mutex_unlock (&self->commit_lock);
+
+	g_ptr_array_add (batch->tasks, task);
+	for (i = 0; i < collections->len; i++) {
+		gpointer collection = g_ptr_array_index (collections, i);
+
+		if (!g_hash_table_contains (batch->collections, collection))
+			g_hash_table_add (batch->collections,
+					  g_object_ref (collection));
+	}
+}
+
+/* Runs @func in a thread, with @task as its data, then @callback in the
+ * thread-default context of the caller. Only the collections are
+ * touched from the thread, as they serialize access to their state
+ * themselves; the batches of changes are left to the main context of
+ * each caller */
+static void
+run_in_thread (SecretFileBackend *self,
+	       GTask *task,
+	       GTaskThreadFunc func,
+	       GAsyncReadyCallback callback)
+{
+	GTask *thread_task;
+
+	/* Not cancellable, the collections may be changed already */
+	thread_task = g_task_new (self, NULL, callback, NULL);
+	g_task_set_task_data (thread_task, task, NULL);
+	g_task_run_in_thread (thread_task, func);
+	g_object_unref (thread_task);
+}
+
+/* Arguments of an operation waiting for the collections to be loaded */
+typedef struct {
+	GHashTable *attributes;
+	gchar *label;
+	SecretValue *value;
+	/* the collections to work on, once loaded */
+	GPtrArray *collections;
+} OperationClosure;
+
+static OperationClosure *
+operation_closure_new (GHashTable *attributes,
+		       const gchar *label,
+		       SecretValue *value)
+{
+	OperationClosure *closure;
+
+	closure = g_new0 (OperationClosure, 1);
+	closure->attributes = g_hash_table_ref (attributes);
+	closure->label = g_strdup (label);
+	if (value)
+		closure->value = secret_value_ref (value);
+
+	return closure;
+}
+
+static void
+operation_closure_free (gpointer data)
+{
+	OperationClosure *closure = data;
+
+	g_hash_table_unref (closure->attributes);
+	g_free (closure->label);
+	g_clear_pointer (&closure->value, secret_value_unref);
+	g_clear_pointer (&closure->collections, g_ptr_array_unref);
+	g_free (closure);
+}
+
+static void
+store_thread (GTask *thread_task,
+	      gpointer source_object,
+	      gpointer task_data,
+	      GCancellable *cancellable)
+{
+	GTask *task = task_data;
+	OperationClosure *closure = g_task_get_task_data (task);
+	GError *error = NULL;
+
+	if (secret_file_collection_replace (g_ptr_array_index (closure->collections, 0),
+					    closure->attributes,
+					    closure->label,
+					    closure->value,
+					    &error))
+		g_task_return_boolean (thread_task, TRUE);
+	else
+		g_task_return_error (thread_task, error);
+}
+
+static void
+on_store_thread (GObject *source_object,
+		 GAsyncResult *result,
+		 gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	GTask *task = g_task_get_task_data (G_TASK (result));
+	OperationClosure *closure = g_task_get_task_data (task);
+	GError *error = NULL;
+
+	if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	queue_commit (self, task, closure->collections);
+}
+
+static void
+on_store_collection (GObject *source_object,
+		     GAsyncResult *result,
+		     gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	GTask *task = G_TASK (user_data);
+	OperationClosure *closure = g_task_get_task_data (task);
+	SecretFileCollection *collection;
+	GError *error = NULL;
+
+	collection = ensure_collection_finish (self, result, &error);
+	if (collection == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	closure->collections = g_ptr_array_new_with_free_func (g_object_unref);
+	g_ptr_array_add (closure->collections, collection);
+	run_in_thread (self, task, store_thread, on_store_thread);
+}
+
+static void
+secret_file_backend_real_store (SecretBackend *backend,
+				const SecretSchema *schema,
+				GHashTable *attributes,
+				const gchar *collection,
+				const gchar *label,
+				SecretValue *value,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
+	GTask *task;
+	gchar *name;
+	GError *error = NULL;
+
+	/* Warnings raised already */
+	if (schema != NULL && !_secret_attributes_validate (schema, attributes, G_STRFUNC, FALSE))
+		return;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_task_data (task, operation_closure_new (attributes, label, value),
+			      operation_closure_free);
+
+	name = collection_file_name (self, collection, &error);
+	if (name == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	ensure_collection (self, name, cancellable, on_store_collection, task);
+	g_free (name);
+}
+
+static gboolean
+secret_file_backend_real_store_finish (SecretBackend *backend,
+				       GAsyncResult *result,
+				       GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, backend), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+typedef struct {
+	GPtrArray *entries;
+	/* collection file name for each entry, NULL if invalid */
+	GPtrArray *names;
+	/* a GError for each entry, or NULL once it's stored */
+	GPtrArray *errors;
+	/* collection file name → GError while opening it */
+	GHashTable *failed;
+	guint pending;
+	/* collection for each entry, NULL if it couldn't be opened */
+	GPtrArray *collections;
+	/* the collections which were changed */
+	GPtrArray *changed;
+} StoreManyClosure;
+
+static void
+free_error_if_set (gpointer data)
+{
+	if (data != NULL)
+		g_error_free (data);
+}
+
+static void
+unref_object_if_set (gpointer data)
+{
+	if (data != NULL)
+		g_object_unref (data);
+}
+
+static void
+store_many_closure_free (gpointer data)
+{
+	StoreManyClosure *closure = data;
+
+	g_ptr_array_unref (closure->entries);
+	g_ptr_array_unref (closure->names);
+	g_ptr_array_unref (closure->errors);
+	g_hash_table_unref (closure->failed);
+	g_clear_pointer (&closure->collections, g_ptr_array_unref);
+	g_clear_pointer (&closure->changed, g_ptr_array_unref);
+	g_free (closure);
+}
+
+static void
+store_many_thread (GTask *thread_task,
+		   gpointer source_object,
+		   gpointer task_data,
+		   GCancellable *cancellable)
+{
+	GTask *task = task_data;
+	StoreManyClosure *closure = g_task_get_task_data (task);
+	guint i;
+
+	for (i = 0; i < closure->entries->len; i++) {
+		SecretPasswordEntry *entry = g_ptr_array_index (closure->entries, i);
+		SecretFileCollection *collection = g_ptr_array_index (closure->collections, i);
+		GError *error = NULL;
+
+		if (collection == NULL)
+			continue;
+
+		if (!secret_file_collection_replace (collection,
+						     entry->attributes,
+						     entry->label,
+						     entry->value,
+						     &error)) {
+			closure->errors->pdata[i] = error;
+			continue;
+		}
+
+		g_ptr_array_add (closure->changed, g_object_ref (collection));
+	}
+
+	g_task_return_boolean (thread_task, TRUE);
+}
+
+static void
+on_store_many_thread (GObject *source_object,
+		      GAsyncResult *result,
+		      gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	GTask *task = g_task_get_task_data (G_TASK (result));
+	StoreManyClosure *closure = g_task_get_task_data (task);
+
+	if (closure->changed->len == 0) {
+		g_task_return_boolean (task, TRUE);
+		g_object_unref (task);
+	} else {
+		queue_commit (self, task, closure->changed);
+	}
+}
+
+/* All entries go into the collections in one go, so that they
+ * are written together */
+static void
+store_many_replace (SecretFileBackend *self,
+		    GTask *task)
+{
+	StoreManyClosure *closure = g_task_get_task_data (task);
+	guint i;
+
+	closure->collections = g_ptr_array_new_with_free_func (unref_object_if_set);
+	closure->changed = g_ptr_array_new_with_free_func (g_object_unref);
+	for (i = 0; i < closure->entries->len; i++) {
+		const gchar *name = g_ptr_array_index (closure->names, i);
+		SecretFileCollection *collection = NULL;
+		GError *error;
+
+		if (name != NULL) {
+			error = g_hash_table_lookup (closure->failed, name);
+			if (error != NULL)
+				closure->errors->pdata[i] = g_error_copy (error);
+			else
+				collection = lookup_collection (self, name);
+		}
+
+		g_ptr_array_add (closure->collections, collection);
+	}
+
+	run_in_thread (self, task, store_many_thread, on_store_many_thread);
+}
+
+typedef struct {
+	GTask *task;
+	gchar *name;
+} StoreManyOpen;
+
+static void
+on_store_many_collection (GObject *source_object,
+			  GAsyncResult *result,
+			  gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	StoreManyOpen *open = user_data;
+	GTask *task = open->task;
+	StoreManyClosure *closure = g_task_get_task_data (task);
+	SecretFileCollection *collection;
+	GError *error = NULL;
+
+	collection = ensure_collection_finish (self, result, &error);
+	if (collection == NULL)
+		g_hash_table_insert (closure->failed, g_steal_pointer (&open->name), error);
+	else
+		g_object_unref (collection);
+
+	g_free (open->name);
+	g_free (open);
+
+	if (--closure->pending == 0)
+		store_many_replace (self, task);
+}
+
+static void
+secret_file_backend_real_store_many (SecretBackend *backend,
+				     GList *entries,
+				     GCancellable *cancellable,
+				     GAsyncReadyCallback callback,
+				     gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
+	StoreManyClosure *closure;
+	GHashTable *names;
+	GHashTableIter iter;
+	gpointer name;
+	GTask *task;
+	GList *l;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	closure = g_new0 (StoreManyClosure, 1);
+	closure->entries = g_ptr_array_new_with_free_func ((GDestroyNotify) secret_password_entry_unref);
+	closure->names = g_ptr_array_new_with_free_func (g_free);
+	closure->errors = g_ptr_array_new_with_free_func (free_error_if_set);
+	closure->failed = g_hash_table_new_full (g_str_hash, g_str_equal,
+						 g_free, (GDestroyNotify) g_error_free);
+	g_task_set_task_data (task, closure, store_many_closure_free);
+
+	names = g_hash_table_new (g_str_hash, g_str_equal);
+	for (l = entries; l != NULL; l = g_list_next (l)) {
+		SecretPasswordEntry *entry = l->data;
+		GError *error = NULL;
+		gchar *file_name;
+
+		file_name = collection_file_name (self, entry->collection, &error);
+		g_ptr_array_add (closure->entries, secret_password_entry_ref (entry));
+		g_ptr_array_add (closure->names, file_name);
+		g_ptr_array_add (closure->errors, error);
+		if (file_name != NULL)
+			g_hash_table_add (names, file_name);
+	}
+
+	/* Each collection is only opened once */
+	closure->pending = g_hash_table_size (names);
+	g_hash_table_iter_init (&iter, names);
+	while (g_hash_table_iter_next (&iter, &name, NULL)) {
+		StoreManyOpen *open = g_new0 (StoreManyOpen, 1);
+
+		open->task = task;
+		open->name = g_strdup (name);
+		ensure_collection (self, name, cancellable,
+				   on_store_many_collection, open);
+	}
+
+	if (g_hash_table_size (names) == 0)
+		store_many_replace (self, task);
+	g_hash_table_unref (names);
+}
+
+static GPtrArray *
+secret_file_backend_real_store_many_finish (SecretBackend *backend,
+					    GAsyncResult *result,
+					    GError **error)
+{
+	StoreManyClosure *closure;
+
+	g_return_val_if_fail (g_task_is_valid (result, backend), NULL);
+
+	if (!g_task_propagate_boolean (G_TASK (result), error))
+		return NULL;
+
+	closure = g_task_get_task_data (G_TASK (result));
+	return g_ptr_array_ref (closure->errors);
+}
+
+static void
+lookup_thread (GTask *task,
+	       gpointer source_object,
+	       gpointer task_data,
+	       GCancellable *cancellable)
+{
+	OperationClosure *closure = task_data;
+	SecretFileCollection *collection;
+	GList *matches = NULL;
+	SecretValue *value;
+	GError *error = NULL;
+	guint i;
+
+	/* The default collection comes first */
+	for (i = 0; i < closure->collections->len && matches == NULL; i++) {
+		collection = g_ptr_array_index (closure->collections, i);
+		matches = secret_file_collection_search_items (collection, closure->attributes);
+	}
+
+	if (matches == NULL) {
+		g_task_return_pointer (task, NULL, NULL);
+		return;
+	}
+
+	/* Only the secret is needed */
+	value = secret_file_item_retrieve_value (matches->data, &error);
+	g_list_free_full (matches, g_object_unref);
+	if (value == NULL) {
+		g_task_return_error (task, error);
+		return;
+	}
+
+	g_task_return_pointer (task, value, secret_value_unref);
+}
+
+static void
+on_lookup_collections (GObject *source_object,
+		       GAsyncResult *result,
+		       gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	GTask *task = G_TASK (user_data);
+	OperationClosure *closure = g_task_get_task_data (task);
+	GError *error = NULL;
+
+	closure->collections = ensure_all_collections_finish (self, result, &error);
+	if (closure->collections == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	g_task_run_in_thread (task, lookup_thread);
+	g_object_unref (task);
+}
+
+static void
+secret_file_backend_real_lookup (SecretBackend *backend,
+				 const SecretSchema *schema,
+				 GHashTable *attributes,
+				 GCancellable *cancellable,
+				 GAsyncReadyCallback callback,
+				 gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
+	GTask *task;
+
+	/* Warnings raised already */
+	if (schema != NULL && !_secret_attributes_validate (schema, attributes, G_STRFUNC, TRUE))
+		return;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_task_data (task, operation_closure_new (attributes, NULL, NULL),
+			      operation_closure_free);
+
+	ensure_all_collections (self, cancellable, on_lookup_collections, task);
+}
+
+static SecretValue *
+secret_file_backend_real_lookup_finish (SecretBackend *backend,
+					GAsyncResult *result,
+					GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, backend), NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+typedef struct {
+	/* sets of attributes (GHashTable) of the items to remove */
+	GList *attributes;
+	GPtrArray *collections;
+	/* a failure reported once what was removed already is written */
+	GError *error;
+} ClearClosure;
+
+static ClearClosure *
+clear_closure_new (GList *attributes)
+{
+	ClearClosure *closure;
+	GList *l;
+
+	closure = g_new0 (ClearClosure, 1);
+	for (l = attributes; l != NULL; l = g_list_next (l))
+		closure->attributes = g_list_prepend (closure->attributes,
+						      g_hash_table_ref (l->data));
+	closure->attributes = g_list_reverse (closure->attributes);
+
+	return closure;
+}
+
+static void
+clear_closure_free (gpointer data)
+{
+	ClearClosure *closure = data;
+
+	g_list_free_full (closure->attributes, (GDestroyNotify) g_hash_table_unref);
+	g_clear_pointer (&closure->collections, g_ptr_array_unref);
+	g_clear_error (&closure->error);
+	g_free (closure);
+}
+
+/* Removes the items matching any of the sets of attributes from all the
+ * collections, returning those which were changed. After a failure, the
+ * error is kept in the closure if some were changed already */
+static void
+clear_thread (GTask *thread_task,
+	      gpointer source_object,
+	      gpointer task_data,
+	      GCancellable *cancellable)
+{
+	GTask *task = task_data;
+	ClearClosure *closure = g_task_get_task_data (task);
+	GPtrArray *changed;
+	GError *error = NULL;
+	GList *l;
+	guint i;
+
+	changed = g_ptr_array_new_with_free_func (g_object_unref);
+	for (i = 0; i < closure->collections->len && error == NULL; i++) {
+		SecretFileCollection *collection = g_ptr_array_index (closure->collections, i);
+		gboolean cleared = FALSE;
+
+		for (l = closure->attributes; l != NULL && error == NULL; l = g_list_next (l)) {
+			if (secret_file_collection_clear (collection, l->data, &error))
+				cleared = TRUE;
+		}
+		if (cleared)
+			g_ptr_array_add (changed, g_object_ref (collection));
+	}
+
+	/* What was removed already still needs to be written */
+	if (error != NULL && changed->len == 0) {
+		g_ptr_array_unref (changed);
+		g_task_return_error (thread_task, error);
+		return;
+	}
+
+	closure->error = error;
+	g_task_return_pointer (thread_task, changed, (GDestroyNotify) g_ptr_array_unref);
+}
+
+static void
+on_clear_commit (GObject *source_object,
+		 GAsyncResult *result,
+		 gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ClearClosure *closure = g_task_get_task_data (task);
+	GError *error = NULL;
+
+	if (!g_task_propagate_boolean (G_TASK (result), &error))
+		g_task_return_error (task, error);
+	else
+		g_task_return_error (task, g_steal_pointer (&closure->error));
+	g_object_unref (task);
+}
+
+/* Writes each changed collection once */
+static void
+on_clear_thread (GObject *source_object,
+		 GAsyncResult *result,
+		 gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	GTask *task = g_task_get_task_data (G_TASK (result));
+	ClearClosure *closure = g_task_get_task_data (task);
+	GPtrArray *changed;
+	GError *error = NULL;
+
+	changed = g_task_propagate_pointer (G_TASK (result), &error);
+	if (changed == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	/* No need to write as nothing has been removed. */
+	if (changed->len == 0) {
+		g_ptr_array_unref (changed);
+		g_task_return_boolean (task, FALSE);
+		g_object_unref (task);
+		return;
+	}
+
+	/* The failure is reported after what changed is written */
+	if (closure->error != NULL)
+		queue_commit (self, g_task_new (self, NULL, on_clear_commit, task),
+			      changed);
+	else
+		queue_commit (self, task, changed);
+	g_ptr_array_unref (changed);
+}
+
+static void
+on_clear_collections (GObject *source_object,
+		      GAsyncResult *result,
+		      gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	GTask *task = G_TASK (user_data);
+	ClearClosure *closure = g_task_get_task_data (task);
+	GError *error = NULL;
+
+	closure->collections = ensure_all_collections_finish (self, result, &error);
+	if (closure->collections == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	run_in_thread (self, task, clear_thread, on_clear_thread);
+}
+
+static void
+secret_file_backend_real_clear (SecretBackend *backend,
+				const SecretSchema *schema,
+				GHashTable *attributes,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
+	GList list = { attributes, NULL, NULL };
+	GTask *task;
+
+	/* Warnings raised already */
+	if (schema != NULL && !_secret_attributes_validate (schema, attributes, G_STRFUNC, TRUE))
+		return;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_task_data (task, clear_closure_new (&list), clear_closure_free);
+
+	ensure_all_collections (self, cancellable, on_clear_collections, task);
+}
+
+static gboolean
+secret_file_backend_real_clear_finish (SecretBackend *backend,
+				       GAsyncResult *result,
+				       GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, backend), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+secret_file_backend_real_clear_many (SecretBackend *backend,
+				     const SecretSchema *schema,
+				     GList *attributes,
+				     GCancellable *cancellable,
+				     GAsyncReadyCallback callback,
+				     gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
+	GTask *task;
+	GList *l;
+
+	/* Warnings raised already */
+	for (l = attributes; l != NULL; l = g_list_next (l)) {
+		if (schema != NULL && !_secret_attributes_validate (schema, l->data, G_STRFUNC, TRUE)) {
+			g_task_report_new_error (self, callback, user_data,
+						 secret_file_backend_real_clear_many,
+						 G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+						 "attributes don't match the schema");
+			return;
+		}
+	}
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_task_data (task, clear_closure_new (attributes), clear_closure_free);
+
+	ensure_all_collections (self, cancellable, on_clear_collections, task);
+}
+
+static void
+unref_objects (gpointer data)
+{
+	GList *list = data;
+
+	g_list_free_full (list, g_object_unref);
+}
+
+static void
+search_thread (GTask *task,
+	       gpointer source_object,
+	       gpointer task_data,
+	       GCancellable *cancellable)
+{
+	OperationClosure *closure = task_data;
+	GList *results = NULL;
+	guint i;
+
+	/* Items are decrypted once their secret or label is asked for */
+	for (i = 0; i < closure->collections->len; i++) {
+		SecretFileCollection *collection = g_ptr_array_index (closure->collections, i);
+
+		results = g_list_concat (results,
+					 secret_file_collection_search_items (collection,
+									      closure->attributes));
+	}
+
+	g_task_return_pointer (task, results, unref_objects);
+}
+
+static void
+on_search_collections (GObject *source_object,
+		       GAsyncResult *result,
+		       gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (source_object);
+	GTask *task = G_TASK (user_data);
+	OperationClosure *closure = g_task_get_task_data (task);
+	GError *error = NULL;
+
+	closure->collections = ensure_all_collections_finish (self, result, &error);
+	if (closure->collections == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	g_task_run_in_thread (task, search_thread);
+	g_object_unref (task);
+}
+
+static void
+secret_file_backend_real_search (SecretBackend *backend,
+				 const SecretSchema *schema,
+				 GHashTable *attributes,
+				 SecretSearchFlags flags,
+				 GCancellable *cancellable,
+				 GAsyncReadyCallback callback,
+				 gpointer user_data)
+{
+	SecretFileBackend *self = SECRET_FILE_BACKEND (backend);
+	GTask *task;
+
+	/* Warnings raised already */
+	if (schema != NULL && !_secret_attributes_validate (schema, attributes, G_STRFUNC, FALSE))
+		return;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_task_data (task, operation_closure_new (attributes, NULL, NULL),
+			      operation_closure_free);
+
+	ensure_all_collections (self, cancellable, on_search_collections, task);
+}
+
+static GList *
+secret_file_backend_real_search_finish (SecretBackend *backend,
+					GAsyncResult *result,
+					GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, backend), NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+secret_file_backend_backend_iface (SecretBackendInterface *iface)
+{
 	iface->store = secret_file_backend_real_store;
 	iface->store_finish = secret_file_backend_real_store_finish;
 	iface->lookup = secret_file_backend_real_lookup;
@@ -919,6 +2158,15 @@ secret_file_backend_backend_iface (SecretBackendInterface *iface)
 	iface->search_finish = secret_file_backend_real_search_finish;
 }
 
+static void
+secret_file_backend_batch_backend_iface (SecretBatchBackendInterface *iface)
+{
+	iface->store_many = secret_file_backend_real_store_many;
+	iface->store_many_finish = secret_file_backend_real_store_many_finish;
+	iface->clear_many = secret_file_backend_real_clear_many;
+	iface->clear_many_finish = secret_file_backend_real_clear_finish;
+}
+
 gboolean
 _secret_file_backend_check_portal_version (void)
 {
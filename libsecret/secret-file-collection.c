@@ -16,9 +16,20 @@
 
 #include "secret-file-collection.h"
 
+#include "egg/egg-keyctl.h"
 #include "egg/egg-keyring1.h"
 #include "egg/egg-secure-memory.h"
 
+#include <gio/gfiledescriptorbased.h>
+#include <gio/gunixoutputstream.h>
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <unistd.h>
+
 EGG_SECURE_DECLARE (secret_file_collection);
 
 #ifdef WITH_GCRYPT
@@ -29,11 +40,185 @@ EGG_SECURE_DECLARE (secret_file_collection);
 #define KEYRING_FILE_HEADER_LEN 16
 
 #define MAJOR_VERSION 1
-#define MINOR_VERSION 0
+/* Items in a version 1.0 file are encrypted with AES-128-CBC and
+ * authenticated with HMAC-SHA256, those in later versions are
+ * encrypted with AES-128-GCM, which also authenticates the hashed
+ * attributes stored alongside */
+#define MINOR_VERSION_CBC 0
+#define MINOR_VERSION_AEAD 1
+#define MINOR_VERSION_SPLIT 2
+#define MINOR_VERSION_LATEST MINOR_VERSION_SPLIT
+
+/* When this bit of the minor version is set, the GVariant contents
+ * are followed by an index of the items, then by the size of the
+ * contents as a 64-bit little endian integer. Older versions of
+ * libsecret refuse to read such files */
+#define MINOR_VERSION_INDEX_FLAG 0x80
+
+/* When this bit is set, the secrets of items in the 1.2 format may be
+ * compressed, which older versions of libsecret can't read */
+#define MINOR_VERSION_COMPRESS_FLAG 0x40
+
+/* When this bit is set, the hashed attributes of items may hold their
+ * ID and creation time, see ITEM_ID_ATTRIBUTE. Older versions of
+ * libsecret would take these for attributes, and fail to match them.
+ * It is ignored in the 1.0 format, where nothing authenticates the
+ * hashed attributes */
+#define MINOR_VERSION_BOOKKEEPING_FLAG 0x20
+
+/* When this bit is set, the file ends with a random nonce, which the
+ * journal next to it refers to. It is set as long as changes may be
+ * journaled, so that older versions of libsecret, which would miss
+ * them, refuse to read the file */
+#define MINOR_VERSION_JOURNAL_FLAG 0x10
+#define FILE_NONCE_SIZE 16
+
+#define MINOR_VERSION_FLAGS (MINOR_VERSION_INDEX_FLAG | \
+			     MINOR_VERSION_COMPRESS_FLAG | \
+			     MINOR_VERSION_BOOKKEEPING_FLAG | \
+			     MINOR_VERSION_JOURNAL_FLAG)
+
+/* Since version 1.2, the metadata and the secret of an item are
+ * encrypted on their own, so that either can be decrypted without the
+ * other. The stored blob holds the size of the metadata section as a
+ * 32-bit little endian integer, then both sections */
+enum {
+	ITEM_SECTION_METADATA = 1,
+	ITEM_SECTION_SECRET = 2,
+	ITEM_SECTION_COMPRESSED_SECRET = 3
+};
+
+/* A compressed secret is marked by this bit of the size of the metadata
+ * section, and authenticated as a section of its own. It holds the
+ * size of the secret as a 32-bit little endian integer, then the
+ * secret as a raw deflate stream. Secrets are only compressed when they
+ * are large enough for it to pay off, and kept so when it saves space */
+#define ITEM_SECRET_COMPRESSED_FLAG 0x80000000
+#define COMPRESS_MIN_SIZE 256
+#define COMPRESS_LEVEL 3
+
+/* The journal is a file next to the keyring file, holding the changes
+ * made since the keyring file was last written, as a sequence of
+ * MAC-protected records appended after a header identifying the
+ * keyring file they apply to by its nonce */
+#define JOURNAL_FILE_HEADER "GnomeKeyringJrnl"
+#define JOURNAL_FILE_HEADER_LEN 16
+#define JOURNAL_FILE_SUFFIX ".journal"
+
+/* size, modification time and usage count of the keyring file */
+#define JOURNAL_BASE_ID_LEN (8 + 8 + 4)
+#define JOURNAL_HEADER_LEN (JOURNAL_FILE_HEADER_LEN + 2 + JOURNAL_BASE_ID_LEN + \
+			    FILE_NONCE_SIZE + MAC_SIZE)
+
+/* The journal is compacted into the keyring file once it is larger
+ * than this, and than half the size of the keyring file */
+#define JOURNAL_COMPACT_SIZE (64 * 1024)
+
+/* In files marked with MINOR_VERSION_BOOKKEEPING_FLAG, each item has a
+ * random identifier stored along with its hashed attributes under this
+ * name, which is reserved; it isn't part of the key of the item, so
+ * that storing an item with the same attributes still replaces it.
+ * Items of other files are given a random one in memory on first use,
+ * which is only stored once the file is upgraded, see upgrade_items() */
+#define ITEM_ID_ATTRIBUTE "xdg:id"
+#define ITEM_ID_SIZE 16
+
+/* The creation time of an item is kept next to its ID, in the clear,
+ * as a little-endian 64-bit number, so that replacing the item doesn't
+ * need to decrypt it. Both are only trusted as part of the hashed
+ * attributes of an AEAD format, which authenticates them along with
+ * the encrypted item. The modification time of the whole keyring is
+ * stored in the clear already */
+#define ITEM_CREATED_ATTRIBUTE "xdg:created"
+
+static gboolean
+is_reserved_attribute (const gchar *name)
+{
+	return strcmp (name, ITEM_ID_ATTRIBUTE) == 0 ||
+		strcmp (name, ITEM_CREATED_ATTRIBUTE) == 0;
+}
+
+/* The index is a table of entries sorted by attribute name and MAC,
+ * each pointing to the positions in the items array of the items with
+ * that attribute value. Every entry is authenticated on its own, so
+ * that a lookup only has to check the entries it uses:
+ *
+ *   u32 number of entries
+ *   entries: u32 name offset, u32 name length, attribute MAC,
+ *            u32 first position, u32 number of positions, entry MAC
+ *   u32 number of positions
+ *   u32 positions
+ *   attribute names
+ *
+ * All integers are little endian. The MAC of an entry covers the size,
+ * modification time and usage count of the contents, as for the
+ * journal, along with the attribute name, its MAC and the positions */
+#define INDEX_ENTRY_SIZE (4 + 4 + MAC_SIZE + 4 + 4 + MAC_SIZE)
+
+/* The keyring file is written through a buffer of this size, rather
+ * than serialized in memory as a whole */
+#define WRITE_BUFFER_SIZE (64 * 1024)
+
+/* Writers in all processes take an exclusive lock on a file next to
+ * the keyring file, which can't be locked itself as it is replaced */
+#define LOCK_FILE_SUFFIX ".lock"
+
+/* How many times a write is merged with changes made by another
+ * process and tried again, before giving up */
+#define MAX_WRITE_ATTEMPTS 5
+
+enum {
+	JOURNAL_ENTRY_UPSERT = 1,
+	JOURNAL_ENTRY_TOMBSTONE = 2
+};
+
+/* Identifies a version of a file on disk, precisely enough to notice
+ * changes made within the same second */
+typedef struct {
+	guint64 inode;
+	guint64 size;
+	guint64 mtime;
+	guint32 mtime_nsec;
+} FileStamp;
+
+#if GLIB_CHECK_VERSION(2,74,0)
+#define FILE_STAMP_ATTRIBUTES_NSEC "," G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC
+#else
+#define FILE_STAMP_ATTRIBUTES_NSEC
+#endif
+
+#define FILE_STAMP_ATTRIBUTES \
+	G_FILE_ATTRIBUTE_UNIX_INODE "," \
+	G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC \
+	FILE_STAMP_ATTRIBUTES_NSEC
+
+/* Watches the keyring file and its journal for changes, from a thread
+ * shared by all collections, so that the files only need to be looked
+ * at after they have changed. The file backend also watches the
+ * directory holding the collections with it */
+typedef struct _SecretFileWatch Watch;
+
+struct _SecretFileWatch {
+	gint ref_count;
+	gint armed;
+	gint stale;
+	/* for a directory, only the files with this suffix count */
+	gchar *suffix;
+	GFile *files[2];
+	GFileMonitor *monitors[2];
+};
 
 struct _SecretFileCollection
 {
 	GObject parent;
+
+	/* Held by whatever reads or changes the state below, as the file
+	 * backend works on collections from other threads, and writes are
+	 * completed from the threads doing them */
+	GRecMutex lock;
+
 	GFile *file;
 	gchar *etag;
 	SecretValue *password;
@@ -42,41 +227,384 @@ struct _SecretFileCollection
 	GDateTime *modified;
 	guint64 usage_count;
 	GBytes *key;
-	GVariant *items;
-	guint64 file_last_modified;
+	EggKeyring1Context *context;
+	guint key_cache_timeout;
+	guint8 minor_version;
+	gboolean upgrade;
+	gboolean use_index;
+	gboolean compress;
+	/* whether the file is marked as holding compressed secrets */
+	gboolean compressed;
+	/* whether the file is marked as holding IDs and creation times */
+	gboolean bookkeeping;
+	SecretFileDurability durability;
+	guint sync_interval;
+	/* monotonic time of the last sync, and the pending one */
+	gint64 synced_time;
+	GSource *sync_source;
+	FileStamp file_stamp;
+	guint64 file_size;
+	/* the nonce at the end of a file marked for journaling */
+	GBytes *file_nonce;
+	Watch *watch;
+
+	gboolean journal;
+	GFile *journal_file;
+	FileStamp journal_stamp;
+	guint64 journal_size;
+	gboolean journal_valid;
+
+	/* bumped whenever the items are changed or reloaded */
+	guint generation;
+	/* tasks (GTask) waiting for the reload in progress, or NULL when
+	 * there is none; the items loaded before are used until it ends */
+	GPtrArray *reloads;
+
+	/* journal entries (GVariant) not yet written to disk */
+	GPtrArray *pending;
+	/* hashed attributes (GBytes) → latest journal entry (GVariant) not
+	 * yet written to disk; replayed on top of the files whenever they
+	 * are reloaded, so that changes made by other processes merge
+	 * with these item by item */
+	GHashTable *changes;
+	/* pending write operations (GTask), the head is in progress; each
+	 * is completed from the thread writing it, so that none of them
+	 * waits on the main context another caller queued its write from */
+	GQueue writes;
+
+	/* hashed attributes (GBytes) → item (GVariant); the items are
+	 * only serialized as a whole when writing the keyring file */
+	GHashTable *records;
+	/* attribute name → MAC (GBytes) → set of hashed attributes (GBytes) */
+	GHashTable *index;
+	/* hashed attributes (GBytes) → position of the item (gsize), in the
+	 * order items were read or stored, which searches and writes keep */
+	GHashTable *sequence;
+	gsize next_sequence;
+	/* item ID (GBytes) → hashed attributes (GBytes), built on first use */
+	GHashTable *ids;
+	/* hashed attributes (GBytes) → ID (GBytes) given to an item which
+	 * has none stored, kept as long as the key of the collection */
+	GHashTable *assigned_ids;
+
+	/* The items array and index read from the keyring file, as long
+	 * as the records and index above are not loaded from them */
+	GVariant *file_items;
+	GBytes *file_index;
+	gsize file_contents_size;
 };
 
+static void secret_file_collection_initable_iface (GInitableIface *iface);
 static void secret_file_collection_async_initable_iface (GAsyncInitableIface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (SecretFileCollection, secret_file_collection, G_TYPE_OBJECT,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, secret_file_collection_initable_iface);
 			 G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE, secret_file_collection_async_initable_iface);
 );
 
 enum {
 	PROP_0,
 	PROP_FILE,
-	PROP_PASSWORD
+	PROP_PASSWORD,
+	PROP_JOURNAL,
+	PROP_KEY_CACHE_TIMEOUT,
+	PROP_UPGRADE,
+	PROP_INDEX,
+	PROP_DURABILITY,
+	PROP_SYNC_INTERVAL,
+	PROP_COMPRESS
 };
 
-static guint64
-get_file_last_modified (SecretFileCollection *self)
+static void
+file_stamp_from_info (FileStamp *stamp,
+		      GFileInfo *info)
+{
+	stamp->inode = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+	stamp->size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+	stamp->mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+#if GLIB_CHECK_VERSION(2,74,0)
+	if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC))
+		stamp->mtime_nsec = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC);
+	else
+#endif
+		stamp->mtime_nsec = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC) * 1000;
+}
+
+static void
+get_file_stamp (GFile *file,
+		FileStamp *stamp)
 {
 	GFileInfo *info;
-	guint64 res;
 
-	info = g_file_query_info (self->file, G_FILE_ATTRIBUTE_TIME_MODIFIED, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	memset (stamp, 0, sizeof (FileStamp));
+
+	info = g_file_query_info (file, FILE_STAMP_ATTRIBUTES, G_FILE_QUERY_INFO_NONE, NULL, NULL);
 	if (info == NULL)
-		return 0;
+		return;
 
-	res = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	file_stamp_from_info (stamp, info);
 	g_object_unref (info);
+}
+
+static gboolean
+file_stamp_equal (const FileStamp *a,
+		  const FileStamp *b)
+{
+	return a->inode == b->inode &&
+	       a->size == b->size &&
+	       a->mtime == b->mtime &&
+	       a->mtime_nsec == b->mtime_nsec;
+}
+
+/* A single thread dispatches the file monitors and the batched syncs of
+ * all collections. It is deliberately never stopped nor joined, and
+ * lives as long as the process, like the worker threads of GDBus: a
+ * collection may still have a watch being torn down or a sync pending
+ * in it as it is finalized, and sources attached there outlive it */
+static gpointer
+watch_thread (gpointer data)
+{
+	GMainContext *context = data;
+
+	g_main_context_push_thread_default (context);
+	for (;;)
+		g_main_context_iteration (context, TRUE);
+
+	return NULL;
+}
+
+/* Started on first use, see watch_thread() */
+static GMainContext *
+get_watch_context (void)
+{
+	static gsize initialized = 0;
+	static GMainContext *context = NULL;
+
+	if (g_once_init_enter (&initialized)) {
+		context = g_main_context_new ();
+		g_thread_unref (g_thread_new ("secret-file-watch", watch_thread, context));
+		g_once_init_leave (&initialized, 1);
+	}
+
+	return context;
+}
+
+static Watch *
+watch_ref (Watch *watch)
+{
+	g_atomic_int_inc (&watch->ref_count);
+	return watch;
+}
+
+static void
+watch_unref (gpointer data)
+{
+	Watch *watch = data;
+	guint i;
+
+	if (!g_atomic_int_dec_and_test (&watch->ref_count))
+		return;
+
+	for (i = 0; i < G_N_ELEMENTS (watch->files); i++) {
+		g_clear_object (&watch->files[i]);
+		g_assert (watch->monitors[i] == NULL);
+	}
+	g_free (watch->suffix);
+	g_free (watch);
+}
+
+static void
+on_watch_changed (GFileMonitor *monitor,
+		  GFile *file,
+		  GFile *other_file,
+		  GFileMonitorEvent event_type,
+		  gpointer user_data)
+{
+	Watch *watch = user_data;
+	gchar *name;
+	gboolean matches;
+
+	if (event_type == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED)
+		return;
+
+	if (watch->suffix != NULL) {
+		name = g_file_get_basename (file);
+		matches = name[0] != '.' && g_str_has_suffix (name, watch->suffix);
+		g_free (name);
+		if (!matches)
+			return;
+	}
+
+	g_atomic_int_set (&watch->stale, 1);
+}
+
+/* Runs in the watch thread */
+static gboolean
+watch_stop (gpointer data)
+{
+	Watch *watch = data;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (watch->monitors); i++) {
+		if (watch->monitors[i] == NULL)
+			continue;
+		g_signal_handlers_disconnect_by_func (watch->monitors[i], on_watch_changed, watch);
+		g_file_monitor_cancel (watch->monitors[i]);
+		g_clear_object (&watch->monitors[i]);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Runs in the watch thread */
+static gboolean
+watch_start (gpointer data)
+{
+	Watch *watch = data;
+	GError *error = NULL;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (watch->files); i++) {
+		if (watch->files[i] == NULL)
+			continue;
+		if (watch->suffix != NULL)
+			watch->monitors[i] = g_file_monitor_directory (watch->files[i],
+								       G_FILE_MONITOR_NONE,
+								       NULL, &error);
+		else
+			watch->monitors[i] = g_file_monitor_file (watch->files[i],
+								  G_FILE_MONITOR_NONE,
+								  NULL, &error);
+		if (watch->monitors[i] == NULL) {
+			g_debug ("couldn't watch keyring file: %s", error->message);
+			g_clear_error (&error);
+			watch_stop (watch);
+			return G_SOURCE_REMOVE;
+		}
+
+		g_signal_connect (watch->monitors[i], "changed",
+				  G_CALLBACK (on_watch_changed), watch);
+	}
+
+	/* Only trust the watch once it covers all of the files */
+	g_atomic_int_set (&watch->armed, 1);
+	return G_SOURCE_REMOVE;
+}
+
+static Watch *
+watch_new (GFile *file,
+	   GFile *journal_file)
+{
+	Watch *watch;
+
+	watch = g_new0 (Watch, 1);
+	watch->ref_count = 1;
+	watch->files[0] = g_object_ref (file);
+	watch->files[1] = g_object_ref (journal_file);
+
+	g_main_context_invoke_full (get_watch_context (), G_PRIORITY_DEFAULT,
+				    watch_start, watch_ref (watch), watch_unref);
+
+	return watch;
+}
+
+static void
+watch_free (Watch *watch)
+{
+	/* The monitors are only touched from the watch thread */
+	g_main_context_invoke_full (get_watch_context (), G_PRIORITY_DEFAULT,
+				    watch_stop, watch, watch_unref);
+}
+
+/* Whether the files might have changed since the last call */
+static gboolean
+watch_check_stale (Watch *watch)
+{
+	if (!g_atomic_int_get (&watch->armed))
+		return TRUE;
+
+	return g_atomic_int_compare_and_exchange (&watch->stale, 1, 0);
+}
+
+/* Watches for files ending with @suffix being added to, removed from or
+ * changed in @directory */
+SecretFileWatch *
+_secret_file_watch_directory (GFile *directory,
+			      const gchar *suffix)
+{
+	Watch *watch;
+
+	watch = g_new0 (Watch, 1);
+	watch->ref_count = 1;
+	watch->suffix = g_strdup (suffix);
+	watch->files[0] = g_object_ref (directory);
+
+	g_main_context_invoke_full (get_watch_context (), G_PRIORITY_DEFAULT,
+				    watch_start, watch_ref (watch), watch_unref);
 
-	return res;
+	return watch;
+}
+
+gboolean
+_secret_file_watch_check_stale (SecretFileWatch *watch)
+{
+	return watch_check_stale (watch);
+}
+
+void
+_secret_file_watch_free (SecretFileWatch *watch)
+{
+	watch_free (watch);
+}
+
+static GHashTable *
+changes_new (void)
+{
+	return g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+				      (GDestroyNotify) g_bytes_unref,
+				      (GDestroyNotify) g_variant_unref);
 }
 
 static void
 secret_file_collection_init (SecretFileCollection *self)
 {
+	self->records = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+					       (GDestroyNotify) g_bytes_unref,
+					       (GDestroyNotify) g_variant_unref);
+	self->index = g_hash_table_new_full (g_str_hash, g_str_equal,
+					     g_free,
+					     (GDestroyNotify) g_hash_table_unref);
+	self->sequence = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+						(GDestroyNotify) g_bytes_unref,
+						NULL);
+	self->assigned_ids = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+						    (GDestroyNotify) g_bytes_unref,
+						    (GDestroyNotify) g_bytes_unref);
+	self->pending = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+	self->changes = changes_new ();
+	g_queue_init (&self->writes);
+	g_rec_mutex_init (&self->lock);
+}
+
+static void
+secret_file_collection_constructed (GObject *object)
+{
+	SecretFileCollection *self = SECRET_FILE_COLLECTION (object);
+	GFile *parent;
+	gchar *basename;
+	gchar *name;
+
+	G_OBJECT_CLASS (secret_file_collection_parent_class)->constructed (object);
+
+	parent = g_file_get_parent (self->file);
+	basename = g_file_get_basename (self->file);
+	name = g_strconcat (basename, JOURNAL_FILE_SUFFIX, NULL);
+	self->journal_file = g_file_get_child (parent, name);
+	g_free (name);
+	g_free (basename);
+	g_object_unref (parent);
+
+	self->watch = watch_new (self->file, self->journal_file);
 }
 
 static void
@@ -94,6 +622,27 @@ secret_file_collection_set_property (GObject      *object,
 	case PROP_PASSWORD:
 		self->password = g_value_dup_boxed (value);
 		break;
+	case PROP_JOURNAL:
+		self->journal = g_value_get_boolean (value);
+		break;
+	case PROP_KEY_CACHE_TIMEOUT:
+		self->key_cache_timeout = g_value_get_uint (value);
+		break;
+	case PROP_UPGRADE:
+		self->upgrade = g_value_get_boolean (value);
+		break;
+	case PROP_INDEX:
+		self->use_index = g_value_get_boolean (value);
+		break;
+	case PROP_DURABILITY:
+		self->durability = g_value_get_int (value);
+		break;
+	case PROP_SYNC_INTERVAL:
+		self->sync_interval = g_value_get_uint (value);
+		break;
+	case PROP_COMPRESS:
+		self->compress = g_value_get_boolean (value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -118,15 +667,34 @@ secret_file_collection_finalize (GObject *object)
 {
 	SecretFileCollection *self = SECRET_FILE_COLLECTION (object);
 
+	/* A pending sync keeps the collection alive */
+	g_warn_if_fail (self->sync_source == NULL);
+
 	g_object_unref (self->file);
 	g_free (self->etag);
+	g_object_unref (self->journal_file);
+	watch_free (self->watch);
 
 	secret_value_unref (self->password);
 
 	g_clear_pointer (&self->salt, g_bytes_unref);
 	g_clear_pointer (&self->key, g_bytes_unref);
-	g_clear_pointer (&self->items, g_variant_unref);
+	g_clear_pointer (&self->context, egg_keyring1_context_unref);
 	g_clear_pointer (&self->modified, g_date_time_unref);
+	g_clear_pointer (&self->file_nonce, g_bytes_unref);
+
+	g_hash_table_unref (self->records);
+	g_hash_table_unref (self->index);
+	g_hash_table_unref (self->sequence);
+	g_clear_pointer (&self->ids, g_hash_table_unref);
+	g_hash_table_unref (self->assigned_ids);
+	g_clear_pointer (&self->file_items, g_variant_unref);
+	g_clear_pointer (&self->file_index, g_bytes_unref);
+	g_ptr_array_unref (self->pending);
+	g_hash_table_unref (self->changes);
+	g_warn_if_fail (g_queue_is_empty (&self->writes));
+	g_warn_if_fail (self->reloads == NULL);
+	g_rec_mutex_clear (&self->lock);
 
 	G_OBJECT_CLASS (secret_file_collection_parent_class)->finalize (object);
 }
@@ -137,6 +705,7 @@ secret_file_collection_class_init (SecretFileCollectionClass *klass)
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 	object_class->set_property = secret_file_collection_set_property;
 	object_class->get_property = secret_file_collection_get_property;
+	object_class->constructed = secret_file_collection_constructed;
 	object_class->finalize = secret_file_collection_finalize;
 
 	g_object_class_install_property (object_class, PROP_FILE,
@@ -146,600 +715,4251 @@ secret_file_collection_class_init (SecretFileCollectionClass *klass)
 		   g_param_spec_boxed ("password", "password", "Password",
 				       SECRET_TYPE_VALUE,
 				       G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+	g_object_class_install_property (object_class, PROP_JOURNAL,
+		   g_param_spec_boolean ("journal", "Journal", "Append changes to a journal",
+					 FALSE,
+					 G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+	g_object_class_install_property (object_class, PROP_KEY_CACHE_TIMEOUT,
+		   g_param_spec_uint ("key-cache-timeout", "Key cache timeout",
+				      "Seconds to keep the derived key in the session keyring, or 0",
+				      0, G_MAXUINT, 0,
+				      G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+	g_object_class_install_property (object_class, PROP_UPGRADE,
+		   g_param_spec_boolean ("upgrade", "Upgrade", "Upgrade the file to the latest format",
+					 FALSE,
+					 G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+	g_object_class_install_property (object_class, PROP_INDEX,
+		   g_param_spec_boolean ("index", "Index",
+					 "Store an index of the items in the file",
+					 FALSE,
+					 G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+	g_object_class_install_property (object_class, PROP_DURABILITY,
+		   g_param_spec_int ("durability", "Durability",
+				     "When the keyring file is synced to disk",
+				     SECRET_FILE_DURABILITY_ALWAYS, SECRET_FILE_DURABILITY_NONE,
+				     SECRET_FILE_DURABILITY_ALWAYS,
+				     G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+	g_object_class_install_property (object_class, PROP_SYNC_INTERVAL,
+		   g_param_spec_uint ("sync-interval", "Sync interval",
+				      "Milliseconds between syncs with batched durability",
+				      0, G_MAXUINT, DEFAULT_SYNC_INTERVAL,
+				      G_PARAM_WRITABLE | G_PARAM_CONSTRUCT));
+	/* Beware that zlib keeps the secrets being compressed in ordinary
+	 * memory, which may be swapped out and isn't wiped */
+	g_object_class_install_property (object_class, PROP_COMPRESS,
+		   g_param_spec_boolean ("compress", "Compress",
+					 "Compress large secrets before encrypting them",
+					 FALSE,
+					 G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
 #ifdef WITH_GCRYPT
 	egg_libgcrypt_initialize ();
 #endif
 }
 
-static gboolean
-load_contents (SecretFileCollection *self,
-	       gchar *contents, /* takes ownership */
-	       gsize length,
-	       GError **error)
+static void
+builder_add_hashed_attributes (GVariantBuilder *builder,
+			       GVariant *hashed_attributes)
 {
-	gchar *p;
-	GVariant *variant;
-	GVariant *salt_array;
-	guint32 salt_size;
-	guint32 iteration_count;
-	guint64 modified_time;
-	guint64 usage_count;
-	gconstpointer data;
-	gsize n_data;
-	const gchar *password;
-	gsize n_password;
+	GVariantIter iter;
+	const gchar *name;
+	GVariant *mac;
 
-	p = contents;
-	if (length < KEYRING_FILE_HEADER_LEN ||
-	    memcmp (p, KEYRING_FILE_HEADER, KEYRING_FILE_HEADER_LEN) != 0) {
-		g_set_error_literal (error,
-				     SECRET_ERROR,
-				     SECRET_ERROR_INVALID_FILE_FORMAT,
-				     "file header mismatch");
-		return FALSE;
+	g_variant_iter_init (&iter, hashed_attributes);
+	while (g_variant_iter_next (&iter, "{&s@ay}", &name, &mac)) {
+		if (!is_reserved_attribute (name))
+			g_variant_builder_add (builder, "{s@ay}", name, mac);
+		g_variant_unref (mac);
 	}
-	p += KEYRING_FILE_HEADER_LEN;
-	length -= KEYRING_FILE_HEADER_LEN;
+}
 
-	if (length < 2 || *p != MAJOR_VERSION || *(p + 1) != MINOR_VERSION) {
-		g_set_error_literal (error,
-				     SECRET_ERROR,
-				     SECRET_ERROR_INVALID_FILE_FORMAT,
-				     "version mismatch");
-		return FALSE;
+static gboolean
+has_reserved_attributes (GVariant *hashed_attributes)
+{
+	GVariantIter iter;
+	const gchar *name;
+
+	g_variant_iter_init (&iter, hashed_attributes);
+	while (g_variant_iter_next (&iter, "{&s@ay}", &name, NULL)) {
+		if (is_reserved_attribute (name))
+			return TRUE;
 	}
-	p += 2;
-	length -= 2;
 
-	variant = g_variant_new_from_data (G_VARIANT_TYPE ("(uayutua(a{say}ay))"),
-					   p,
-					   length,
-					   TRUE,
-					   g_free,
-					   contents);
-	g_variant_get (variant, "(u@ayutu@a(a{say}ay))",
-		       &salt_size, &salt_array, &iteration_count,
-		       &modified_time, &usage_count,
-		       &self->items);
+	return FALSE;
+}
+
+/* The key of an item is the serialized form of its hashed attributes,
+ * without its ID and creation time, which is unique within a collection */
+static GBytes *
+hashed_attributes_get_key (GVariant *hashed_attributes)
+{
+	GVariantBuilder builder;
+	GVariant *variant;
+	GBytes *key;
+
+	if (!has_reserved_attributes (hashed_attributes))
+		return g_variant_get_data_as_bytes (hashed_attributes);
 
-	salt_size = GUINT32_FROM_LE(salt_size);
-	iteration_count = GUINT32_FROM_LE(iteration_count);
-	modified_time = GUINT64_FROM_LE(modified_time);
-	usage_count = GUINT32_FROM_LE(usage_count);
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{say}"));
+	builder_add_hashed_attributes (&builder, hashed_attributes);
+	variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+	key = g_variant_get_data_as_bytes (variant);
+	g_variant_unref (variant);
 
-	self->iteration_count = iteration_count;
-	self->modified = g_date_time_new_from_unix_utc (modified_time);
-	self->usage_count = usage_count;
+	return key;
+}
 
-	data = g_variant_get_fixed_array (salt_array, &n_data, sizeof(guint8));
-	g_assert (n_data == salt_size);
+static GBytes *
+item_get_key (GVariant *item,
+	      GVariant **hashed_attributes)
+{
+	GVariant *variant;
+	GBytes *key;
 
-	self->salt = g_bytes_new (data, n_data);
+	variant = g_variant_get_child_value (item, 0);
+	key = hashed_attributes_get_key (variant);
+	if (hashed_attributes)
+		*hashed_attributes = variant;
+	else
+		g_variant_unref (variant);
 
-	g_variant_unref (salt_array);
-	g_variant_unref (variant);
+	return key;
+}
 
-	password = secret_value_get (self->password, &n_password);
-	self->key = egg_keyring1_derive_key (password,
-					     n_password,
-					     self->salt,
-					     self->iteration_count);
-	if (!self->key) {
-		g_set_error_literal (error,
-				     SECRET_ERROR,
-				     SECRET_ERROR_PROTOCOL,
-				     "couldn't derive key");
-		return FALSE;
+static GBytes *
+item_get_stored_id (GVariant *item)
+{
+	GVariant *hashed_attributes;
+	GVariant *variant;
+	GBytes *id = NULL;
+
+	hashed_attributes = g_variant_get_child_value (item, 0);
+	variant = g_variant_lookup_value (hashed_attributes, ITEM_ID_ATTRIBUTE,
+					  G_VARIANT_TYPE_BYTESTRING);
+	if (variant != NULL) {
+		if (g_variant_get_size (variant) == ITEM_ID_SIZE)
+			id = g_variant_get_data_as_bytes (variant);
+		g_variant_unref (variant);
 	}
+	g_variant_unref (hashed_attributes);
 
-	return TRUE;
+	return id;
 }
 
-static gboolean
-init_empty_file (SecretFileCollection *self,
-		 GError **error)
+/* Must be called with the lock held. IDs stored in the items are only
+ * trusted in a file marked as holding them */
+static GBytes *
+item_get_id (SecretFileCollection *self,
+	     GVariant *item)
 {
-	GVariantBuilder builder;
-	const gchar *password;
-	gsize n_password;
-	guint8 salt[SALT_SIZE];
-
-	egg_keyring1_create_nonce (salt, sizeof(salt));
-	self->salt = g_bytes_new (salt, sizeof(salt));
-	self->iteration_count = ITERATION_COUNT;
-	self->modified = g_date_time_new_now_utc ();
-	self->usage_count = 0;
+	guint8 nonce[ITEM_ID_SIZE];
+	GBytes *key;
+	GBytes *id;
 
-	password = secret_value_get (self->password, &n_password);
-	self->key = egg_keyring1_derive_key (password,
-					     n_password,
-					     self->salt,
-					     self->iteration_count);
-	if (!self->key) {
-		g_set_error_literal (error,
-				     SECRET_ERROR,
-				     SECRET_ERROR_PROTOCOL,
-				     "couldn't derive key");
-		return FALSE;
+	if (self->bookkeeping) {
+		id = item_get_stored_id (item);
+		if (id != NULL)
+			return id;
 	}
 
-	g_variant_builder_init (&builder,
-				G_VARIANT_TYPE ("a(a{say}ay)"));
-	self->items = g_variant_builder_end (&builder);
-	g_variant_ref_sink (self->items);
+	key = item_get_key (item, NULL);
+	id = g_hash_table_lookup (self->assigned_ids, key);
+	if (id == NULL) {
+		egg_keyring1_create_nonce (nonce, sizeof (nonce));
+		id = g_bytes_new (nonce, sizeof (nonce));
+		g_hash_table_insert (self->assigned_ids, g_bytes_ref (key), id);
+	}
+	g_bytes_unref (key);
 
-	return TRUE;
+	return g_bytes_ref (id);
 }
 
-static void
-ensure_up_to_date (SecretFileCollection *self)
+static gchar *
+id_to_string (GBytes *id)
 {
-	guint64 last_modified;
+	const guint8 *data;
+	gsize n_data;
+	gchar *string;
+	gsize i;
 
-	last_modified = get_file_last_modified (self);
-	if (last_modified != self->file_last_modified) {
-		gchar *contents = NULL;
-		gsize length = 0;
-		gboolean success;
-		GError *error = NULL;
-		gchar *etag = NULL;
+	data = g_bytes_get_data (id, &n_data);
+	string = g_malloc (n_data * 2 + 1);
+	for (i = 0; i < n_data; i++)
+		g_snprintf (string + i * 2, 3, "%02x", data[i]);
 
-		self->file_last_modified = last_modified;
+	return string;
+}
 
-		success = g_file_load_contents (self->file, NULL, &contents, &length, &etag, &error);
+static GBytes *
+id_from_string (const gchar *string)
+{
+	guint8 data[ITEM_ID_SIZE];
+	gsize i;
 
-		if (success) {
-			g_clear_pointer (&self->etag, g_free);
-			self->etag = g_steal_pointer (&etag);
-		} else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
-			g_clear_error (&error);
+	if (strlen (string) != ITEM_ID_SIZE * 2)
+		return NULL;
 
-			success = init_empty_file (self, &error);
-		}
+	for (i = 0; i < ITEM_ID_SIZE; i++) {
+		gint high = g_ascii_xdigit_value (string[i * 2]);
+		gint low = g_ascii_xdigit_value (string[i * 2 + 1]);
 
-		if (success)
-			success = load_contents (self, contents, length, &error);
+		if (high < 0 || low < 0)
+			return NULL;
+		data[i] = (high << 4) | low;
+	}
 
-		if (!success)
-			g_debug ("Failed to load file contents: %s", error ? error->message : "Unknown error");
+	return g_bytes_new (data, ITEM_ID_SIZE);
+}
 
-		g_clear_error (&error);
+/* Items stored by older versions only have it in their metadata */
+static gboolean
+item_get_created (GVariant *item,
+		  guint64 *created)
+{
+	GVariant *hashed_attributes;
+	GVariant *variant;
+	gboolean ret = FALSE;
+
+	hashed_attributes = g_variant_get_child_value (item, 0);
+	variant = g_variant_lookup_value (hashed_attributes, ITEM_CREATED_ATTRIBUTE,
+					  G_VARIANT_TYPE_BYTESTRING);
+	if (variant != NULL) {
+		if (g_variant_get_size (variant) == sizeof (guint64)) {
+			memcpy (created, g_variant_get_data (variant), sizeof (guint64));
+			*created = GUINT64_FROM_LE (*created);
+			ret = TRUE;
+		}
+		g_variant_unref (variant);
 	}
+	g_variant_unref (hashed_attributes);
+
+	return ret;
 }
 
-static void
-on_load_contents (GObject *source_object,
-		  GAsyncResult *result,
-		  gpointer user_data)
+/* The hashed attributes of an item, along with its ID and creation time */
+static GVariant *
+hashed_attributes_add_bookkeeping (GVariant *hashed_attributes,
+				   GBytes *id,
+				   guint64 created)
 {
-	GFile *file = G_FILE (source_object);
-	GTask *task = G_TASK (user_data);
-	SecretFileCollection *self = g_task_get_source_object (task);
+	GVariantBuilder builder;
+	guint64 created_le;
+
+	created_le = GUINT64_TO_LE (created);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{say}"));
+	builder_add_hashed_attributes (&builder, hashed_attributes);
+	g_variant_builder_add (&builder, "{s@ay}", ITEM_ID_ATTRIBUTE,
+			       g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+							  g_bytes_get_data (id, NULL),
+							  g_bytes_get_size (id),
+							  sizeof (guint8)));
+	g_variant_builder_add (&builder, "{s@ay}", ITEM_CREATED_ATTRIBUTE,
+			       g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+							  &created_le,
+							  sizeof (created_le),
+							  sizeof (guint8)));
+
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+index_add_item (SecretFileCollection *self,
+		GBytes *key,
+		GVariant *hashed_attributes)
+{
+	GVariantIter iter;
+	const gchar *name;
+	GVariant *mac;
+
+	g_variant_iter_init (&iter, hashed_attributes);
+	while (g_variant_iter_next (&iter, "{&s@ay}", &name, &mac)) {
+		GHashTable *macs;
+		GHashTable *keys;
+		GBytes *digest;
+
+		if (is_reserved_attribute (name)) {
+			g_variant_unref (mac);
+			continue;
+		}
+
+		macs = g_hash_table_lookup (self->index, name);
+		if (macs == NULL) {
+			macs = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+						      (GDestroyNotify) g_bytes_unref,
+						      (GDestroyNotify) g_hash_table_unref);
+			g_hash_table_insert (self->index, g_strdup (name), macs);
+		}
+
+		digest = g_variant_get_data_as_bytes (mac);
+		keys = g_hash_table_lookup (macs, digest);
+		if (keys == NULL) {
+			keys = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+						      (GDestroyNotify) g_bytes_unref,
+						      NULL);
+			g_hash_table_insert (macs, g_bytes_ref (digest), keys);
+		}
+
+		g_hash_table_add (keys, g_bytes_ref (key));
+		g_bytes_unref (digest);
+		g_variant_unref (mac);
+	}
+}
+
+static void
+index_remove_item (SecretFileCollection *self,
+		   GBytes *key,
+		   GVariant *hashed_attributes)
+{
+	GVariantIter iter;
+	const gchar *name;
+	GVariant *mac;
+
+	g_variant_iter_init (&iter, hashed_attributes);
+	while (g_variant_iter_next (&iter, "{&s@ay}", &name, &mac)) {
+		GHashTable *macs;
+		GHashTable *keys;
+		GBytes *digest;
+
+		macs = g_hash_table_lookup (self->index, name);
+		if (macs == NULL) {
+			g_variant_unref (mac);
+			continue;
+		}
+
+		digest = g_variant_get_data_as_bytes (mac);
+		keys = g_hash_table_lookup (macs, digest);
+		if (keys != NULL) {
+			g_hash_table_remove (keys, key);
+			if (g_hash_table_size (keys) == 0)
+				g_hash_table_remove (macs, digest);
+		}
+		if (g_hash_table_size (macs) == 0)
+			g_hash_table_remove (self->index, name);
+
+		g_bytes_unref (digest);
+		g_variant_unref (mac);
+	}
+}
+
+static void
+insert_item (SecretFileCollection *self,
+	     GVariant *item)
+{
+	GVariant *hashed_attributes;
+	GBytes *key;
+
+	key = item_get_key (item, &hashed_attributes);
+	g_hash_table_replace (self->records, g_bytes_ref (key),
+			      g_variant_ref (item));
+	index_add_item (self, key, hashed_attributes);
+	/* An item put in place of another one keeps its position */
+	if (!g_hash_table_contains (self->sequence, key))
+		g_hash_table_insert (self->sequence, g_bytes_ref (key),
+				     GSIZE_TO_POINTER (self->next_sequence++));
+	if (self->ids != NULL)
+		g_hash_table_replace (self->ids, item_get_id (self, item), g_bytes_ref (key));
+	g_variant_unref (hashed_attributes);
+	g_bytes_unref (key);
+}
+
+static void
+remove_item (SecretFileCollection *self,
+	     GBytes *key)
+{
+	GVariant *item;
+	GVariant *hashed_attributes;
+
+	item = g_hash_table_lookup (self->records, key);
+	if (item == NULL)
+		return;
+
+	hashed_attributes = g_variant_get_child_value (item, 0);
+	index_remove_item (self, key, hashed_attributes);
+	g_variant_unref (hashed_attributes);
+
+	if (self->ids != NULL) {
+		GBytes *id = item_get_id (self, item);
+		g_hash_table_remove (self->ids, id);
+		g_bytes_unref (id);
+	}
+
+	g_hash_table_remove (self->sequence, key);
+	g_hash_table_remove (self->records, key);
+}
+
+/* Orders the keys of items as they were read or stored */
+static gint
+compare_sequence (gconstpointer a,
+		  gconstpointer b,
+		  gpointer user_data)
+{
+	SecretFileCollection *self = user_data;
+	gsize sa = GPOINTER_TO_SIZE (g_hash_table_lookup (self->sequence, a));
+	gsize sb = GPOINTER_TO_SIZE (g_hash_table_lookup (self->sequence, b));
+
+	return sa < sb ? -1 : (sa > sb ? 1 : 0);
+}
+
+static void
+load_items (SecretFileCollection *self,
+	    GVariant *items)
+{
+	GVariantIter iter;
+	GVariant *child;
+
+	g_hash_table_remove_all (self->records);
+	g_hash_table_remove_all (self->index);
+	g_hash_table_remove_all (self->sequence);
+	g_clear_pointer (&self->ids, g_hash_table_unref);
+
+	g_variant_iter_init (&iter, items);
+	while ((child = g_variant_iter_next_value (&iter)) != NULL) {
+		insert_item (self, child);
+		g_variant_unref (child);
+	}
+}
+
+/* Loads the items which were left in the keyring file, once something
+ * needs more than the index stored along with them */
+static void
+ensure_records (SecretFileCollection *self)
+{
+	if (self->file_items == NULL)
+		return;
+
+	load_items (self, self->file_items);
+	g_clear_pointer (&self->file_items, g_variant_unref);
+	g_clear_pointer (&self->file_index, g_bytes_unref);
+}
+
+static void
+journal_add_entry (SecretFileCollection *self,
+		   guint8 type,
+		   GVariant *value)
+{
+	GVariant *entry;
+	GBytes *key;
+
+	if (type == JOURNAL_ENTRY_UPSERT)
+		key = item_get_key (value, NULL);
+	else
+		key = hashed_attributes_get_key (value);
+
+	entry = g_variant_new ("(yv)", type, value);
+	g_ptr_array_add (self->pending, g_variant_ref_sink (entry));
+	g_hash_table_replace (self->changes, key, g_variant_ref (entry));
+}
+
+static gboolean
+journal_apply_entry (SecretFileCollection *self,
+		     GVariant *entry)
+{
+	GVariant *value;
+	GBytes *key;
+	guint8 type;
+	gboolean ret = TRUE;
+
+	ensure_records (self);
+	g_variant_get (entry, "(yv)", &type, &value);
+
+	if (type == JOURNAL_ENTRY_UPSERT &&
+	    g_variant_is_of_type (value, G_VARIANT_TYPE ("(a{say}ay)"))) {
+		key = item_get_key (value, NULL);
+		remove_item (self, key);
+		insert_item (self, value);
+		g_bytes_unref (key);
+	} else if (type == JOURNAL_ENTRY_TOMBSTONE &&
+		   g_variant_is_of_type (value, G_VARIANT_TYPE ("a{say}"))) {
+		key = hashed_attributes_get_key (value);
+		remove_item (self, key);
+		g_bytes_unref (key);
+	} else {
+		ret = FALSE;
+	}
+
+	g_variant_unref (value);
+	return ret;
+}
+
+/* Puts the changes not written yet back on top of the items and
+ * journal just loaded */
+static void
+replay_changes (SecretFileCollection *self)
+{
+	GHashTableIter iter;
+	gpointer entry;
+
+	g_hash_table_iter_init (&iter, self->changes);
+	while (g_hash_table_iter_next (&iter, NULL, &entry)) {
+		journal_apply_entry (self, entry);
+		g_ptr_array_add (self->pending, g_variant_ref (entry));
+	}
+}
+
+/* Identifies the keyring file the journal applies to */
+static void
+journal_base_id (SecretFileCollection *self,
+		 guint64 size,
+		 guint8 *buffer)
+{
+	guint64 size_le = GUINT64_TO_LE (size);
+	guint64 modified_le = GUINT64_TO_LE (g_date_time_to_unix (self->modified));
+	guint32 usage_count_le = GUINT32_TO_LE (self->usage_count);
+
+	memcpy (buffer, &size_le, 8);
+	memcpy (buffer + 8, &modified_le, 8);
+	memcpy (buffer + 16, &usage_count_le, 4);
+}
+
+static gboolean
+journal_create_header (SecretFileCollection *self,
+		       const guint8 *base_id,
+		       const guint8 *nonce,
+		       guint8 *buffer)
+{
+	guint8 *p = buffer;
+
+	memcpy (p, JOURNAL_FILE_HEADER, JOURNAL_FILE_HEADER_LEN);
+	p += JOURNAL_FILE_HEADER_LEN;
+
+	*p++ = MAJOR_VERSION;
+	*p++ = self->minor_version;
+
+	memcpy (p, base_id, JOURNAL_BASE_ID_LEN);
+	memcpy (p + JOURNAL_BASE_ID_LEN, nonce, FILE_NONCE_SIZE);
+
+	return egg_keyring1_calculate_mac (self->context,
+					   p, JOURNAL_BASE_ID_LEN + FILE_NONCE_SIZE,
+					   p + JOURNAL_BASE_ID_LEN + FILE_NONCE_SIZE);
+}
+
+static gboolean
+journal_verify_header (SecretFileCollection *self,
+		       const guint8 *data,
+		       gsize n_data)
+{
+	guint8 base_id[JOURNAL_BASE_ID_LEN];
+	const guint8 *p = data;
+
+	/* Only a file marked for journaling has a journal */
+	if (self->file_nonce == NULL)
+		return FALSE;
+
+	if (n_data < JOURNAL_HEADER_LEN ||
+	    memcmp (p, JOURNAL_FILE_HEADER, JOURNAL_FILE_HEADER_LEN) != 0)
+		return FALSE;
+	p += JOURNAL_FILE_HEADER_LEN;
+
+	if (*p != MAJOR_VERSION || *(p + 1) != self->minor_version)
+		return FALSE;
+	p += 2;
+
+	journal_base_id (self, self->file_size, base_id);
+	if (memcmp (p, base_id, JOURNAL_BASE_ID_LEN) != 0 ||
+	    memcmp (p + JOURNAL_BASE_ID_LEN, g_bytes_get_data (self->file_nonce, NULL),
+		    FILE_NONCE_SIZE) != 0)
+		return FALSE;
+
+	return egg_keyring1_verify_mac (self->context,
+					p, JOURNAL_BASE_ID_LEN + FILE_NONCE_SIZE,
+					p + JOURNAL_BASE_ID_LEN + FILE_NONCE_SIZE);
+}
+
+/* Replays the journal on top of the keyring file contents */
+static void
+load_journal (SecretFileCollection *self,
+	      GBytes *journal)
+{
+	const guint8 *contents;
+	gsize length;
+	gsize offset;
+
+	self->journal_valid = FALSE;
+	self->journal_size = 0;
+
+	if (journal == NULL)
+		return;
+
+	contents = g_bytes_get_data (journal, &length);
+
+	/* Left over from an older keyring file */
+	if (!journal_verify_header (self, contents, length)) {
+		g_debug ("ignoring journal not matching the keyring file");
+		return;
+	}
+
+	offset = JOURNAL_HEADER_LEN;
+	while (offset < length) {
+		const guint8 *data = contents + offset;
+		guint32 n_data;
+		GBytes *bytes;
+		GVariant *entry;
+		gboolean applied;
+
+		/* An incomplete record is left behind by an interrupted append */
+		if (length - offset < 4)
+			break;
+		memcpy (&n_data, data, 4);
+		n_data = GUINT32_FROM_LE (n_data);
+		data += 4;
+		if (length - offset - 4 < (gsize) n_data + MAC_SIZE)
+			break;
+
+		if (!egg_keyring1_verify_mac (self->context, data, n_data, data + n_data))
+			break;
+
+		bytes = g_bytes_new (data, n_data);
+		entry = g_variant_new_from_bytes (G_VARIANT_TYPE ("(yv)"), bytes, FALSE);
+		g_bytes_unref (bytes);
+		g_variant_ref_sink (entry);
+		applied = journal_apply_entry (self, entry);
+		g_variant_unref (entry);
+		if (!applied)
+			break;
+
+		offset += 4 + n_data + MAC_SIZE;
+	}
+
+	/* Appending after a damaged record would lose the new ones, so
+	 * the next write needs to replace the whole keyring file */
+	self->journal_valid = offset == length;
+	self->journal_size = length;
+	if (!self->journal_valid)
+		g_debug ("ignoring damaged journal records");
+}
+
+/* The keyring file and journal as read from disk. Everything which
+ * involves I/O or key derivation happens while filling this in, which
+ * can be done in a thread, so that applying it to the collection is
+ * cheap */
+typedef struct {
+	GFile *file;
+	GFile *journal_file;
+	SecretValue *password;
+	guint key_cache_timeout;
+	gboolean upgrade;
+	guint generation;
+
+	/* What is already loaded */
+	gboolean check;
+	gboolean merge;
+	FileStamp known_stamp;
+	FileStamp known_journal_stamp;
+	GBytes *known_salt;
+	guint32 known_iteration_count;
+	GBytes *known_key;
+
+	gboolean changed;
+	FileStamp stamp;
+	FileStamp journal_stamp;
+	gchar *etag;
+	gsize size;
+	guint8 minor_version;
+	gboolean compressed;
+	gboolean bookkeeping;
+	GBytes *nonce;
+	GVariant *items;
+	GBytes *index;
+	gsize contents_size;
+	GBytes *salt;
+	guint32 iteration_count;
+	guint64 modified;
+	guint32 usage_count;
+	GBytes *key;
+	EggKeyring1Context *context;
+	GBytes *journal;
+	GError *error;
+} LoadData;
+
+static LoadData *
+load_data_new (SecretFileCollection *self,
+	       gboolean check)
+{
+	LoadData *load;
+
+	load = g_new0 (LoadData, 1);
+	load->file = g_object_ref (self->file);
+	load->journal_file = g_object_ref (self->journal_file);
+	load->password = secret_value_ref (self->password);
+	load->key_cache_timeout = self->key_cache_timeout;
+	load->upgrade = self->upgrade;
+	load->generation = self->generation;
+
+	load->check = check;
+	load->known_stamp = self->file_stamp;
+	load->known_journal_stamp = self->journal_stamp;
+	if (self->salt)
+		load->known_salt = g_bytes_ref (self->salt);
+	load->known_iteration_count = self->iteration_count;
+	if (self->key)
+		load->known_key = g_bytes_ref (self->key);
+
+	return load;
+}
+
+static void
+load_data_free (gpointer data)
+{
+	LoadData *load = data;
+
+	g_object_unref (load->file);
+	g_object_unref (load->journal_file);
+	secret_value_unref (load->password);
+	g_clear_pointer (&load->known_salt, g_bytes_unref);
+	g_clear_pointer (&load->known_key, g_bytes_unref);
+	g_free (load->etag);
+	g_clear_pointer (&load->items, g_variant_unref);
+	g_clear_pointer (&load->index, g_bytes_unref);
+	g_clear_pointer (&load->nonce, g_bytes_unref);
+	g_clear_pointer (&load->salt, g_bytes_unref);
+	g_clear_pointer (&load->key, g_bytes_unref);
+	g_clear_pointer (&load->context, egg_keyring1_context_unref);
+	g_clear_pointer (&load->journal, g_bytes_unref);
+	g_clear_error (&load->error);
+	g_free (load);
+}
+
+static gsize
+read_offset (const guint8 *data,
+	     gsize offset_size)
+{
+	gsize value = 0;
+	gsize i;
+
+	/* Framing offsets are little endian */
+	for (i = 0; i < offset_size; i++)
+		value |= (gsize) data[i] << (i * 8);
+
+	return value;
+}
+
+/* The keyring file contents follow the header at an offset which is
+ * not aligned for GVariant, so wrapping it as a whole would copy it.
+ * The leading members of the (uayutua(a{say}ay)) tuple are small and
+ * easily located, so read those directly and only wrap the items
+ * array, which has an alignment of 1, in place */
+static gboolean
+parse_contents (LoadData *load,
+		GBytes *contents,
+		gsize offset,
+		gsize length)
+{
+	const guint8 *data;
+	gsize offset_size;
+	gsize salt_end;
+	gsize end;
+	gsize pos;
+	guint32 salt_size;
+	guint32 iteration_count;
+	guint64 modified_time;
+	guint32 usage_count;
+	GBytes *items;
+
+	data = g_bytes_get_data (contents, NULL);
+	data += offset;
+
+	if (length <= G_MAXUINT8)
+		offset_size = 1;
+	else if (length <= G_MAXUINT16)
+		offset_size = 2;
+	else if (length <= G_MAXUINT32)
+		offset_size = 4;
+	else
+		offset_size = 8;
+
+	if (length < 4 + offset_size)
+		return FALSE;
+	end = length - offset_size;
+
+	salt_end = read_offset (data + end, offset_size);
+	if (salt_end < 4 || salt_end > end)
+		return FALSE;
+
+	memcpy (&salt_size, data, 4);
+	salt_size = GUINT32_FROM_LE (salt_size);
+	if (salt_size != salt_end - 4)
+		return FALSE;
+
+	pos = (salt_end + 3) & ~(gsize) 3;
+	if (pos + 4 > end)
+		return FALSE;
+	memcpy (&iteration_count, data + pos, 4);
+	pos += 4;
+
+	pos = (pos + 7) & ~(gsize) 7;
+	if (pos + 8 + 4 > end)
+		return FALSE;
+	memcpy (&modified_time, data + pos, 8);
+	pos += 8;
+	memcpy (&usage_count, data + pos, 4);
+	pos += 4;
+
+	items = g_bytes_new_from_bytes (contents, offset + pos, end - pos);
+	load->items = g_variant_new_from_bytes (G_VARIANT_TYPE ("a(a{say}ay)"),
+						items, FALSE);
+	g_variant_ref_sink (load->items);
+	g_bytes_unref (items);
+
+	load->salt = g_bytes_new (data + 4, salt_size);
+	load->iteration_count = GUINT32_FROM_LE (iteration_count);
+	load->modified = GUINT64_FROM_LE (modified_time);
+	load->usage_count = GUINT32_FROM_LE (usage_count);
+
+	return TRUE;
+}
+
+static gboolean
+load_contents (LoadData *load,
+	       GBytes *contents,
+	       GError **error)
+{
+	const guint8 *p;
+	gsize length;
+
+	p = g_bytes_get_data (contents, &length);
+	load->size = length;
+
+	if (length < KEYRING_FILE_HEADER_LEN ||
+	    memcmp (p, KEYRING_FILE_HEADER, KEYRING_FILE_HEADER_LEN) != 0) {
+		g_set_error_literal (error,
+				     SECRET_ERROR,
+				     SECRET_ERROR_INVALID_FILE_FORMAT,
+				     "file header mismatch");
+		return FALSE;
+	}
+	p += KEYRING_FILE_HEADER_LEN;
+	length -= KEYRING_FILE_HEADER_LEN;
+
+	if (length < 2 || *p != MAJOR_VERSION ||
+	    (*(p + 1) & ~MINOR_VERSION_FLAGS) > MINOR_VERSION_LATEST) {
+		g_set_error_literal (error,
+				     SECRET_ERROR,
+				     SECRET_ERROR_INVALID_FILE_FORMAT,
+				     "version mismatch");
+		return FALSE;
+	}
+	load->minor_version = *(p + 1) & ~MINOR_VERSION_FLAGS;
+	load->compressed = (*(p + 1) & MINOR_VERSION_COMPRESS_FLAG) != 0;
+	load->bookkeeping = (*(p + 1) & MINOR_VERSION_BOOKKEEPING_FLAG) != 0 &&
+		load->minor_version >= MINOR_VERSION_AEAD;
+	length -= 2;
+
+	if (*(p + 1) & MINOR_VERSION_JOURNAL_FLAG) {
+		if (length < FILE_NONCE_SIZE) {
+			g_set_error_literal (error,
+					     SECRET_ERROR,
+					     SECRET_ERROR_INVALID_FILE_FORMAT,
+					     "malformed file contents");
+			return FALSE;
+		}
+		length -= FILE_NONCE_SIZE;
+		load->nonce = g_bytes_new_from_bytes (contents,
+						      KEYRING_FILE_HEADER_LEN + 2 + length,
+						      FILE_NONCE_SIZE);
+	}
+
+	load->contents_size = length;
+
+	/* The index is only checked as it is used */
+	if (*(p + 1) & MINOR_VERSION_INDEX_FLAG) {
+		guint64 contents_size;
+
+		if (length < 8) {
+			g_set_error_literal (error,
+					     SECRET_ERROR,
+					     SECRET_ERROR_INVALID_FILE_FORMAT,
+					     "malformed file contents");
+			return FALSE;
+		}
+		memcpy (&contents_size, p + 2 + length - 8, 8);
+		contents_size = GUINT64_FROM_LE (contents_size);
+		if (contents_size > length - 8) {
+			g_set_error_literal (error,
+					     SECRET_ERROR,
+					     SECRET_ERROR_INVALID_FILE_FORMAT,
+					     "malformed file contents");
+			return FALSE;
+		}
+		load->contents_size = contents_size;
+		load->index = g_bytes_new_from_bytes (contents,
+						      KEYRING_FILE_HEADER_LEN + 2 + contents_size,
+						      length - 8 - contents_size);
+	}
+
+	if (!parse_contents (load, contents, KEYRING_FILE_HEADER_LEN + 2,
+			     load->contents_size)) {
+		g_set_error_literal (error,
+				     SECRET_ERROR,
+				     SECRET_ERROR_INVALID_FILE_FORMAT,
+				     "malformed file contents");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+init_empty_file (LoadData *load)
+{
+	GVariantBuilder builder;
+	guint8 salt[SALT_SIZE];
+
+	egg_keyring1_create_nonce (salt, sizeof(salt));
+	load->salt = g_bytes_new (salt, sizeof(salt));
+	load->iteration_count = ITERATION_COUNT;
+	load->modified = g_get_real_time () / G_USEC_PER_SEC;
+	load->usage_count = 0;
+	load->size = 0;
+	load->minor_version = load->upgrade ? MINOR_VERSION_LATEST : MINOR_VERSION_CBC;
+
+	g_variant_builder_init (&builder,
+				G_VARIANT_TYPE ("a(a{say}ay)"));
+	load->items = g_variant_builder_end (&builder);
+	g_variant_ref_sink (load->items);
+}
+
+/* Maps the file read-only, falling back to reading it in where that
+ * is not possible. The etag and stamp are those of the file actually mapped */
+static GBytes *
+map_file (GFile *file,
+	  GCancellable *cancellable,
+	  FileStamp *stamp,
+	  gchar **etag,
+	  GError **error)
+{
+	GFileInputStream *stream;
+	GFileInfo *info;
+	GMappedFile *mapped;
+	GBytes *bytes;
 	gchar *contents;
 	gsize length;
-	GError *error = NULL;
+
+	stream = g_file_read (file, cancellable, error);
+	if (stream == NULL)
+		return NULL;
+
+	if (!G_IS_FILE_DESCRIPTOR_BASED (stream)) {
+		g_object_unref (stream);
+		get_file_stamp (file, stamp);
+		if (!g_file_load_contents (file, cancellable,
+					   &contents, &length, etag, error))
+			return NULL;
+		return g_bytes_new_take (contents, length);
+	}
+
+	info = g_file_input_stream_query_info (stream,
+					       FILE_STAMP_ATTRIBUTES ","
+					       G_FILE_ATTRIBUTE_ETAG_VALUE,
+					       cancellable,
+					       error);
+	if (info == NULL) {
+		g_object_unref (stream);
+		return NULL;
+	}
+
+	/* The mapping stays valid after the stream is closed */
+	mapped = g_mapped_file_new_from_fd (g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (stream)),
+					    FALSE,
+					    error);
+	g_object_unref (stream);
+	if (mapped == NULL) {
+		g_object_unref (info);
+		return NULL;
+	}
+
+	file_stamp_from_info (stamp, info);
+	if (etag)
+		*etag = g_strdup (g_file_info_get_etag (info));
+	g_object_unref (info);
+
+	bytes = g_mapped_file_get_bytes (mapped);
+	g_mapped_file_unref (mapped);
+
+	return bytes;
+}
+
+/* Identifies the derived key in the session keyring, by the file it
+ * belongs to and the parameters it was derived with. The description
+ * can be listed by anyone with access to the keyring, so nothing about
+ * the password may go into it; a key cached for another password is
+ * told apart by failing to decrypt the items instead */
+static gchar *
+key_cache_description (LoadData *load)
+{
+	GChecksum *checksum;
+	guint32 iteration_count;
+	gchar *uri;
+	gchar *description;
+
+	checksum = g_checksum_new (G_CHECKSUM_SHA256);
+	uri = g_file_get_uri (load->file);
+	g_checksum_update (checksum, (const guchar *)uri, strlen (uri) + 1);
+	g_free (uri);
+	g_checksum_update (checksum,
+			   g_bytes_get_data (load->salt, NULL),
+			   g_bytes_get_size (load->salt));
+	iteration_count = GUINT32_TO_LE (load->iteration_count);
+	g_checksum_update (checksum, (const guchar *)&iteration_count,
+			   sizeof (iteration_count));
+
+	description = g_strdup_printf ("libsecret:file-collection:%s",
+				       g_checksum_get_string (checksum));
+	g_checksum_free (checksum);
+
+	return description;
+}
+
+/* The hashed attributes and the section are authenticated along with
+ * a section of an item, so that it can't be moved to another one */
+static guint8 *
+section_aad (GVariant *hashed_attributes,
+	     guint8 section,
+	     gsize *n_aad)
+{
+	gsize n_attributes;
+	guint8 *aad;
+
+	n_attributes = g_variant_get_size (hashed_attributes);
+	aad = g_malloc (n_attributes + 1);
+	if (n_attributes > 0)
+		memcpy (aad, g_variant_get_data (hashed_attributes), n_attributes);
+	aad[n_attributes] = section;
+
+	*n_aad = n_attributes + 1;
+	return aad;
+}
+
+/* The data is laid out as for egg_keyring1_aead_encrypt() */
+static gboolean
+encrypt_section (EggKeyring1Context *context,
+		 GVariant *hashed_attributes,
+		 guint8 section,
+		 guint8 *data,
+		 gsize n_data)
+{
+	guint8 *aad;
+	gsize n_aad;
+	gboolean ret;
+
+	aad = section_aad (hashed_attributes, section, &n_aad);
+	ret = egg_keyring1_aead_encrypt (context, aad, n_aad, data, n_data);
+	g_free (aad);
+
+	return ret;
+}
+
+/* Returns the compressed form of a secret in secure memory, or NULL
+ * if it isn't any smaller. GZlibCompressor offers no way to choose the
+ * allocator of zlib, which keeps its state, including a copy of the
+ * secret in its window, in ordinary memory that is never wiped; see
+ * the "compress" property */
+static guint8 *
+compress_secret (const guint8 *secret,
+		 gsize n_secret,
+		 gsize *n_compressed)
+{
+	GZlibCompressor *compressor;
+	GConverterResult result;
+	guint8 *data;
+	guint32 size;
+	gsize n_read;
+	gsize n_written;
+
+	if (n_secret < COMPRESS_MIN_SIZE || n_secret > G_MAXUINT32)
+		return NULL;
+
+	data = egg_secure_alloc (n_secret);
+	size = GUINT32_TO_LE (n_secret);
+	memcpy (data, &size, 4);
+
+	compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW,
+					    COMPRESS_LEVEL);
+	result = g_converter_convert (G_CONVERTER (compressor),
+				      secret, n_secret,
+				      data + 4, n_secret - 4,
+				      G_CONVERTER_INPUT_AT_END,
+				      &n_read, &n_written, NULL);
+	g_object_unref (compressor);
+
+	if (result != G_CONVERTER_FINISHED) {
+		egg_secure_free (data);
+		return NULL;
+	}
+
+	*n_compressed = 4 + n_written;
+	return data;
+}
+
+/* Returns the secret in secure memory, with room for a terminator */
+static guint8 *
+decompress_secret (const guint8 *data,
+		   gsize n_data,
+		   gsize *n_secret)
+{
+	GZlibDecompressor *decompressor;
+	GConverterResult result;
+	guint8 *secret;
+	guint32 size;
+	gsize n_read;
+	gsize n_written;
+
+	if (n_data < 4)
+		return NULL;
+
+	memcpy (&size, data, 4);
+	size = GUINT32_FROM_LE (size);
+	secret = egg_secure_alloc ((gsize) size + 1);
+
+	decompressor = g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW);
+	result = g_converter_convert (G_CONVERTER (decompressor),
+				      data + 4, n_data - 4,
+				      secret, (gsize) size + 1,
+				      G_CONVERTER_INPUT_AT_END,
+				      &n_read, &n_written, NULL);
+	g_object_unref (decompressor);
+
+	if (result != G_CONVERTER_FINISHED || n_written != size) {
+		egg_secure_free (secret);
+		return NULL;
+	}
+
+	*n_secret = size;
+	return secret;
+}
+
+/* Encrypts an item in the format of the given version, returning the
+ * blob stored alongside its hashed attributes */
+static GVariant *
+encrypt_item (EggKeyring1Context *context,
+	      guint8 minor_version,
+	      gboolean compress,
+	      GVariant *hashed_attributes,
+	      SecretFileItem *item,
+	      GError **error)
+{
+	GVariant *serialized;
+	const gchar *secret;
+	gsize n_secret;
+	guint8 *compressed = NULL;
+	gsize n_compressed;
+	guint32 flags = 0;
+	guint8 *data;
+	gsize n_data;
+	gsize n_padded;
+	gsize n_blob;
+	gsize n_section;
+	guint32 n_section_le;
+	gboolean ret;
+
+	if (minor_version >= MINOR_VERSION_SPLIT) {
+		serialized = secret_file_item_serialize_metadata (item);
+		n_data = g_variant_get_size (serialized);
+		secret = secret_value_get (secret_file_item_get_value (item),
+					   &n_secret);
+
+		if (compress)
+			compressed = compress_secret ((const guint8 *) secret,
+						      n_secret, &n_compressed);
+		if (compressed != NULL) {
+			secret = (const gchar *) compressed;
+			n_secret = n_compressed;
+			flags = ITEM_SECRET_COMPRESSED_FLAG;
+		}
+
+		n_section = AEAD_NONCE_SIZE + n_data + AEAD_TAG_SIZE;
+		n_blob = 4 + n_section + AEAD_NONCE_SIZE + n_secret + AEAD_TAG_SIZE;
+		data = egg_secure_alloc (n_blob);
+
+		n_section_le = GUINT32_TO_LE (n_section | flags);
+		memcpy (data, &n_section_le, 4);
+		g_variant_store (serialized, data + 4 + AEAD_NONCE_SIZE);
+		g_variant_unref (serialized);
+		memcpy (data + 4 + n_section + AEAD_NONCE_SIZE, secret, n_secret);
+		egg_secure_free (compressed);
+
+		ret = encrypt_section (context, hashed_attributes,
+				       ITEM_SECTION_METADATA,
+				       data + 4, n_data) &&
+		      encrypt_section (context, hashed_attributes,
+				       flags ? ITEM_SECTION_COMPRESSED_SECRET :
+				       ITEM_SECTION_SECRET,
+				       data + 4 + n_section, n_secret);
+	} else if (minor_version >= MINOR_VERSION_AEAD) {
+		serialized = secret_file_item_serialize (item);
+		n_data = g_variant_get_size (serialized);
+		n_blob = AEAD_NONCE_SIZE + n_data + AEAD_TAG_SIZE;
+		data = egg_secure_alloc (n_blob);
+		g_variant_store (serialized, data + AEAD_NONCE_SIZE);
+		g_variant_unref (serialized);
+
+		ret = egg_keyring1_aead_encrypt (context,
+						 g_variant_get_data (hashed_attributes),
+						 g_variant_get_size (hashed_attributes),
+						 data, n_data);
+	} else {
+		/* Encrypt the item with PKCS #7 padding */
+		serialized = secret_file_item_serialize (item);
+		n_data = g_variant_get_size (serialized);
+		n_padded = ((n_data + CIPHER_BLOCK_SIZE) / CIPHER_BLOCK_SIZE) *
+			CIPHER_BLOCK_SIZE;
+		n_blob = n_padded + IV_SIZE + MAC_SIZE;
+		data = egg_secure_alloc (n_blob);
+		g_variant_store (serialized, data);
+		g_variant_unref (serialized);
+		memset (data + n_data, n_padded - n_data, n_padded - n_data);
+
+		ret = egg_keyring1_encrypt (context, data, n_padded);
+		if (ret && !egg_keyring1_calculate_mac (context, data, n_padded + IV_SIZE,
+							data + n_padded + IV_SIZE)) {
+			egg_secure_free (data);
+			g_set_error (error,
+				     SECRET_ERROR,
+				     SECRET_ERROR_PROTOCOL,
+				     "couldn't calculate mac");
+			return NULL;
+		}
+	}
+
+	if (!ret) {
+		egg_secure_free (data);
+		g_set_error (error,
+			     SECRET_ERROR,
+			     SECRET_ERROR_PROTOCOL,
+			     "couldn't encrypt item");
+		return NULL;
+	}
+
+	return g_variant_new_from_data (G_VARIANT_TYPE ("ay"),
+					data,
+					n_blob,
+					TRUE,
+					egg_secure_free,
+					data);
+}
+
+/* Decrypts a stored item in the formats before 1.2 into secure memory,
+ * returning the serialized item which is n_data long */
+static guint8 *
+decrypt_item (EggKeyring1Context *context,
+	      guint8 minor_version,
+	      GVariant *encrypted,
+	      gsize *n_data,
+	      GError **error)
+{
+	GVariant *hashed_attributes;
+	GVariant *blob;
+	gconstpointer padded;
+	gsize n_padded;
+	guint8 *data;
+
+	g_variant_get (encrypted, "(@a{say}@ay)", &hashed_attributes, &blob);
+
+	padded = g_variant_get_fixed_array (blob, &n_padded, sizeof(guint8));
+	data = egg_secure_alloc (MAX (n_padded, 1));
+	memcpy (data, padded, n_padded);
+	g_variant_unref (blob);
+
+	if (minor_version >= MINOR_VERSION_AEAD) {
+		gboolean ret;
+
+		ret = n_padded >= AEAD_NONCE_SIZE + AEAD_TAG_SIZE &&
+		      egg_keyring1_aead_decrypt (context,
+						 g_variant_get_data (hashed_attributes),
+						 g_variant_get_size (hashed_attributes),
+						 data,
+						 n_padded - AEAD_NONCE_SIZE - AEAD_TAG_SIZE);
+		g_variant_unref (hashed_attributes);
+
+		if (!ret) {
+			egg_secure_free (data);
+			g_set_error (error,
+				     SECRET_ERROR,
+				     SECRET_ERROR_PROTOCOL,
+				     "couldn't decrypt item");
+			return NULL;
+		}
+
+		*n_data = n_padded - AEAD_NONCE_SIZE - AEAD_TAG_SIZE;
+		memmove (data, data + AEAD_NONCE_SIZE, *n_data);
+		return data;
+	}
+
+	g_variant_unref (hashed_attributes);
+
+	if (n_padded < IV_SIZE + MAC_SIZE) {
+		egg_secure_free (data);
+		g_set_error (error,
+			     SECRET_ERROR,
+			     SECRET_ERROR_PROTOCOL,
+			     "couldn't calculate mac");
+		return NULL;
+	}
+
+	n_padded -= MAC_SIZE;
+	if (!egg_keyring1_verify_mac (context, data, n_padded, data + n_padded)) {
+		egg_secure_free (data);
+		g_set_error (error,
+			     SECRET_ERROR,
+			     SECRET_ERROR_PROTOCOL,
+			     "couldn't calculate mac");
+		return NULL;
+	}
+
+	n_padded -= IV_SIZE;
+	if (!egg_keyring1_decrypt (context, data, n_padded)) {
+		egg_secure_free (data);
+		g_set_error (error,
+			     SECRET_ERROR,
+			     SECRET_ERROR_PROTOCOL,
+			     "couldn't decrypt item");
+		return NULL;
+	}
+
+	/* Remove PKCS #7 padding */
+	*n_data = n_padded - data[n_padded - 1];
+	return data;
+}
+
+/* Decrypts a section of a stored item in the 1.2 format into secure
+ * memory, returning its contents which are n_data long; a compressed
+ * secret is returned decompressed */
+static guint8 *
+decrypt_section (EggKeyring1Context *context,
+		 GVariant *encrypted,
+		 guint8 section,
+		 gsize *n_data,
+		 GError **error)
+{
+	GVariant *hashed_attributes;
+	GVariant *blob;
+	const guint8 *p;
+	gsize n_blob;
+	guint32 n_metadata;
+	gsize n_section;
+	gboolean compressed = FALSE;
+	guint8 *data = NULL;
+	guint8 *secret;
+	guint8 *aad;
+	gsize n_aad;
+	gboolean ret = FALSE;
+
+	g_variant_get (encrypted, "(@a{say}@ay)", &hashed_attributes, &blob);
+	p = g_variant_get_fixed_array (blob, &n_blob, sizeof(guint8));
+
+	if (n_blob >= 4) {
+		memcpy (&n_metadata, p, 4);
+		n_metadata = GUINT32_FROM_LE (n_metadata);
+		compressed = (n_metadata & ITEM_SECRET_COMPRESSED_FLAG) != 0;
+		n_metadata &= ~ITEM_SECRET_COMPRESSED_FLAG;
+		if (n_metadata <= n_blob - 4) {
+			if (section == ITEM_SECTION_METADATA) {
+				p += 4;
+				n_section = n_metadata;
+			} else {
+				p += 4 + n_metadata;
+				n_section = n_blob - 4 - n_metadata;
+				if (compressed)
+					section = ITEM_SECTION_COMPRESSED_SECRET;
+			}
+			ret = n_section >= AEAD_NONCE_SIZE + AEAD_TAG_SIZE;
+		}
+	}
+
+	if (ret) {
+		*n_data = n_section - AEAD_NONCE_SIZE - AEAD_TAG_SIZE;
+		data = egg_secure_alloc (n_section);
+		memcpy (data, p, n_section);
+
+		aad = section_aad (hashed_attributes, section, &n_aad);
+		ret = egg_keyring1_aead_decrypt (context, aad, n_aad, data, *n_data);
+		g_free (aad);
+	}
+
+	g_variant_unref (blob);
+	g_variant_unref (hashed_attributes);
+
+	if (!ret) {
+		egg_secure_free (data);
+		g_set_error (error,
+			     SECRET_ERROR,
+			     SECRET_ERROR_PROTOCOL,
+			     "couldn't decrypt item");
+		return NULL;
+	}
+
+	if (section == ITEM_SECTION_COMPRESSED_SECRET) {
+		secret = decompress_secret (data + AEAD_NONCE_SIZE, *n_data, n_data);
+		egg_secure_free (data);
+		if (secret == NULL)
+			g_set_error (error,
+				     SECRET_ERROR,
+				     SECRET_ERROR_PROTOCOL,
+				     "couldn't decompress item");
+		return secret;
+	}
+
+	memmove (data, data + AEAD_NONCE_SIZE, *n_data);
+	return data;
+}
+
+static GVariant *
+decrypt_serialized (EggKeyring1Context *context,
+		    guint8 minor_version,
+		    GVariant *encrypted,
+		    GError **error)
+{
+	guint8 *data;
+	gsize n_data;
+
+	if (minor_version >= MINOR_VERSION_SPLIT)
+		data = decrypt_section (context, encrypted, ITEM_SECTION_METADATA,
+					&n_data, error);
+	else
+		data = decrypt_item (context, minor_version, encrypted,
+				     &n_data, error);
+	if (data == NULL)
+		return NULL;
+
+	return g_variant_new_from_data (minor_version >= MINOR_VERSION_SPLIT ?
+					G_VARIANT_TYPE ("(a{ss}stt)") :
+					G_VARIANT_TYPE ("(a{ss}sttay)"),
+					data,
+					n_data,
+					TRUE,
+					egg_secure_free,
+					data);
+}
+
+/* Decrypts only the secret of a stored item, where possible */
+static SecretValue *
+decrypt_value (EggKeyring1Context *context,
+	       guint8 minor_version,
+	       GVariant *encrypted,
+	       GError **error)
+{
+	GVariant *serialized;
+	GVariant *array;
+	gconstpointer secret;
+	gsize n_secret;
+	SecretValue *value;
+	guint8 *data;
+	gsize n_data;
+
+	if (minor_version >= MINOR_VERSION_SPLIT) {
+		data = decrypt_section (context, encrypted, ITEM_SECTION_SECRET,
+					&n_data, error);
+		if (data == NULL)
+			return NULL;
+
+		/* There's room for a terminator where the nonce was */
+		data[n_data] = '\0';
+		return secret_value_new_full ((gchar *) data, n_data,
+					      "text/plain", egg_secure_free);
+	}
+
+	serialized = decrypt_serialized (context, minor_version, encrypted, error);
+	if (serialized == NULL)
+		return NULL;
+
+	g_variant_ref_sink (serialized);
+	array = g_variant_get_child_value (serialized, 4);
+	secret = g_variant_get_fixed_array (array, &n_secret, sizeof(gchar));
+	value = secret_value_new (secret, n_secret, "text/plain");
+	g_variant_unref (array);
+	g_variant_unref (serialized);
+
+	return value;
+}
+
+/* Decrypts a stored item; the secret is left out when it is stored
+ * separately, unless it is asked for */
+static SecretFileItem *
+decrypt_full (EggKeyring1Context *context,
+	      guint8 minor_version,
+	      GVariant *encrypted,
+	      gboolean with_value,
+	      GError **error)
+{
+	GVariant *serialized;
+	SecretValue *value = NULL;
+	SecretFileItem *item;
+
+	if (with_value && minor_version >= MINOR_VERSION_SPLIT) {
+		value = decrypt_value (context, minor_version, encrypted, error);
+		if (value == NULL)
+			return NULL;
+	}
+
+	serialized = decrypt_serialized (context, minor_version, encrypted, error);
+	if (serialized == NULL) {
+		if (value)
+			secret_value_unref (value);
+		return NULL;
+	}
+
+	g_variant_ref_sink (serialized);
+	if (minor_version >= MINOR_VERSION_SPLIT)
+		item = secret_file_item_deserialize_metadata (serialized, value);
+	else
+		item = secret_file_item_deserialize (serialized);
+	g_variant_unref (serialized);
+
+	if (value)
+		secret_value_unref (value);
+	return item;
+}
+
+/* Re-encrypts every item in the latest format, along with its ID and
+ * creation time. Nothing is changed unless all of the items could be */
+static gboolean
+upgrade_items (SecretFileCollection *self,
+	       GError **error)
+{
+	GPtrArray *upgraded;
+	GHashTableIter iter;
+	GVariant *record;
+	guint i;
+
+	ensure_records (self);
+	upgraded = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+
+	g_hash_table_iter_init (&iter, self->records);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &record)) {
+		GVariant *hashed_attributes;
+		GVariant *with_bookkeeping;
+		SecretFileItem *item;
+		GVariant *blob;
+		GBytes *id;
+		guint64 created;
+
+		item = decrypt_full (self->context, self->minor_version, record,
+				     TRUE, error);
+		if (item == NULL) {
+			g_ptr_array_unref (upgraded);
+			return FALSE;
+		}
+
+		/* Those given in memory are the ones stored */
+		id = item_get_id (self, record);
+		g_object_get (item, "created", &created, NULL);
+
+		hashed_attributes = g_variant_get_child_value (record, 0);
+		with_bookkeeping = hashed_attributes_add_bookkeeping (hashed_attributes,
+								      id, created);
+		g_variant_unref (hashed_attributes);
+		g_bytes_unref (id);
+
+		/* The file is marked as holding compressed secrets
+		 * once it is upgraded */
+		blob = encrypt_item (self->context, MINOR_VERSION_LATEST,
+				     self->compress, with_bookkeeping, item,
+				     error);
+		g_object_unref (item);
+		if (blob == NULL) {
+			g_variant_unref (with_bookkeeping);
+			g_ptr_array_unref (upgraded);
+			return FALSE;
+		}
+
+		record = g_variant_new ("(@a{say}@ay)", with_bookkeeping, blob);
+		g_ptr_array_add (upgraded, g_variant_ref_sink (record));
+		g_variant_unref (with_bookkeeping);
+	}
+
+	for (i = 0; i < upgraded->len; i++)
+		insert_item (self, upgraded->pdata[i]);
+	g_ptr_array_unref (upgraded);
+
+	self->minor_version = MINOR_VERSION_LATEST;
+	self->bookkeeping = TRUE;
+	g_hash_table_remove_all (self->assigned_ids);
+	if (self->compress)
+		self->compressed = TRUE;
+
+	/* The journal can't hold records of another version than the
+	 * keyring file, so the next write replaces both */
+	self->journal_valid = FALSE;
+	self->generation++;
+
+	return TRUE;
+}
+
+/* Must be called with the lock held. The map of item IDs is only kept
+ * up to date once something needs it */
+static void
+ensure_ids (SecretFileCollection *self)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer item;
+
+	ensure_records (self);
+	if (self->ids != NULL)
+		return;
+
+	self->ids = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+					   (GDestroyNotify) g_bytes_unref,
+					   (GDestroyNotify) g_bytes_unref);
+	g_hash_table_iter_init (&iter, self->records);
+	while (g_hash_table_iter_next (&iter, &key, &item))
+		g_hash_table_insert (self->ids, item_get_id (self, item), g_bytes_ref (key));
+}
+
+/* A key which doesn't decrypt the items was derived from another
+ * password. Without any items there's nothing to check it against, so
+ * it isn't trusted either */
+static gboolean
+key_matches_items (EggKeyring1Context *context,
+		   guint8 minor_version,
+		   GVariant *items)
+{
+	GVariant *item;
+	GVariant *serialized;
+
+	if (g_variant_n_children (items) == 0)
+		return FALSE;
+
+	item = g_variant_get_child_value (items, 0);
+	serialized = decrypt_serialized (context, minor_version, item, NULL);
+	g_variant_unref (item);
+
+	if (serialized == NULL)
+		return FALSE;
+
+	g_variant_unref (g_variant_ref_sink (serialized));
+	return TRUE;
+}
+
+static void
+derive_key (LoadData *load)
+{
+	const gchar *password;
+	gsize n_password;
+	gchar *description = NULL;
+
+	if (load->key_cache_timeout > 0) {
+		description = key_cache_description (load);
+		if (g_variant_n_children (load->items) > 0)
+			load->key = egg_keyctl_lookup (description);
+		if (load->key != NULL &&
+		    g_bytes_get_size (load->key) == KEY_SIZE)
+			load->context = egg_keyring1_context_new (load->key);
+		if (load->context != NULL &&
+		    key_matches_items (load->context, load->minor_version, load->items)) {
+			g_free (description);
+			return;
+		}
+
+		if (load->key != NULL) {
+			g_debug ("ignoring stale key from the session keyring");
+			egg_keyctl_invalidate (description);
+			g_clear_pointer (&load->key, g_bytes_unref);
+			g_clear_pointer (&load->context, egg_keyring1_context_unref);
+		}
+	}
+
+	password = secret_value_get (load->password, &n_password);
+	load->key = egg_keyring1_derive_key (password,
+					     n_password,
+					     load->salt,
+					     load->iteration_count);
+
+	if (load->key != NULL) {
+		load->context = egg_keyring1_context_new (load->key);
+		if (load->context == NULL)
+			g_clear_pointer (&load->key, g_bytes_unref);
+	}
+
+	if (load->key != NULL && description != NULL)
+		egg_keyctl_store (description, load->key, load->key_cache_timeout);
+
+	g_free (description);
+}
+
+/* Safe to call from any thread */
+static void
+read_files (LoadData *load,
+	    GCancellable *cancellable)
+{
+	GBytes *contents;
+	FileStamp stamp;
+	gchar *journal;
+	gsize n_journal;
+	GError *error = NULL;
+
+	get_file_stamp (load->file, &stamp);
+	get_file_stamp (load->journal_file, &load->journal_stamp);
+	if (load->check &&
+	    file_stamp_equal (&stamp, &load->known_stamp) &&
+	    file_stamp_equal (&load->journal_stamp, &load->known_journal_stamp))
+		return;
+
+	load->changed = TRUE;
+	load->stamp = stamp;
+
+	contents = map_file (load->file, cancellable,
+			     &load->stamp, &load->etag, &error);
+	if (contents != NULL) {
+		gboolean ret = load_contents (load, contents, &load->error);
+		g_bytes_unref (contents);
+		if (!ret)
+			return;
+	} else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+		g_clear_error (&error);
+		init_empty_file (load);
+	} else {
+		g_propagate_error (&load->error, error);
+		return;
+	}
+
+	/* Deriving the key is costly, reuse it unless the salt changed */
+	if (load->known_key != NULL &&
+	    load->iteration_count == load->known_iteration_count &&
+	    g_bytes_equal (load->salt, load->known_salt)) {
+		load->key = g_bytes_ref (load->known_key);
+	} else {
+		derive_key (load);
+		if (!load->key) {
+			g_set_error_literal (&load->error,
+					     SECRET_ERROR,
+					     SECRET_ERROR_PROTOCOL,
+					     "couldn't derive key");
+			return;
+		}
+	}
+
+	/* A journal without a keyring file is stale, and is ignored */
+	if (load->size > 0) {
+		if (g_file_load_contents (load->journal_file, cancellable,
+					  &journal, &n_journal, NULL, &error)) {
+			load->journal = g_bytes_new_take (journal, n_journal);
+		} else {
+			if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+				g_debug ("couldn't load journal: %s", error->message);
+			g_clear_error (&error);
+		}
+	}
+}
+
+/* Must be called with the lock held, from any thread */
+static gboolean
+apply_files (SecretFileCollection *self,
+	     LoadData *load,
+	     GError **error)
+{
+	gboolean lost;
+
+	if (!load->changed)
+		return TRUE;
+
+	/* The collection changed in the meantime, what was read might
+	 * be older than what is already there; look again next time */
+	if (!load->merge && load->generation != self->generation) {
+		g_atomic_int_set (&self->watch->stale, 1);
+		return TRUE;
+	}
+
+	/* Don't try to load a broken file over and over */
+	self->file_stamp = load->stamp;
+	self->journal_stamp = load->journal_stamp;
+	self->generation++;
+
+	if (load->error != NULL) {
+		g_propagate_error (error, g_error_copy (load->error));
+		return FALSE;
+	}
+
+	/* Changes encrypted with another key or in another format can't
+	 * be put on top of what was read */
+	lost = g_hash_table_size (self->changes) > 0 &&
+	       (load->context != NULL || load->minor_version != self->minor_version ||
+		(self->bookkeeping && !load->bookkeeping && !self->upgrade));
+	if (lost)
+		g_hash_table_remove_all (self->changes);
+
+	g_clear_pointer (&self->salt, g_bytes_unref);
+	g_clear_pointer (&self->key, g_bytes_unref);
+	g_clear_pointer (&self->modified, g_date_time_unref);
+
+	self->salt = g_steal_pointer (&load->salt);
+	self->key = g_steal_pointer (&load->key);
+	/* Only a newly derived key comes with a new context */
+	if (load->context != NULL) {
+		g_clear_pointer (&self->context, egg_keyring1_context_unref);
+		self->context = g_steal_pointer (&load->context);
+		/* The keys of the items changed along with it */
+		g_hash_table_remove_all (self->assigned_ids);
+	}
+	self->iteration_count = load->iteration_count;
+	self->minor_version = load->minor_version;
+	self->modified = g_date_time_new_from_unix_utc (load->modified);
+	self->usage_count = load->usage_count;
+	self->file_size = load->size;
+	g_clear_pointer (&self->file_nonce, g_bytes_unref);
+	self->file_nonce = g_steal_pointer (&load->nonce);
+	g_clear_pointer (&self->etag, g_free);
+	self->etag = g_steal_pointer (&load->etag);
+	g_ptr_array_set_size (self->pending, 0);
+
+	g_clear_pointer (&self->file_items, g_variant_unref);
+	g_clear_pointer (&self->file_index, g_bytes_unref);
+
+	/* With an index and nothing to put on top of the items, they are
+	 * left in the file until something needs all of them */
+	if (load->index != NULL &&
+	    (load->journal == NULL || g_bytes_get_size (load->journal) <= JOURNAL_HEADER_LEN) &&
+	    g_hash_table_size (self->changes) == 0 &&
+	    !(self->upgrade && (self->minor_version < MINOR_VERSION_LATEST ||
+				!load->bookkeeping))) {
+		g_hash_table_remove_all (self->records);
+		g_hash_table_remove_all (self->index);
+		g_hash_table_remove_all (self->sequence);
+		g_clear_pointer (&self->ids, g_hash_table_unref);
+		self->file_items = g_steal_pointer (&load->items);
+		self->file_index = g_steal_pointer (&load->index);
+		self->file_contents_size = load->contents_size;
+	} else {
+		load_items (self, load->items);
+		g_clear_pointer (&load->items, g_variant_unref);
+	}
+
+	load_journal (self, load->journal);
+	replay_changes (self);
+
+	/* The file stays readable as it is if this fails */
+	self->bookkeeping = load->bookkeeping;
+	if (self->upgrade &&
+	    (self->minor_version < MINOR_VERSION_LATEST || !self->bookkeeping)) {
+		GError *upgrade_error = NULL;
+		if (!upgrade_items (self, &upgrade_error)) {
+			g_debug ("couldn't upgrade file: %s", upgrade_error->message);
+			g_error_free (upgrade_error);
+		}
+	}
+
+	/* Compressed secrets can only go in a file marked as holding them,
+	 * so the next write replaces the file along with the journal */
+	self->compressed = load->compressed;
+	if (self->compress && !self->compressed &&
+	    self->minor_version >= MINOR_VERSION_SPLIT) {
+		self->compressed = TRUE;
+		self->journal_valid = FALSE;
+	}
+
+	if (lost) {
+		g_set_error_literal (error, SECRET_ERROR, SECRET_ERROR_PROTOCOL,
+				     "keyring file was re-encrypted by another process, "
+				     "discarding changes not yet written");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+reload_thread (GTask *task,
+	       gpointer source_object,
+	       gpointer task_data,
+	       GCancellable *cancellable)
+{
+	SecretFileCollection *self = SECRET_FILE_COLLECTION (source_object);
+	LoadData *load = task_data;
+	GPtrArray *waiters;
+	GError *error = NULL;
+	guint i;
+
+	read_files (load, cancellable);
+
+	g_rec_mutex_lock (&self->lock);
+	if (!apply_files (self, load, &error))
+		g_debug ("Failed to load file contents: %s", error->message);
+	waiters = g_steal_pointer (&self->reloads);
+	g_rec_mutex_unlock (&self->lock);
+
+	/* Each waiter is completed in its own main context */
+	for (i = 0; i < waiters->len; i++) {
+		GTask *waiter = g_ptr_array_index (waiters, i);
+
+		if (error != NULL)
+			g_task_return_error (waiter, g_error_copy (error));
+		else
+			g_task_return_boolean (waiter, TRUE);
+	}
+
+	g_clear_error (&error);
+	g_ptr_array_unref (waiters);
+	g_task_return_boolean (task, TRUE);
+}
+
+/* Must be called with the lock held. Starts reading the files in a
+ * thread if they were reported to change, without waiting for it: the
+ * file I/O and key derivation must not happen with the lock held, and
+ * the items already loaded are served meanwhile. Returns whether a
+ * reload is in progress, which callers can wait on through reloads */
+static gboolean
+start_reload (SecretFileCollection *self)
+{
+	GTask *task;
+
+	if (self->reloads != NULL)
+		return TRUE;
+
+	/* Nothing to look at until the files are reported to change */
+	if (!watch_check_stale (self->watch))
+		return FALSE;
+
+	self->reloads = g_ptr_array_new_with_free_func (g_object_unref);
+
+	/* Not cancellable, as other callers may be waiting on it */
+	task = g_task_new (self, NULL, NULL, NULL);
+	g_task_set_task_data (task, load_data_new (self, TRUE), load_data_free);
+	g_task_run_in_thread (task, reload_thread);
+	g_object_unref (task);
+
+	return TRUE;
+}
+
+/* Blocks while the files are read, for callers which are in a thread
+ * already and don't want to depend on any main context */
+static gboolean
+secret_file_collection_real_init (GInitable *initable,
+				  GCancellable *cancellable,
+				  GError **error)
+{
+	SecretFileCollection *self = SECRET_FILE_COLLECTION (initable);
+	LoadData *load;
+	gboolean ret;
+
+	g_rec_mutex_lock (&self->lock);
+	load = load_data_new (self, FALSE);
+	g_rec_mutex_unlock (&self->lock);
+
+	read_files (load, cancellable);
+
+	g_rec_mutex_lock (&self->lock);
+	ret = apply_files (self, load, error);
+	g_rec_mutex_unlock (&self->lock);
+
+	load_data_free (load);
+	return ret;
+}
+
+static void
+secret_file_collection_initable_iface (GInitableIface *iface)
+{
+	iface->init = secret_file_collection_real_init;
+}
+
+static void
+read_files_thread (GTask *task,
+		   gpointer source_object,
+		   gpointer task_data,
+		   GCancellable *cancellable)
+{
+	read_files (task_data, cancellable);
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+on_init_read_files (GObject *source_object,
+		    GAsyncResult *result,
+		    gpointer user_data)
+{
+	SecretFileCollection *self = SECRET_FILE_COLLECTION (source_object);
+	GTask *task = G_TASK (user_data);
+	LoadData *load = g_task_get_task_data (G_TASK (result));
+	GError *error = NULL;
+	gboolean ret;
+
+	g_rec_mutex_lock (&self->lock);
+	ret = apply_files (self, load, &error);
+	g_rec_mutex_unlock (&self->lock);
+
+	if (ret)
+		g_task_return_boolean (task, TRUE);
+	else
+		g_task_return_error (task, error);
+
+	g_object_unref (task);
+}
+
+static void
+secret_file_collection_real_init_async (GAsyncInitable *initable,
+					int io_priority,
+					GCancellable *cancellable,
+					GAsyncReadyCallback callback,
+					gpointer user_data)
+{
+	SecretFileCollection *self = SECRET_FILE_COLLECTION (initable);
+	GTask *task;
+	GTask *read_task;
+
+	task = g_task_new (initable, cancellable, callback, user_data);
+
+	read_task = g_task_new (initable, cancellable, on_init_read_files, task);
+	g_rec_mutex_lock (&self->lock);
+	g_task_set_task_data (read_task, load_data_new (self, FALSE), load_data_free);
+	g_rec_mutex_unlock (&self->lock);
+	g_task_set_priority (read_task, io_priority);
+	g_task_run_in_thread (read_task, read_files_thread);
+	g_object_unref (read_task);
+}
+
+static gboolean
+secret_file_collection_real_init_finish (GAsyncInitable *initable,
+					 GAsyncResult *result,
+					 GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, initable), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+secret_file_collection_async_initable_iface (GAsyncInitableIface *iface)
+{
+	iface->init_async = secret_file_collection_real_init_async;
+	iface->init_finish = secret_file_collection_real_init_finish;
+}
+
+/**
+ * secret_file_collection_refresh:
+ * @self: the collection
+ * @cancellable: (nullable): optional cancellation object
+ * @callback: called when the operation completes
+ * @user_data: data to pass to the callback
+ *
+ * Makes sure the collection reflects the file on disk, reloading it
+ * without blocking if it was changed. Concurrent calls, and the reloads
+ * started by other operations, share a single reload per collection.
+ */
+void
+secret_file_collection_refresh (SecretFileCollection *self,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	GTask *task;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+
+	g_rec_mutex_lock (&self->lock);
+	if (start_reload (self)) {
+		g_ptr_array_add (self->reloads, task);
+		g_rec_mutex_unlock (&self->lock);
+		return;
+	}
+	g_rec_mutex_unlock (&self->lock);
+
+	g_task_return_boolean (task, TRUE);
+	g_object_unref (task);
+}
+
+gboolean
+secret_file_collection_refresh_finish (SecretFileCollection *self,
+				       GAsyncResult *result,
+				       GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* A query whose attribute MACs are calculated once, so that candidate
+ * items can be matched by comparing digests instead of running an
+ * HMAC per item */
+typedef struct {
+	guint n_attributes;
+	gchar **names;		/* sorted */
+	guint8 *macs;		/* n_attributes * MAC_SIZE */
+} CompiledQuery;
+
+static void
+compiled_query_free (CompiledQuery *query)
+{
+	g_strfreev (query->names);
+	g_free (query->macs);
+	g_free (query);
+}
+
+static CompiledQuery *
+compile_query (SecretFileCollection *self,
+	       GHashTable *attributes)
+{
+	CompiledQuery *query;
+	GList *keys;
+	GList *l;
+	guint i;
+
+	keys = g_hash_table_get_keys (attributes);
+	keys = g_list_sort (keys, (GCompareFunc) g_strcmp0);
+
+	query = g_new0 (CompiledQuery, 1);
+	query->n_attributes = g_list_length (keys);
+	query->names = g_new0 (gchar *, query->n_attributes + 1);
+	query->macs = g_new (guint8, query->n_attributes * MAC_SIZE);
+
+	for (l = keys, i = 0; l; l = g_list_next (l), i++) {
+		const gchar *value;
+
+		query->names[i] = g_strdup (l->data);
+		value = g_hash_table_lookup (attributes, l->data);
+		if (!egg_keyring1_calculate_mac (self->context,
+						 (const guint8 *)value,
+						 strlen (value),
+						 query->macs + i * MAC_SIZE)) {
+			g_list_free (keys);
+			compiled_query_free (query);
+			return NULL;
+		}
+	}
+	g_list_free (keys);
+
+	return query;
+}
+
+static GVariant *
+compiled_query_to_hashed_attributes (CompiledQuery *query)
+{
+	GVariantBuilder builder;
+	guint i;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{say}"));
+
+	for (i = 0; i < query->n_attributes; i++) {
+		GVariant *variant;
+
+		variant = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+						     query->macs + i * MAC_SIZE,
+						     MAC_SIZE,
+						     sizeof(guint8));
+		g_variant_builder_add (&builder, "{s@ay}", query->names[i], variant);
+	}
+
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static gboolean
+mac_equal (const guint8 *a,
+	   const guint8 *b)
+{
+	guint8 status = 0;
+	gsize i;
+
+	for (i = 0; i < MAC_SIZE; i++)
+		status |= a[i] ^ b[i];
+
+	return status == 0;
+}
+
+static gboolean
+compiled_query_match (CompiledQuery *query,
+		      GVariant *hashed_attributes)
+{
+	GVariant *hashed_attribute;
+	const guint8 *data;
+	gsize n_data;
+	gboolean matched;
+	guint i;
+
+	for (i = 0; i < query->n_attributes; i++) {
+		hashed_attribute = g_variant_lookup_value (hashed_attributes,
+							   query->names[i],
+							   G_VARIANT_TYPE_BYTESTRING);
+		if (hashed_attribute == NULL)
+			return FALSE;
+
+		data = g_variant_get_fixed_array (hashed_attribute,
+						  &n_data, sizeof(guint8));
+		matched = n_data == MAC_SIZE &&
+			mac_equal (data, query->macs + i * MAC_SIZE);
+		g_variant_unref (hashed_attribute);
+
+		if (!matched)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Returns the hashed attributes (as GBytes) of all the items
+ * matching @query, using the attribute index, in the order of the
+ * items */
+static GList *
+find_items (SecretFileCollection *self,
+	    CompiledQuery *query)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	GHashTable *smallest = NULL;
+	GList *result = NULL;
+	guint i;
+
+	if (query->n_attributes == 0) {
+		g_hash_table_iter_init (&iter, self->records);
+		while (g_hash_table_iter_next (&iter, &key, NULL))
+			result = g_list_prepend (result, g_bytes_ref (key));
+		return g_list_sort_with_data (result, compare_sequence, self);
+	}
+
+	/* Pick the shortest posting list as the candidate set */
+	for (i = 0; i < query->n_attributes; i++) {
+		GHashTable *macs;
+		GHashTable *keys;
+		GBytes *digest;
+
+		macs = g_hash_table_lookup (self->index, query->names[i]);
+		if (macs == NULL)
+			return NULL;
+
+		digest = g_bytes_new_static (query->macs + i * MAC_SIZE, MAC_SIZE);
+		keys = g_hash_table_lookup (macs, digest);
+		g_bytes_unref (digest);
+		if (keys == NULL)
+			return NULL;
+
+		if (smallest == NULL ||
+		    g_hash_table_size (keys) < g_hash_table_size (smallest))
+			smallest = keys;
+	}
+
+	/* Match the candidates against the precalculated digests */
+	g_hash_table_iter_init (&iter, smallest);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		GVariant *hashed_attributes;
+		gboolean matched;
+
+		value = g_hash_table_lookup (self->records, key);
+		hashed_attributes = g_variant_get_child_value (value, 0);
+		matched = compiled_query_match (query, hashed_attributes);
+		g_variant_unref (hashed_attributes);
+
+		if (matched)
+			result = g_list_prepend (result, g_bytes_ref (key));
+	}
+
+	return g_list_sort_with_data (result, compare_sequence, self);
+}
+
+/* The index stored in the keyring file, see INDEX_ENTRY_SIZE */
+typedef struct {
+	const guint8 *entries;
+	guint32 n_entries;
+	const guint8 *positions;
+	guint32 n_positions;
+	const gchar *names;
+	gsize n_names;
+} FileIndex;
+
+typedef struct {
+	const gchar *name;
+	gsize n_name;
+	const guint8 *mac;
+	guint32 first;
+	guint32 count;
+	const guint8 *entry_mac;
+} FileIndexEntry;
+
+static gboolean
+file_index_parse (GBytes *bytes,
+		  FileIndex *index)
+{
+	const guint8 *data;
+	gsize length;
+	guint32 u32;
+
+	data = g_bytes_get_data (bytes, &length);
+
+	if (length < 4)
+		return FALSE;
+	memcpy (&u32, data, 4);
+	index->n_entries = GUINT32_FROM_LE (u32);
+	data += 4;
+	length -= 4;
+	if (index->n_entries > length / INDEX_ENTRY_SIZE)
+		return FALSE;
+	index->entries = data;
+	data += (gsize) index->n_entries * INDEX_ENTRY_SIZE;
+	length -= (gsize) index->n_entries * INDEX_ENTRY_SIZE;
+
+	if (length < 4)
+		return FALSE;
+	memcpy (&u32, data, 4);
+	index->n_positions = GUINT32_FROM_LE (u32);
+	data += 4;
+	length -= 4;
+	if (index->n_positions > length / 4)
+		return FALSE;
+	index->positions = data;
+	data += (gsize) index->n_positions * 4;
+	length -= (gsize) index->n_positions * 4;
+
+	index->names = (const gchar *) data;
+	index->n_names = length;
+
+	return TRUE;
+}
+
+static gboolean
+file_index_get_entry (FileIndex *index,
+		      guint32 i,
+		      FileIndexEntry *entry)
+{
+	const guint8 *p = index->entries + (gsize) i * INDEX_ENTRY_SIZE;
+	guint32 offset;
+	guint32 length;
+
+	memcpy (&offset, p, 4);
+	offset = GUINT32_FROM_LE (offset);
+	memcpy (&length, p + 4, 4);
+	length = GUINT32_FROM_LE (length);
+	if (offset > index->n_names || length > index->n_names - offset)
+		return FALSE;
+	entry->name = index->names + offset;
+	entry->n_name = length;
+	p += 8;
+
+	entry->mac = p;
+	p += MAC_SIZE;
+
+	memcpy (&entry->first, p, 4);
+	entry->first = GUINT32_FROM_LE (entry->first);
+	memcpy (&entry->count, p + 4, 4);
+	entry->count = GUINT32_FROM_LE (entry->count);
+	if (entry->first > index->n_positions ||
+	    entry->count > index->n_positions - entry->first)
+		return FALSE;
+	p += 8;
+
+	entry->entry_mac = p;
+	return TRUE;
+}
+
+/* Orders entries as strcmp() would their names, then by MAC */
+static gint
+compare_index_entry (const gchar *name_a,
+		     gsize n_name_a,
+		     const guint8 *mac_a,
+		     const gchar *name_b,
+		     gsize n_name_b,
+		     const guint8 *mac_b)
+{
+	gint ret;
+
+	ret = memcmp (name_a, name_b, MIN (n_name_a, n_name_b));
+	if (ret == 0)
+		ret = (n_name_a > n_name_b) - (n_name_a < n_name_b);
+	if (ret == 0)
+		ret = memcmp (mac_a, mac_b, MAC_SIZE);
+
+	return ret;
+}
+
+/* The positions are given as stored, in little endian */
+static gboolean
+calculate_index_entry_mac (EggKeyring1Context *context,
+			   const guint8 *base_id,
+			   const gchar *name,
+			   gsize n_name,
+			   const guint8 *mac,
+			   const guint8 *positions,
+			   guint32 count,
+			   guint8 *buffer)
+{
+	GByteArray *data;
+	guint32 u32;
+	gboolean ret;
+
+	data = g_byte_array_sized_new (JOURNAL_BASE_ID_LEN + 4 + n_name +
+				       MAC_SIZE + (gsize) count * 4);
+	g_byte_array_append (data, base_id, JOURNAL_BASE_ID_LEN);
+	u32 = GUINT32_TO_LE (n_name);
+	g_byte_array_append (data, (guint8 *) &u32, 4);
+	g_byte_array_append (data, (const guint8 *) name, n_name);
+	g_byte_array_append (data, mac, MAC_SIZE);
+	g_byte_array_append (data, positions, (gsize) count * 4);
+
+	ret = egg_keyring1_calculate_mac (context, data->data, data->len, buffer);
+	g_byte_array_unref (data);
+
+	return ret;
+}
+
+static int
+compare_positions (const void *a,
+		   const void *b)
+{
+	guint32 pa = *(const guint32 *) a;
+	guint32 pb = *(const guint32 *) b;
+
+	return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+/* Finds the items matching @query through the index stored in the
+ * keyring file, only reading the records of the candidates. Returns
+ * FALSE if the index can't be used, in which case all of the items
+ * need to be loaded. The entries are found before they can be
+ * authenticated, so a damaged index may hide items, much like
+ * removing them from the file would, but can't add any */
+static gboolean
+find_items_in_file (SecretFileCollection *self,
+		    CompiledQuery *query,
+		    GList **result)
+{
+	guint8 base_id[JOURNAL_BASE_ID_LEN];
+	guint8 entry_mac[MAC_SIZE];
+	FileIndex index;
+	FileIndexEntry entry;
+	FileIndexEntry smallest = { NULL, };
+	guint32 *positions;
+	gsize n_items;
+	guint i;
+
+	*result = NULL;
+
+	if (self->file_index == NULL || query->n_attributes == 0 ||
+	    !file_index_parse (self->file_index, &index))
+		return FALSE;
+
+	journal_base_id (self, self->file_contents_size, base_id);
+
+	for (i = 0; i < query->n_attributes; i++) {
+		const gchar *name = query->names[i];
+		const guint8 *mac = query->macs + i * MAC_SIZE;
+		guint32 low = 0;
+		guint32 high = index.n_entries;
+		gboolean found = FALSE;
+
+		while (low < high) {
+			guint32 middle = low + (high - low) / 2;
+			gint cmp;
+
+			if (!file_index_get_entry (&index, middle, &entry))
+				return FALSE;
+
+			cmp = compare_index_entry (entry.name, entry.n_name, entry.mac,
+						   name, strlen (name), mac);
+			if (cmp == 0) {
+				found = TRUE;
+				break;
+			} else if (cmp < 0) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+
+		/* No item has this attribute value */
+		if (!found)
+			return TRUE;
+
+		if (!calculate_index_entry_mac (self->context, base_id,
+						entry.name, entry.n_name, entry.mac,
+						index.positions + (gsize) entry.first * 4,
+						entry.count, entry_mac) ||
+		    !mac_equal (entry_mac, entry.entry_mac)) {
+			g_debug ("ignoring index entry with a bad mac");
+			return FALSE;
+		}
+
+		if (smallest.name == NULL || entry.count < smallest.count)
+			smallest = entry;
+	}
+
+	/* The candidates are matched in the order of the file */
+	positions = g_new (guint32, smallest.count);
+	for (i = 0; i < smallest.count; i++) {
+		memcpy (&positions[i], index.positions + ((gsize) smallest.first + i) * 4, 4);
+		positions[i] = GUINT32_FROM_LE (positions[i]);
+	}
+	qsort (positions, smallest.count, sizeof (guint32), compare_positions);
+
+	/* Match the candidates against the precalculated digests */
+	n_items = g_variant_n_children (self->file_items);
+	for (i = 0; i < smallest.count; i++) {
+		GVariant *hashed_attributes;
+		GVariant *record;
+		guint32 position = positions[i];
+		gboolean matched;
+
+		if (position >= n_items) {
+			g_list_free_full (*result, (GDestroyNotify) g_variant_unref);
+			*result = NULL;
+			g_free (positions);
+			return FALSE;
+		}
+
+		record = g_variant_get_child_value (self->file_items, position);
+		hashed_attributes = g_variant_get_child_value (record, 0);
+		matched = compiled_query_match (query, hashed_attributes);
+		g_variant_unref (hashed_attributes);
+
+		if (matched)
+			*result = g_list_prepend (*result, record);
+		else
+			g_variant_unref (record);
+	}
+
+	g_free (positions);
+	*result = g_list_reverse (*result);
+	return TRUE;
+}
+
+/* Encrypts @item and puts it in place of the one with the same key */
+static gboolean
+store_item (SecretFileCollection *self,
+	    GBytes *key,
+	    GVariant *hashed_attributes,
+	    SecretFileItem *item,
+	    GError **error)
+{
+	GVariant *variant;
+
+	variant = encrypt_item (self->context, self->minor_version,
+				self->compress && self->compressed,
+				hashed_attributes, item, error);
+	if (variant == NULL)
+		return FALSE;
+
+	self->usage_count++;
+	g_date_time_unref (self->modified);
+	self->modified = g_date_time_new_now_utc ();
+
+	variant = g_variant_new ("(@a{say}@ay)", hashed_attributes, variant);
+	g_variant_ref_sink (variant);
+
+	/* Takes the place of the existing item */
+	remove_item (self, key);
+	insert_item (self, variant);
+
+	journal_add_entry (self, JOURNAL_ENTRY_UPSERT, variant);
+	self->generation++;
+
+	g_variant_unref (variant);
+
+	return TRUE;
+}
+
+static gboolean
+replace_locked (SecretFileCollection *self,
+		GHashTable *attributes,
+		const gchar *label,
+		SecretValue *value,
+		GError **error)
+{
+	CompiledQuery *query;
+	GVariant *hashed_attributes;
+	GVariant *stored_attributes;
+	GBytes *key;
+	GBytes *id;
+	GVariant *existing;
+	SecretFileItem *item;
+	GHashTableIter iter;
+	gpointer name;
+	GDateTime *modified;
+	guint64 created;
+	guint8 nonce[ITEM_ID_SIZE];
+	gboolean ret;
+
+	g_hash_table_iter_init (&iter, attributes);
+	while (g_hash_table_iter_next (&iter, &name, NULL)) {
+		if (is_reserved_attribute (name)) {
+			g_set_error (error,
+				     SECRET_ERROR,
+				     SECRET_ERROR_PROTOCOL,
+				     "the %s attribute is reserved",
+				     (const gchar *) name);
+			return FALSE;
+		}
+	}
+
+	start_reload (self);
+	ensure_records (self);
+
+	query = compile_query (self, attributes);
+	if (!query) {
+		g_set_error (error,
+			     SECRET_ERROR,
+			     SECRET_ERROR_PROTOCOL,
+			     "couldn't calculate mac");
+		return FALSE;
+	}
+
+	hashed_attributes = compiled_query_to_hashed_attributes (query);
+	compiled_query_free (query);
+
+	key = g_variant_get_data_as_bytes (hashed_attributes);
+
+	modified = g_date_time_new_now_utc ();
+	created = g_date_time_to_unix (modified);
+
+	/* Preserve the creation time and ID of the existing item, only
+	 * decrypting it if it was stored without the former */
+	existing = g_hash_table_lookup (self->records, key);
+	if (existing != NULL &&
+	    !(self->bookkeeping && item_get_created (existing, &created))) {
+		SecretFileItem *existing_item =
+			_secret_file_item_decrypt_metadata (existing, self, error);
+
+		if (existing_item == NULL) {
+			g_date_time_unref (modified);
+			g_bytes_unref (key);
+			g_variant_unref (hashed_attributes);
+			return FALSE;
+		}
+		g_object_get (existing_item, "created", &created, NULL);
+		g_object_unref (existing_item);
+	}
+
+	/* Create a new item and append it */
+	item = g_object_new (SECRET_TYPE_FILE_ITEM,
+			     "attributes", attributes,
+			     "label", label,
+			     "value", value,
+			     "created", created,
+			     "modified", g_date_time_to_unix (modified),
+			     NULL);
+	g_date_time_unref (modified);
+
+	if (self->bookkeeping) {
+		if (existing != NULL) {
+			id = item_get_id (self, existing);
+		} else {
+			egg_keyring1_create_nonce (nonce, sizeof (nonce));
+			id = g_bytes_new (nonce, sizeof (nonce));
+		}
+		stored_attributes = hashed_attributes_add_bookkeeping (hashed_attributes,
+								       id, created);
+		g_bytes_unref (id);
+	} else {
+		stored_attributes = g_variant_ref (hashed_attributes);
+	}
+
+	ret = store_item (self, key, stored_attributes, item, error);
+
+	g_object_unref (item);
+	g_variant_unref (stored_attributes);
+	g_variant_unref (hashed_attributes);
+	g_bytes_unref (key);
+
+	return ret;
+}
+
+gboolean
+secret_file_collection_replace (SecretFileCollection *self,
+				GHashTable *attributes,
+				const gchar *label,
+				SecretValue *value,
+				GError **error)
+{
+	gboolean ret;
+
+	g_rec_mutex_lock (&self->lock);
+	ret = replace_locked (self, attributes, label, value, error);
+	g_rec_mutex_unlock (&self->lock);
+
+	return ret;
+}
+
+static GList *
+search_locked (SecretFileCollection *self,
+	       GHashTable *attributes)
+{
+	CompiledQuery *query;
+	GList *keys;
+	GList *result = NULL;
+	GList *l;
+
+	start_reload (self);
+
+	query = compile_query (self, attributes);
+	if (query == NULL)
+		return NULL;
+
+	if (find_items_in_file (self, query, &result)) {
+		compiled_query_free (query);
+		return result;
+	}
+
+	ensure_records (self);
+	keys = find_items (self, query);
+	compiled_query_free (query);
+
+	for (l = keys; l; l = g_list_next (l)) {
+		GVariant *item = g_hash_table_lookup (self->records, l->data);
+		result = g_list_prepend (result, g_variant_ref (item));
+	}
+	g_list_free_full (keys, (GDestroyNotify)g_bytes_unref);
+
+	return g_list_reverse (result);
+}
+
+GList *
+secret_file_collection_search (SecretFileCollection *self,
+			       GHashTable *attributes)
+{
+	GList *result;
+
+	g_rec_mutex_lock (&self->lock);
+	result = search_locked (self, attributes);
+	g_rec_mutex_unlock (&self->lock);
+
+	return result;
+}
+
+/* Known without decrypting anything */
+gchar *
+_secret_file_item_get_encrypted_id (GVariant *encrypted,
+				    SecretFileCollection *collection)
+{
+	GBytes *id;
+	gchar *string;
+
+	g_rec_mutex_lock (&collection->lock);
+	id = item_get_id (collection, encrypted);
+	g_rec_mutex_unlock (&collection->lock);
+	string = id_to_string (id);
+	g_bytes_unref (id);
+
+	return string;
+}
+
+static SecretFileItem *
+item_set_id (SecretFileItem *item,
+	     GVariant *encrypted,
+	     SecretFileCollection *collection)
+{
+	gchar *id;
+
+	if (item != NULL) {
+		id = _secret_file_item_get_encrypted_id (encrypted, collection);
+		secret_file_item_set_id (item, id);
+		g_free (id);
+	}
+
+	return item;
+}
+
+/* Returns the context and format the items of the collection are
+ * encrypted with now. A reload may replace them with other ones, but
+ * the records found before can still be decrypted with these */
+static EggKeyring1Context *
+current_key (SecretFileCollection *self,
+	     guint8 *minor_version)
+{
+	EggKeyring1Context *context;
+
+	g_rec_mutex_lock (&self->lock);
+	context = egg_keyring1_context_ref (self->context);
+	*minor_version = self->minor_version;
+	g_rec_mutex_unlock (&self->lock);
+
+	return context;
+}
+
+/* Creates items which are only decrypted once used, with the key the
+ * matching records were found with */
+GList *
+secret_file_collection_search_items (SecretFileCollection *self,
+				     GHashTable *attributes)
+{
+	GList *matches;
+	GList *result = NULL;
+	GList *l;
+
+	g_rec_mutex_lock (&self->lock);
+	matches = search_locked (self, attributes);
+	for (l = matches; l; l = g_list_next (l))
+		result = g_list_prepend (result,
+					 _secret_file_item_new_deferred (l->data, self,
+									 self->context,
+									 self->minor_version));
+	g_rec_mutex_unlock (&self->lock);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	return g_list_reverse (result);
+}
+
+SecretFileItem *
+_secret_file_item_decrypt (GVariant *encrypted,
+			   SecretFileCollection *collection,
+			   GError **error)
+{
+	EggKeyring1Context *context;
+	guint8 minor_version;
+	SecretFileItem *item;
+
+	context = current_key (collection, &minor_version);
+	item = decrypt_full (context, minor_version, encrypted, TRUE, error);
+	egg_keyring1_context_unref (context);
+
+	return item_set_id (item, encrypted, collection);
+}
+
+/* The secret is only included if it is stored along with the metadata */
+SecretFileItem *
+_secret_file_item_decrypt_metadata_full (GVariant *encrypted,
+					 EggKeyring1Context *context,
+					 guint8 minor_version,
+					 GError **error)
+{
+	return decrypt_full (context, minor_version, encrypted, FALSE, error);
+}
+
+SecretFileItem *
+_secret_file_item_decrypt_metadata (GVariant *encrypted,
+				    SecretFileCollection *collection,
+				    GError **error)
+{
+	EggKeyring1Context *context;
+	guint8 minor_version;
+	SecretFileItem *item;
+
+	context = current_key (collection, &minor_version);
+	item = _secret_file_item_decrypt_metadata_full (encrypted, context,
+							minor_version, error);
+	egg_keyring1_context_unref (context);
+
+	return item_set_id (item, encrypted, collection);
+}
+
+SecretValue *
+_secret_file_item_decrypt_value_full (GVariant *encrypted,
+				      EggKeyring1Context *context,
+				      guint8 minor_version,
+				      GError **error)
+{
+	return decrypt_value (context, minor_version, encrypted, error);
+}
+
+SecretValue *
+_secret_file_item_decrypt_value (GVariant *encrypted,
+				 SecretFileCollection *collection,
+				 GError **error)
+{
+	EggKeyring1Context *context;
+	guint8 minor_version;
+	SecretValue *value;
+
+	context = current_key (collection, &minor_version);
+	value = decrypt_value (context, minor_version, encrypted, error);
+	egg_keyring1_context_unref (context);
+
+	return value;
+}
+
+static gboolean
+clear_locked (SecretFileCollection *self,
+	      GHashTable *attributes,
+	      GError **error)
+{
+	CompiledQuery *query;
+	GList *keys;
+	GList *l;
+
+	start_reload (self);
+	ensure_records (self);
+
+	query = compile_query (self, attributes);
+	if (query == NULL) {
+		g_set_error (error,
+			     SECRET_ERROR,
+			     SECRET_ERROR_PROTOCOL,
+			     "couldn't calculate mac");
+		return FALSE;
+	}
+
+	keys = find_items (self, query);
+	compiled_query_free (query);
+
+	if (keys == NULL)
+		return FALSE;
+
+	for (l = keys; l; l = g_list_next (l)) {
+		GVariant *item = g_hash_table_lookup (self->records, l->data);
+		GVariant *hashed_attributes = g_variant_get_child_value (item, 0);
+
+		journal_add_entry (self, JOURNAL_ENTRY_TOMBSTONE, hashed_attributes);
+		g_variant_unref (hashed_attributes);
+		remove_item (self, l->data);
+	}
+	g_list_free_full (keys, (GDestroyNotify)g_bytes_unref);
+	self->generation++;
+
+	return TRUE;
+}
+
+gboolean
+secret_file_collection_clear (SecretFileCollection *self,
+			      GHashTable *attributes,
+			      GError **error)
+{
+	gboolean ret;
+
+	g_rec_mutex_lock (&self->lock);
+	ret = clear_locked (self, attributes, error);
+	g_rec_mutex_unlock (&self->lock);
+
+	return ret;
+}
+
+/* Finds an item through the map of IDs rather than its attributes */
+static GVariant *
+lookup_item_by_id (SecretFileCollection *self,
+		   const gchar *id,
+		   GBytes **key,
+		   GError **error)
+{
+	GBytes *bytes;
+	GBytes *found = NULL;
+	GVariant *item = NULL;
+
+	start_reload (self);
+	ensure_ids (self);
+
+	bytes = id_from_string (id);
+	if (bytes != NULL) {
+		found = g_hash_table_lookup (self->ids, bytes);
+		g_bytes_unref (bytes);
+	}
+	if (found != NULL)
+		item = g_hash_table_lookup (self->records, found);
+
+	if (item == NULL) {
+		g_set_error (error,
+			     SECRET_ERROR,
+			     SECRET_ERROR_NO_SUCH_OBJECT,
+			     "no item with ID %s", id);
+		return NULL;
+	}
+
+	*key = g_bytes_ref (found);
+	return item;
+}
+
+/* Changes the label or the secret of an item, leaving the rest */
+static gboolean
+update_locked (SecretFileCollection *self,
+	       const gchar *id,
+	       const gchar *label,
+	       SecretValue *value,
+	       GError **error)
+{
+	GVariant *existing;
+	GVariant *hashed_attributes;
+	GVariant *stored_attributes;
+	GBytes *key;
+	GBytes *item_id;
+	SecretFileItem *old_item;
+	SecretFileItem *item;
+	GHashTable *attributes;
+	gchar *old_label;
+	guint64 created;
+	GDateTime *modified;
+	gboolean ret;
+
+	existing = lookup_item_by_id (self, id, &key, error);
+	if (existing == NULL)
+		return FALSE;
+
+	/* The secret is only decrypted if it is kept */
+	if (value != NULL)
+		old_item = _secret_file_item_decrypt_metadata (existing, self, error);
+	else
+		old_item = _secret_file_item_decrypt (existing, self, error);
+	if (old_item == NULL) {
+		g_bytes_unref (key);
+		return FALSE;
+	}
+
+	g_object_get (old_item,
+		      "attributes", &attributes,
+		      "label", &old_label,
+		      "created", &created,
+		      NULL);
+
+	modified = g_date_time_new_now_utc ();
+	item = g_object_new (SECRET_TYPE_FILE_ITEM,
+			     "attributes", attributes,
+			     "label", label ? label : old_label,
+			     "value", value ? value : secret_file_item_get_value (old_item),
+			     "created", created,
+			     "modified", g_date_time_to_unix (modified),
+			     NULL);
+	g_date_time_unref (modified);
+	g_hash_table_unref (attributes);
+	g_free (old_label);
+	g_object_unref (old_item);
+
+	hashed_attributes = g_variant_get_child_value (existing, 0);
+	if (self->bookkeeping) {
+		item_id = item_get_id (self, existing);
+		stored_attributes = hashed_attributes_add_bookkeeping (hashed_attributes,
+								       item_id, created);
+		g_bytes_unref (item_id);
+	} else {
+		stored_attributes = g_variant_ref (hashed_attributes);
+	}
+	ret = store_item (self, key, stored_attributes, item, error);
+
+	g_object_unref (item);
+	g_variant_unref (stored_attributes);
+	g_variant_unref (hashed_attributes);
+	g_bytes_unref (key);
+
+	return ret;
+}
+
+static gboolean
+delete_locked (SecretFileCollection *self,
+	       const gchar *id,
+	       GError **error)
+{
+	GVariant *existing;
+	GVariant *hashed_attributes;
+	GBytes *key;
+
+	existing = lookup_item_by_id (self, id, &key, error);
+	if (existing == NULL)
+		return FALSE;
+
+	hashed_attributes = g_variant_get_child_value (existing, 0);
+	journal_add_entry (self, JOURNAL_ENTRY_TOMBSTONE, hashed_attributes);
+	g_variant_unref (hashed_attributes);
+	remove_item (self, key);
+	self->generation++;
+
+	g_bytes_unref (key);
+
+	return TRUE;
+}
+
+/* Replaces the secret of the item with the given ID */
+gboolean
+secret_file_collection_update (SecretFileCollection *self,
+			       const gchar *id,
+			       SecretValue *value,
+			       GError **error)
+{
+	gboolean ret;
+
+	g_return_val_if_fail (id != NULL, FALSE);
+	g_return_val_if_fail (value != NULL, FALSE);
+
+	g_rec_mutex_lock (&self->lock);
+	ret = update_locked (self, id, NULL, value, error);
+	g_rec_mutex_unlock (&self->lock);
+
+	return ret;
+}
+
+gboolean
+secret_file_collection_set_label (SecretFileCollection *self,
+				  const gchar *id,
+				  const gchar *label,
+				  GError **error)
+{
+	gboolean ret;
+
+	g_return_val_if_fail (id != NULL, FALSE);
+	g_return_val_if_fail (label != NULL, FALSE);
+
+	g_rec_mutex_lock (&self->lock);
+	ret = update_locked (self, id, label, NULL, error);
+	g_rec_mutex_unlock (&self->lock);
+
+	return ret;
+}
+
+gboolean
+secret_file_collection_delete (SecretFileCollection *self,
+			       const gchar *id,
+			       GError **error)
+{
 	gboolean ret;
+
+	g_return_val_if_fail (id != NULL, FALSE);
+
+	g_rec_mutex_lock (&self->lock);
+	ret = delete_locked (self, id, error);
+	g_rec_mutex_unlock (&self->lock);
+
+	return ret;
+}
+
+typedef struct {
+	gboolean compact;
+	guint attempts;
+	guint8 *contents;
+	gsize n_contents;
+	guint8 header[JOURNAL_HEADER_LEN];
+	guint8 nonce[FILE_NONCE_SIZE];
+
+	/* The files as last seen, checked while holding the lock, and
+	 * as left behind by the write */
+	GFile *file;
+	GFile *journal_file;
+	FileStamp file_stamp;
+	FileStamp journal_stamp;
+	gboolean journal;
+	gboolean journal_valid;
+
+	/* What goes into the keyring file when it's written as a whole */
+	gchar *etag;
+	GByteArray *head;
+	GPtrArray *records;
+	gsize items_offset_size;
+	gsize salt_end;
+	gsize offset_size;
+	gsize contents_size;
+	GByteArray *index;
+	SecretFileDurability durability;
+	gboolean sync;
+
+	/* The changes being written, see SecretFileCollection.changes */
+	GHashTable *changes;
+} WriteClosure;
+
+/* Drops what a previous attempt at the write left behind */
+static void
+write_closure_reset (WriteClosure *closure)
+{
+	g_clear_pointer (&closure->contents, g_free);
+	g_clear_object (&closure->file);
+	g_clear_object (&closure->journal_file);
+	g_clear_pointer (&closure->etag, g_free);
+	g_clear_pointer (&closure->head, g_byte_array_unref);
+	g_clear_pointer (&closure->records, g_ptr_array_unref);
+	g_clear_pointer (&closure->index, g_byte_array_unref);
+	g_clear_pointer (&closure->changes, g_hash_table_unref);
+}
+
+static void
+write_closure_free (gpointer data)
+{
+	WriteClosure *closure = data;
+	write_closure_reset (closure);
+	g_free (closure);
+}
+
+/* The changes which are about to be written stop being tracked, and
+ * later changes are tracked separately */
+static void
+write_take_changes (SecretFileCollection *self,
+		    WriteClosure *closure)
+{
+	closure->file = g_object_ref (self->file);
+	closure->journal_file = g_object_ref (self->journal_file);
+	closure->file_stamp = self->file_stamp;
+	closure->journal_stamp = self->journal_stamp;
+
+	closure->changes = self->changes;
+	self->changes = changes_new ();
+}
+
+/* Tracks the changes which weren't written again, unless they were
+ * superseded in the meantime */
+static void
+write_restore_changes (SecretFileCollection *self,
+		       WriteClosure *closure)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer entry;
+
+	if (closure->changes == NULL)
+		return;
+
+	g_hash_table_iter_init (&iter, closure->changes);
+	while (g_hash_table_iter_next (&iter, &key, &entry)) {
+		if (!g_hash_table_contains (self->changes, key))
+			g_hash_table_insert (self->changes, g_bytes_ref (key),
+					     g_variant_ref (entry));
+	}
+
+	g_clear_pointer (&closure->changes, g_hash_table_unref);
+}
+
+static void write_next (SecretFileCollection *self);
+
+static void
+write_done (SecretFileCollection *self,
+	    GError *error)
+{
+	GTask *task;
+
+	g_rec_mutex_lock (&self->lock);
+	task = g_queue_pop_head (&self->writes);
+
+	/* Whatever was not written is still in memory; make sure the next
+	 * write replaces the whole keyring file */
+	if (error != NULL) {
+		write_restore_changes (self, g_task_get_task_data (task));
+		self->journal_valid = FALSE;
+	}
+
+	if (!g_queue_is_empty (&self->writes))
+		write_next (self);
+	g_rec_mutex_unlock (&self->lock);
+
+	if (error != NULL)
+		g_task_return_error (task, error);
+	else
+		g_task_return_boolean (task, TRUE);
+	g_object_unref (task);
+}
+
+static void
+queue_write (SecretFileCollection *self,
+	     GTask *task)
+{
+	g_rec_mutex_lock (&self->lock);
+	g_queue_push_tail (&self->writes, task);
+	if (g_queue_get_length (&self->writes) == 1)
+		write_next (self);
+	g_rec_mutex_unlock (&self->lock);
+}
+
+static gboolean
+journal_needs_compaction (SecretFileCollection *self)
+{
+	return self->journal_size > MAX (JOURNAL_COMPACT_SIZE,
+					 self->file_size / 2);
+}
+
+/* Runs in a thread, and goes on with the write from there */
+static void
+merge_read_files_thread (GTask *read_task,
+			 gpointer source_object,
+			 gpointer task_data,
+			 GCancellable *cancellable)
+{
+	SecretFileCollection *self = source_object;
+	LoadData *load = task_data;
+	GError *error = NULL;
+
+	read_files (load, cancellable);
+
+	g_rec_mutex_lock (&self->lock);
+
+	/* Still at the head of the queue */
+	if (apply_files (self, load, &error))
+		write_next (self);
+	else
+		write_done (self, error);
+
+	g_rec_mutex_unlock (&self->lock);
+
+	g_task_return_boolean (read_task, TRUE);
+}
+
+/* Another process wrote the files since they were last read; reload
+ * them, with the changes not yet written on top, and try again */
+static gboolean
+write_merge (SecretFileCollection *self,
+	     GTask *task,
+	     GError *error)
+{
+	WriteClosure *closure = g_task_get_task_data (task);
+	GTask *read_task;
+	LoadData *load;
+
+	if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WRONG_ETAG) ||
+	    ++closure->attempts >= MAX_WRITE_ATTEMPTS)
+		return FALSE;
+
+	g_debug ("merging with changes made by another process: %s", error->message);
+	g_error_free (error);
+
+	write_restore_changes (self, closure);
+	write_closure_reset (closure);
+
+	load = load_data_new (self, FALSE);
+	load->merge = TRUE;
+
+	/* Not cancellable, the files are left as they were */
+	read_task = g_task_new (self, NULL, NULL, NULL);
+	g_task_set_task_data (read_task, load, load_data_free);
+	g_task_run_in_thread (read_task, merge_read_files_thread);
+	g_object_unref (read_task);
+
+	return TRUE;
+}
+
+static void
+write_stream_done (SecretFileCollection *self,
+		   GTask *task,
+		   gchar *etag,
+		   GError *error)
+{
+	WriteClosure *closure = g_task_get_task_data (task);
+
+	g_rec_mutex_lock (&self->lock);
+
+	if (error != NULL) {
+		if (!write_merge (self, task, error))
+			write_done (self, error);
+		g_rec_mutex_unlock (&self->lock);
+		return;
+	}
+
+	self->file_stamp = closure->file_stamp;
+	self->file_size = closure->n_contents;
+	g_clear_pointer (&self->file_nonce, g_bytes_unref);
+	if (closure->journal)
+		self->file_nonce = g_bytes_new (closure->nonce, FILE_NONCE_SIZE);
+	g_clear_pointer (&self->etag, g_free);
+	self->etag = etag;
+
+	self->journal_stamp = closure->journal_stamp;
+	self->journal_valid = closure->journal_valid;
+	self->journal_size = closure->journal_valid ? JOURNAL_HEADER_LEN : 0;
+
+	write_done (self, NULL);
+	g_rec_mutex_unlock (&self->lock);
+}
+
+static gboolean
+write_offset (GOutputStream *stream,
+	      gsize value,
+	      gsize offset_size,
+	      GCancellable *cancellable,
+	      GError **error)
+{
+	guint8 buffer[8];
+	gsize i;
+
+	/* Framing offsets are little endian */
+	for (i = 0; i < offset_size; i++)
+		buffer[i] = (value >> (i * 8)) & 0xff;
+
+	return g_output_stream_write_all (stream, buffer, offset_size, NULL,
+					  cancellable, error);
+}
+
+static gboolean
+write_records (GOutputStream *stream,
+	       WriteClosure *closure,
+	       GCancellable *cancellable,
+	       GError **error)
+{
+	gsize end = 0;
+	guint i;
+
+	if (!g_output_stream_write_all (stream,
+					closure->head->data,
+					closure->head->len,
+					NULL, cancellable, error))
+		return FALSE;
+
+	for (i = 0; i < closure->records->len; i++) {
+		GVariant *record = g_ptr_array_index (closure->records, i);
+
+		if (!g_output_stream_write_all (stream,
+						g_variant_get_data (record),
+						g_variant_get_size (record),
+						NULL, cancellable, error))
+			return FALSE;
+	}
+
+	for (i = 0; i < closure->records->len; i++) {
+		end += g_variant_get_size (g_ptr_array_index (closure->records, i));
+		if (!write_offset (stream, end, closure->items_offset_size,
+				   cancellable, error))
+			return FALSE;
+	}
+
+	if (!write_offset (stream, closure->salt_end, closure->offset_size,
+			   cancellable, error))
+		return FALSE;
+
+	if (closure->index != NULL &&
+	    (!g_output_stream_write_all (stream,
+					 closure->index->data,
+					 closure->index->len,
+					 NULL, cancellable, error) ||
+	     !write_offset (stream, closure->contents_size, 8,
+			    cancellable, error)))
+		return FALSE;
+
+	return !closure->journal ||
+	       g_output_stream_write_all (stream, closure->nonce, FILE_NONCE_SIZE,
+					  NULL, cancellable, error);
+}
+
+/* Makes the creation or the renaming of @file survive a crash of the
+ * system, which syncing the file alone doesn't. Failing that, the file
+ * itself is still in place, so this is only logged */
+static void
+sync_directory (GFile *file)
+{
+	gchar *path;
+	gchar *directory;
+	gint fd;
+
+	path = g_file_get_path (file);
+	directory = g_path_get_dirname (path);
+	g_free (path);
+
+	fd = g_open (directory, O_RDONLY | O_DIRECTORY, 0);
+	if (fd < 0 || fsync (fd) < 0) {
+		int errsv = errno;
+		g_debug ("couldn't sync keyring directory: %s", g_strerror (errsv));
+	}
+	if (fd >= 0)
+		close (fd);
+
+	g_free (directory);
+}
+
+/* Writes through GIO, which syncs the new file before putting it in
+ * place of an existing one */
+static gboolean
+replace_with_gio (WriteClosure *closure,
+		  GCancellable *cancellable,
+		  gchar **etag,
+		  GError **error)
+{
+	GFileOutputStream *file_stream;
+	GOutputStream *stream;
+	GCancellable *abort;
+
+	file_stream = g_file_replace (closure->file,
+				      closure->etag,
+				      FALSE,
+				      G_FILE_CREATE_PRIVATE |
+				      G_FILE_CREATE_REPLACE_DESTINATION,
+				      cancellable,
+				      error);
+	if (file_stream == NULL)
+		return FALSE;
+
+	stream = g_buffered_output_stream_new_sized (G_OUTPUT_STREAM (file_stream),
+						     WRITE_BUFFER_SIZE);
+	g_filter_output_stream_set_close_base_stream (G_FILTER_OUTPUT_STREAM (stream),
+						      FALSE);
+
+	if (!write_records (stream, closure, cancellable, error) ||
+	    !g_output_stream_close (stream, cancellable, error)) {
+		/* Closing while cancelled leaves the keyring file untouched */
+		abort = g_cancellable_new ();
+		g_cancellable_cancel (abort);
+		g_output_stream_close (G_OUTPUT_STREAM (file_stream), abort, NULL);
+		g_object_unref (abort);
+		g_object_unref (stream);
+		g_object_unref (file_stream);
+		return FALSE;
+	}
+
+	/* This is what puts the new keyring file in place */
+	if (!g_output_stream_close (G_OUTPUT_STREAM (file_stream), cancellable, error)) {
+		g_object_unref (stream);
+		g_object_unref (file_stream);
+		return FALSE;
+	}
+
+	/* Only an existing file is replaced, and so synced */
+	if (closure->etag != NULL)
+		g_debug ("synced keyring file");
+	if (closure->sync)
+		sync_directory (closure->file);
+
+	*etag = g_file_output_stream_get_etag (file_stream);
+	g_object_unref (stream);
+	g_object_unref (file_stream);
+	return TRUE;
+}
+
+static gchar *
+query_etag (GFile *file,
+	    GCancellable *cancellable,
+	    GError **error)
+{
+	GFileInfo *info;
+	gchar *etag;
+
+	info = g_file_query_info (file, G_FILE_ATTRIBUTE_ETAG_VALUE,
+				  G_FILE_QUERY_INFO_NONE, cancellable, error);
+	if (info == NULL)
+		return NULL;
+
+	etag = g_strdup (g_file_info_get_etag (info));
+	g_object_unref (info);
+	return etag;
+}
+
+static gboolean
+sync_fd (gint fd,
+	 GError **error)
+{
+	if (fsync (fd) < 0) {
+		int errsv = errno;
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+			     "couldn't sync keyring file: %s", g_strerror (errsv));
+		return FALSE;
+	}
+
+	g_debug ("synced keyring file");
+	return TRUE;
+}
+
+/* Writes a temporary file and renames it over the keyring file, only
+ * syncing it when asked to. A crash of the process leaves either the
+ * old or the new file in place, but the new one may not survive a
+ * crash of the system until it has been synced */
+static gboolean
+replace_with_rename (WriteClosure *closure,
+		     GCancellable *cancellable,
+		     gchar **etag,
+		     GError **error)
+{
+	GOutputStream *file_stream;
+	GOutputStream *stream;
+	GError *local_error = NULL;
+	gchar *current;
+	gchar *path;
+	gchar *temp;
+	gboolean ret = FALSE;
+	gint fd;
+
+	/* Refuse to overwrite changes made by someone else, like
+	 * g_file_replace() does */
+	if (closure->etag != NULL) {
+		current = query_etag (closure->file, cancellable, &local_error);
+		if (current == NULL &&
+		    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+			g_propagate_error (error, local_error);
+			return FALSE;
+		}
+		g_clear_error (&local_error);
+		if (current != NULL && !g_str_equal (current, closure->etag)) {
+			g_free (current);
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WRONG_ETAG,
+					     "The file was externally modified");
+			return FALSE;
+		}
+		g_free (current);
+	}
+
+	path = g_file_get_path (closure->file);
+	temp = g_strconcat (path, ".XXXXXX", NULL);
+	fd = g_mkstemp_full (temp, O_WRONLY, 0600);
+	if (fd < 0) {
+		int errsv = errno;
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+			     "couldn't create temporary file: %s", g_strerror (errsv));
+		g_free (temp);
+		g_free (path);
+		return FALSE;
+	}
+
+	file_stream = g_unix_output_stream_new (fd, TRUE);
+	stream = g_buffered_output_stream_new_sized (file_stream, WRITE_BUFFER_SIZE);
+	g_filter_output_stream_set_close_base_stream (G_FILTER_OUTPUT_STREAM (stream),
+						      FALSE);
+
+	if (write_records (stream, closure, cancellable, error) &&
+	    g_output_stream_close (stream, cancellable, error) &&
+	    (!closure->sync || sync_fd (fd, error)) &&
+	    g_output_stream_close (file_stream, cancellable, error)) {
+		if (g_rename (temp, path) < 0) {
+			int errsv = errno;
+			g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+				     "couldn't replace keyring file: %s", g_strerror (errsv));
+		} else {
+			ret = TRUE;
+			if (closure->sync)
+				sync_directory (closure->file);
+		}
+	}
+
+	g_object_unref (stream);
+	g_object_unref (file_stream);
+
+	if (!ret)
+		g_unlink (temp);
+	else
+		*etag = query_etag (closure->file, cancellable, NULL);
+
+	g_free (temp);
+	g_free (path);
+	return ret;
+}
+
+/* Blocks until no other process is writing the files; closing the
+ * returned descriptor releases the lock */
+static gint
+lock_files (GFile *file,
+	    GError **error)
+{
+	gchar *path;
+	gchar *lock_path;
+	gint fd;
+
+	path = g_file_get_path (file);
+	lock_path = g_strconcat (path, LOCK_FILE_SUFFIX, NULL);
+	g_free (path);
+
+	fd = g_open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		int errsv = errno;
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+			     "couldn't open lock file %s: %s",
+			     lock_path, g_strerror (errsv));
+		g_free (lock_path);
+		return -1;
+	}
+
+	while (flock (fd, LOCK_EX) < 0) {
+		int errsv = errno;
+		if (errsv == EINTR)
+			continue;
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+			     "couldn't lock %s: %s", lock_path, g_strerror (errsv));
+		close (fd);
+		fd = -1;
+		break;
+	}
+
+	g_free (lock_path);
+	return fd;
+}
+
+/* Whether the files are still as they were last read or written by
+ * this collection; called with the lock held */
+static gboolean
+check_file_stamps (WriteClosure *closure,
+		   GError **error)
+{
+	FileStamp stamp;
+	FileStamp journal_stamp;
+
+	get_file_stamp (closure->file, &stamp);
+	get_file_stamp (closure->journal_file, &journal_stamp);
+	if (!file_stamp_equal (&stamp, &closure->file_stamp) ||
+	    !file_stamp_equal (&journal_stamp, &closure->journal_stamp)) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WRONG_ETAG,
+				     "The file was externally modified");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Starts a new journal for the keyring file just written, or gets rid
+ * of the one which is now obsolete. The keyring file is already in
+ * place, so failing here is not fatal */
+static void
+reset_journal (WriteClosure *closure,
+	       GCancellable *cancellable)
+{
+	GError *error = NULL;
+
+	if (closure->journal) {
+		closure->journal_valid =
+			g_file_replace_contents (closure->journal_file,
+						 (gchar *) closure->header,
+						 JOURNAL_HEADER_LEN,
+						 NULL,
+						 FALSE,
+						 G_FILE_CREATE_PRIVATE |
+						 G_FILE_CREATE_REPLACE_DESTINATION,
+						 NULL,
+						 cancellable,
+						 &error);
+		if (!closure->journal_valid) {
+			g_debug ("couldn't reset journal: %s", error->message);
+			g_clear_error (&error);
+		}
+	} else if (closure->journal_valid) {
+		if (!g_file_delete (closure->journal_file, cancellable, &error)) {
+			if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+				g_debug ("couldn't remove journal: %s", error->message);
+			g_clear_error (&error);
+		}
+		closure->journal_valid = FALSE;
+	}
+}
+
+/* Runs in a thread, only touching what's in the closure while writing;
+ * the outcome is applied to the collection from the thread as well, so
+ * that the writes queued after this one don't depend on the main
+ * context of whoever queued it */
+static void
+write_stream_thread (GTask *stream_task,
+		     gpointer source_object,
+		     gpointer task_data,
+		     GCancellable *cancellable)
+{
+	GTask *task = task_data;
+	WriteClosure *closure = g_task_get_task_data (task);
+	GError *error = NULL;
 	gchar *etag = NULL;
+	gboolean ret;
+	gint lock;
 
-	self->file_last_modified = get_file_last_modified (self);
+	lock = lock_files (closure->file, &error);
+	if (lock >= 0) {
+		if (!check_file_stamps (closure, &error))
+			ret = FALSE;
+		else if (closure->durability == SECRET_FILE_DURABILITY_ALWAYS)
+			ret = replace_with_gio (closure, cancellable, &etag, &error);
+		else
+			ret = replace_with_rename (closure, cancellable, &etag, &error);
 
-	ret = g_file_load_contents_finish (file, result,
-					   &contents, &length,
-					   &etag,
-					   &error);
+		if (ret) {
+			reset_journal (closure, cancellable);
+			get_file_stamp (closure->file, &closure->file_stamp);
+			get_file_stamp (closure->journal_file, &closure->journal_stamp);
+		}
+
+		close (lock);
+	}
+
+	write_stream_done (source_object, task, etag, error);
+	g_task_return_boolean (stream_task, TRUE);
+}
+
+static void
+sync_file (GFile *file,
+	   gboolean optional)
+{
+	GError *error = NULL;
+	gchar *path;
+	gint fd;
 
-	if (!ret) {
-		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
-			g_clear_error (&error);
+	path = g_file_get_path (file);
+	fd = g_open (path, O_RDONLY, 0);
+	g_free (path);
 
-			if (init_empty_file (self, &error)) {
-				g_task_return_boolean (task, TRUE);
-				g_object_unref (task);
-				return;
-			}
-		}
+	if (fd < 0) {
+		int errsv = errno;
+		if (optional && errsv == ENOENT)
+			return;
+		g_set_error (&error, G_IO_ERROR, g_io_error_from_errno (errsv),
+			     "couldn't open keyring file: %s", g_strerror (errsv));
+	} else {
+		sync_fd (fd, &error);
+		close (fd);
+	}
 
-		g_task_return_error (task, error);
-		g_object_unref (task);
-		return;
+	if (error != NULL) {
+		g_debug ("%s", error->message);
+		g_error_free (error);
 	}
+}
 
-	g_clear_pointer (&self->etag, g_free);
-	self->etag = g_steal_pointer (&etag);
+/* The journal is synced along with the keyring file, if there is one */
+static void
+sync_file_thread (GTask *task,
+		  gpointer source_object,
+		  gpointer task_data,
+		  GCancellable *cancellable)
+{
+	SecretFileCollection *self = source_object;
 
-	ret = load_contents (self, contents, length, &error);
-	if (ret)
-		g_task_return_boolean (task, ret);
-	else
-		g_task_return_error (task, error);
+	sync_file (self->file, FALSE);
+	sync_file (self->journal_file, TRUE);
 
-	g_object_unref (task);
+	g_task_return_boolean (task, TRUE);
 }
 
-static void
-secret_file_collection_real_init_async (GAsyncInitable *initable,
-					int io_priority,
-					GCancellable *cancellable,
-					GAsyncReadyCallback callback,
-					gpointer user_data)
+/* Syncs what was written since the last time, without waiting */
+static gboolean
+on_sync_timeout (gpointer user_data)
 {
-	SecretFileCollection *self = SECRET_FILE_COLLECTION (initable);
+	SecretFileCollection *self = user_data;
 	GTask *task;
 
-	task = g_task_new (initable, cancellable, callback, user_data);
+	g_rec_mutex_lock (&self->lock);
+	g_clear_pointer (&self->sync_source, g_source_unref);
+	self->synced_time = g_get_monotonic_time ();
+	g_rec_mutex_unlock (&self->lock);
+
+	task = g_task_new (self, NULL, NULL, NULL);
+	g_task_run_in_thread (task, sync_file_thread);
+	g_object_unref (task);
 
-	g_file_load_contents_async (self->file, cancellable, on_load_contents, task);
+	return G_SOURCE_REMOVE;
 }
 
+/* With batched durability, the keyring file is synced when it is
+ * written if that didn't happen for a while, and otherwise once the
+ * interval is over */
 static gboolean
-secret_file_collection_real_init_finish (GAsyncInitable *initable,
-					 GAsyncResult *result,
-					 GError **error)
+write_needs_sync (SecretFileCollection *self)
 {
-	g_return_val_if_fail (g_task_is_valid (result, initable), FALSE);
+	gint64 now = g_get_monotonic_time ();
+	gint64 interval = (gint64) self->sync_interval * G_TIME_SPAN_MILLISECOND;
 
-	return g_task_propagate_boolean (G_TASK (result), error);
+	switch (self->durability) {
+	case SECRET_FILE_DURABILITY_NONE:
+		return FALSE;
+	case SECRET_FILE_DURABILITY_BATCHED:
+		if (self->sync_source != NULL)
+			return FALSE;
+		if (self->synced_time == 0 || now - self->synced_time >= interval) {
+			self->synced_time = now;
+			return TRUE;
+		}
+		/* Writes may be started from a thread, or from a context
+		 * which is only run for the duration of a synchronous call */
+		self->sync_source = g_timeout_source_new (MAX (0, self->synced_time + interval - now) /
+							  G_TIME_SPAN_MILLISECOND);
+		g_source_set_callback (self->sync_source, on_sync_timeout,
+				       g_object_ref (self), g_object_unref);
+		g_source_attach (self->sync_source, get_watch_context ());
+		return FALSE;
+	case SECRET_FILE_DURABILITY_ALWAYS:
+	default:
+		return TRUE;
+	}
 }
 
-static void
-secret_file_collection_async_initable_iface (GAsyncInitableIface *iface)
+/* The size of a GVariant container with the given body and number of
+ * framing offsets, which are as large as needed to address it all */
+static gsize
+framed_size (gsize body_size,
+	     gsize n_offsets,
+	     gsize *offset_size)
 {
-	iface->init_async = secret_file_collection_real_init_async;
-	iface->init_finish = secret_file_collection_real_init_finish;
+	if (body_size + n_offsets <= G_MAXUINT8)
+		*offset_size = 1;
+	else if (body_size + 2 * n_offsets <= G_MAXUINT16)
+		*offset_size = 2;
+	else if (body_size + 4 * n_offsets <= G_MAXUINT32)
+		*offset_size = 4;
+	else
+		*offset_size = 8;
+
+	return body_size + *offset_size * n_offsets;
 }
 
-static GVariant *
-hash_attributes (SecretFileCollection *self,
-		 GHashTable *attributes)
+static void
+append_padding (GByteArray *array,
+		gsize start,
+		gsize alignment)
 {
-	GVariantBuilder builder;
-	guint8 buffer[MAC_SIZE];
-	GList *keys;
-	GList *l;
+	static const guint8 zeros[8] = { 0, };
+	gsize pos = array->len - start;
 
-	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{say}"));
+	g_byte_array_append (array, zeros, ((pos + alignment - 1) & ~(alignment - 1)) - pos);
+}
 
-	keys = g_hash_table_get_keys (attributes);
-	keys = g_list_sort (keys, (GCompareFunc) g_strcmp0);
+typedef struct {
+	const gchar *name;
+	GBytes *mac;
+	GArray *positions;
+} IndexBuilderEntry;
 
-	for (l = keys; l; l = g_list_next (l)) {
-		const gchar *value;
-		GVariant *variant;
+static gint
+compare_index_builder_entry (gconstpointer a,
+			     gconstpointer b)
+{
+	const IndexBuilderEntry *entry_a = a;
+	const IndexBuilderEntry *entry_b = b;
 
-		value = g_hash_table_lookup (attributes, l->data);
-		if (!egg_keyring1_calculate_mac (self->key,
-						 (const guint8 *)value,
-						 strlen (value),
-						 buffer)) {
-			g_list_free (keys);
-			return NULL;
-		}
+	return compare_index_entry (entry_a->name, strlen (entry_a->name),
+				    g_bytes_get_data (entry_a->mac, NULL),
+				    entry_b->name, strlen (entry_b->name),
+				    g_bytes_get_data (entry_b->mac, NULL));
+}
 
-		variant = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
-						     buffer,
-						     MAC_SIZE,
-						     sizeof(guint8));
-		g_variant_builder_add (&builder, "{s@ay}", l->data, variant);
-	}
-	g_list_free (keys);
+static gint
+compare_position (gconstpointer a,
+		  gconstpointer b)
+{
+	guint32 position_a = *(const guint32 *) a;
+	guint32 position_b = *(const guint32 *) b;
 
-	return g_variant_builder_end (&builder);
+	return (position_a > position_b) - (position_a < position_b);
 }
 
-static gboolean
-hashed_attributes_match (SecretFileCollection *self,
-			 GVariant *hashed_attributes,
-			 GHashTable *attributes)
+/* Builds the index stored after the contents, from the in-memory one;
+ * @positions maps the hashed attributes of each item to its position
+ * in the items array */
+static GByteArray *
+build_index (SecretFileCollection *self,
+	     GHashTable *positions,
+	     gsize contents_size)
 {
-	GHashTableIter iter;
-	GVariant *hashed_attribute = NULL;
+	guint8 base_id[JOURNAL_BASE_ID_LEN];
+	GHashTableIter names_iter;
+	GHashTableIter macs_iter;
+	GHashTableIter keys_iter;
+	gpointer name;
+	gpointer macs;
+	gpointer mac;
+	gpointer keys;
 	gpointer key;
-	gpointer value;
+	GArray *entries;
+	GByteArray *entries_data;
+	GByteArray *positions_data;
+	GByteArray *names_data;
+	GByteArray *index = NULL;
+	const gchar *last_name = NULL;
+	guint32 name_offset = 0;
+	guint32 u32;
+	guint i;
+	guint j;
 
-	g_hash_table_iter_init (&iter, attributes);
-	while (g_hash_table_iter_next (&iter, &key, &value)) {
-		const guint8 *data;
-		gsize n_data;
+	journal_base_id (self, contents_size, base_id);
 
-		if (!g_variant_lookup (hashed_attributes, key,
-				       "@ay", &hashed_attribute))
-			return FALSE;
+	entries = g_array_new (FALSE, FALSE, sizeof (IndexBuilderEntry));
+	g_hash_table_iter_init (&names_iter, self->index);
+	while (g_hash_table_iter_next (&names_iter, &name, &macs)) {
+		g_hash_table_iter_init (&macs_iter, macs);
+		while (g_hash_table_iter_next (&macs_iter, &mac, &keys)) {
+			IndexBuilderEntry entry;
 
-		data = g_variant_get_fixed_array (hashed_attribute,
-						  &n_data, sizeof(guint8));
-		if (n_data != MAC_SIZE) {
-			g_variant_unref (hashed_attribute);
-			return FALSE;
-		}
+			/* Can't be matched by any query anyway */
+			if (g_bytes_get_size (mac) != MAC_SIZE)
+				continue;
 
-		if (!egg_keyring1_verify_mac (self->key, value, strlen ((char *)value), data)) {
-			g_variant_unref (hashed_attribute);
-			return FALSE;
+			entry.name = name;
+			entry.mac = mac;
+			entry.positions = g_array_sized_new (FALSE, FALSE, sizeof (guint32),
+							     g_hash_table_size (keys));
+			g_hash_table_iter_init (&keys_iter, keys);
+			while (g_hash_table_iter_next (&keys_iter, &key, NULL)) {
+				guint32 position = GPOINTER_TO_UINT (g_hash_table_lookup (positions, key));
+				g_array_append_val (entry.positions, position);
+			}
+			g_array_sort (entry.positions, compare_position);
+			g_array_append_val (entries, entry);
 		}
-		g_variant_unref (hashed_attribute);
 	}
+	g_array_sort (entries, compare_index_builder_entry);
 
-	return TRUE;
-}
+	entries_data = g_byte_array_sized_new (entries->len * INDEX_ENTRY_SIZE);
+	positions_data = g_byte_array_new ();
+	names_data = g_byte_array_new ();
 
-gboolean
-secret_file_collection_replace (SecretFileCollection *self,
-				GHashTable *attributes,
-				const gchar *label,
-				SecretValue *value,
-				GError **error)
-{
-	GVariantBuilder builder;
-	GVariant *hashed_attributes;
-	GVariantIter iter;
-	GVariant *child;
-	SecretFileItem *item;
-	GVariant *serialized_item;
-	guint8 *data = NULL;
-	gsize n_data;
-	gsize n_padded;
-	GVariant *variant;
-	GDateTime *created = NULL;
-	GDateTime *modified;
+	for (i = 0; i < entries->len; i++) {
+		IndexBuilderEntry *entry = &g_array_index (entries, IndexBuilderEntry, i);
+		guint32 first = positions_data->len / 4;
+		guint8 entry_mac[MAC_SIZE];
 
-	ensure_up_to_date (self);
+		/* The entries of an attribute are next to each other */
+		if (last_name == NULL || strcmp (last_name, entry->name) != 0) {
+			name_offset = names_data->len;
+			g_byte_array_append (names_data, (const guint8 *) entry->name,
+					     strlen (entry->name));
+			last_name = entry->name;
+		}
 
-	hashed_attributes = hash_attributes (self, attributes);
-	if (!hashed_attributes) {
-		g_set_error (error,
-			     SECRET_ERROR,
-			     SECRET_ERROR_PROTOCOL,
-			     "couldn't calculate mac");
-		return FALSE;
-	}
+		for (j = 0; j < entry->positions->len; j++) {
+			u32 = GUINT32_TO_LE (g_array_index (entry->positions, guint32, j));
+			g_byte_array_append (positions_data, (guint8 *) &u32, 4);
+		}
 
-	/* Filter out the existing item */
-	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(a{say}ay)"));
-	g_variant_iter_init (&iter, self->items);
-	while ((child = g_variant_iter_next_value (&iter)) != NULL) {
-		GVariant *_hashed_attributes;
-		g_variant_get (child, "(@a{say}ay)", &_hashed_attributes, NULL);
-		if (g_variant_equal (hashed_attributes, _hashed_attributes)) {
-			SecretFileItem *existing =
-				_secret_file_item_decrypt (child, self, error);
-			guint64 created_time;
-
-			if (existing == NULL) {
-				g_variant_builder_clear (&builder);
-				g_variant_unref (child);
-				g_variant_unref (_hashed_attributes);
-				return FALSE;
-			}
-			g_object_get (existing, "created", &created_time, NULL);
-			g_object_unref (existing);
+		if (!calculate_index_entry_mac (self->context, base_id,
+						entry->name, strlen (entry->name),
+						g_bytes_get_data (entry->mac, NULL),
+						positions_data->data + (gsize) first * 4,
+						entry->positions->len, entry_mac))
+			goto out;
 
-			created = g_date_time_new_from_unix_utc (created_time);
-		} else {
-			g_variant_builder_add_value (&builder, child);
-		}
-		g_variant_unref (child);
-		g_variant_unref (_hashed_attributes);
+		u32 = GUINT32_TO_LE (name_offset);
+		g_byte_array_append (entries_data, (guint8 *) &u32, 4);
+		u32 = GUINT32_TO_LE (strlen (entry->name));
+		g_byte_array_append (entries_data, (guint8 *) &u32, 4);
+		g_byte_array_append (entries_data, g_bytes_get_data (entry->mac, NULL), MAC_SIZE);
+		u32 = GUINT32_TO_LE (first);
+		g_byte_array_append (entries_data, (guint8 *) &u32, 4);
+		u32 = GUINT32_TO_LE (entry->positions->len);
+		g_byte_array_append (entries_data, (guint8 *) &u32, 4);
+		g_byte_array_append (entries_data, entry_mac, MAC_SIZE);
 	}
 
-	modified = g_date_time_new_now_utc ();
-	if (created == NULL)
-		created = g_date_time_ref (modified);
+	index = g_byte_array_sized_new (4 + entries_data->len + 4 +
+					positions_data->len + names_data->len);
+	u32 = GUINT32_TO_LE (entries->len);
+	g_byte_array_append (index, (guint8 *) &u32, 4);
+	g_byte_array_append (index, entries_data->data, entries_data->len);
+	u32 = GUINT32_TO_LE (positions_data->len / 4);
+	g_byte_array_append (index, (guint8 *) &u32, 4);
+	g_byte_array_append (index, positions_data->data, positions_data->len);
+	g_byte_array_append (index, names_data->data, names_data->len);
 
-	/* Create a new item and append it */
-	item = g_object_new (SECRET_TYPE_FILE_ITEM,
-			     "attributes", attributes,
-			     "label", label,
-			     "value", value,
-			     "created", g_date_time_to_unix (created),
-			     "modified", g_date_time_to_unix (modified),
-			     NULL);
+ out:
+	for (i = 0; i < entries->len; i++)
+		g_array_unref (g_array_index (entries, IndexBuilderEntry, i).positions);
+	g_array_unref (entries);
+	g_byte_array_unref (entries_data);
+	g_byte_array_unref (positions_data);
+	g_byte_array_unref (names_data);
 
-	g_date_time_unref (created);
-	g_date_time_unref (modified);
+	return index;
+}
 
-	serialized_item = secret_file_item_serialize (item);
-	g_object_unref (item);
+/* Lays out the (uayutua(a{say}ay)) tuple the same way as GVariant
+ * would, but without serializing the items into a single buffer; the
+ * records already serialized on their own are written one after the
+ * other by write_stream_thread() */
+static void
+write_full (SecretFileCollection *self,
+	    GTask *task)
+{
+	WriteClosure *closure = g_task_get_task_data (task);
+	guint8 base_id[JOURNAL_BASE_ID_LEN];
+	GHashTable *positions = NULL;
+	GList *keys, *l;
+	GVariant *record;
+	gsize items_size = 0;
+	gsize start;
+	guint8 version[2];
+	guint32 u32;
+	guint64 u64;
+	GTask *stream_task;
 
-	/* Encrypt the item with PKCS #7 padding */
-	n_data = g_variant_get_size (serialized_item);
-	n_padded = ((n_data + CIPHER_BLOCK_SIZE) / CIPHER_BLOCK_SIZE) *
-		CIPHER_BLOCK_SIZE;
-	data = egg_secure_alloc (n_padded + IV_SIZE + MAC_SIZE);
-	g_variant_store (serialized_item, data);
-	g_variant_unref (serialized_item);
-	memset (data + n_data, n_padded - n_data, n_padded - n_data);
-	if (!egg_keyring1_encrypt (self->key, data, n_padded)) {
-		egg_secure_free (data);
-		g_set_error (error,
-			     SECRET_ERROR,
-			     SECRET_ERROR_PROTOCOL,
-			     "couldn't encrypt item");
-		return FALSE;
-	}
+	ensure_records (self);
+	write_take_changes (self, closure);
+	closure->etag = g_strdup (self->etag);
+	closure->journal = self->journal;
+	closure->journal_valid = self->journal_valid;
+	closure->durability = self->durability;
+	closure->sync = write_needs_sync (self);
 
-	if (!egg_keyring1_calculate_mac (self->key, data, n_padded + IV_SIZE,
-					 data + n_padded + IV_SIZE)) {
-		egg_secure_free (data);
-		g_set_error (error,
-			     SECRET_ERROR,
-			     SECRET_ERROR_PROTOCOL,
-			     "couldn't calculate mac");
-		return FALSE;
+	/* The records are immutable, so these stay as they are while the
+	 * collection changes during the write */
+	closure->records = g_ptr_array_new_full (g_hash_table_size (self->records),
+						 (GDestroyNotify) g_variant_unref);
+	if (self->use_index)
+		positions = g_hash_table_new (g_bytes_hash, g_bytes_equal);
+	keys = g_hash_table_get_keys (self->records);
+	keys = g_list_sort_with_data (keys, compare_sequence, self);
+	for (l = keys; l != NULL; l = g_list_next (l)) {
+		record = g_hash_table_lookup (self->records, l->data);
+		items_size += g_variant_get_size (record);
+		if (positions)
+			g_hash_table_insert (positions, l->data,
+					     GUINT_TO_POINTER (closure->records->len));
+		g_ptr_array_add (closure->records, g_variant_ref (record));
 	}
+	g_list_free (keys);
 
-	self->usage_count++;
-	g_date_time_unref (self->modified);
-	self->modified = g_date_time_new_now_utc ();
-
-	variant = g_variant_new_from_data (G_VARIANT_TYPE ("ay"),
-					   data,
-					   n_padded + IV_SIZE + MAC_SIZE,
-					   TRUE,
-					   egg_secure_free,
-					   data);
-	variant = g_variant_new ("(@a{say}@ay)", hashed_attributes, variant);
-	g_variant_builder_add_value (&builder, variant);
+	closure->head = g_byte_array_new ();
+	g_byte_array_append (closure->head, (const guint8 *) KEYRING_FILE_HEADER,
+			     KEYRING_FILE_HEADER_LEN);
+	version[0] = MAJOR_VERSION;
+	version[1] = self->minor_version;
+	if (self->use_index)
+		version[1] |= MINOR_VERSION_INDEX_FLAG;
+	if (self->compressed)
+		version[1] |= MINOR_VERSION_COMPRESS_FLAG;
+	if (self->bookkeeping)
+		version[1] |= MINOR_VERSION_BOOKKEEPING_FLAG;
+	if (self->journal)
+		version[1] |= MINOR_VERSION_JOURNAL_FLAG;
+	g_byte_array_append (closure->head, version, 2);
 
-	g_variant_unref (self->items);
-	self->items = g_variant_builder_end (&builder);
-	g_variant_ref_sink (self->items);
+	start = closure->head->len;
+	u32 = GUINT32_TO_LE (g_bytes_get_size (self->salt));
+	g_byte_array_append (closure->head, (guint8 *) &u32, 4);
+	g_byte_array_append (closure->head, g_bytes_get_data (self->salt, NULL),
+			     g_bytes_get_size (self->salt));
+	closure->salt_end = closure->head->len - start;
+	append_padding (closure->head, start, 4);
+	u32 = GUINT32_TO_LE (self->iteration_count);
+	g_byte_array_append (closure->head, (guint8 *) &u32, 4);
+	append_padding (closure->head, start, 8);
+	u64 = GUINT64_TO_LE (g_date_time_to_unix (self->modified));
+	g_byte_array_append (closure->head, (guint8 *) &u64, 8);
+	u32 = GUINT32_TO_LE (self->usage_count);
+	g_byte_array_append (closure->head, (guint8 *) &u32, 4);
 
-	return TRUE;
-}
+	/* The items array has an alignment of 1, and is followed by the
+	 * offset of the end of the salt, the only other member which isn't
+	 * of a fixed size */
+	items_size = framed_size (items_size, closure->records->len,
+				  &closure->items_offset_size);
+	closure->contents_size = framed_size (closure->head->len - start + items_size,
+					      1, &closure->offset_size);
+	closure->n_contents = start + closure->contents_size;
 
-GList *
-secret_file_collection_search (SecretFileCollection *self,
-			       GHashTable *attributes)
-{
-	GVariantIter iter;
-	GVariant *child;
-	GList *result = NULL;
+	if (positions) {
+		closure->index = build_index (self, positions, closure->contents_size);
+		g_hash_table_unref (positions);
+		if (closure->index == NULL) {
+			write_done (self, g_error_new (SECRET_ERROR,
+						       SECRET_ERROR_PROTOCOL,
+						       "couldn't calculate mac"));
+			return;
+		}
+		closure->n_contents += closure->index->len + 8;
+	}
 
-	ensure_up_to_date (self);
+	/* A new nonce ties the new journal to this very file */
+	if (self->journal) {
+		egg_keyring1_create_nonce (closure->nonce, FILE_NONCE_SIZE);
+		closure->n_contents += FILE_NONCE_SIZE;
+	}
 
-	g_variant_iter_init (&iter, self->items);
-	while ((child = g_variant_iter_next_value (&iter)) != NULL) {
-		GVariant *hashed_attributes;
-		gboolean matched;
+	/* Everything pending is part of the new keyring file */
+	g_ptr_array_set_size (self->pending, 0);
 
-		g_variant_get (child, "(@a{say}ay)", &hashed_attributes, NULL);
-		matched = hashed_attributes_match (self,
-						   hashed_attributes,
-						   attributes);
-		g_variant_unref (hashed_attributes);
-		if (matched)
-			result = g_list_append (result, g_variant_ref (child));
-		g_variant_unref (child);
+	journal_base_id (self, closure->n_contents, base_id);
+	if (self->journal &&
+	    !journal_create_header (self, base_id, closure->nonce, closure->header)) {
+		write_done (self, g_error_new (SECRET_ERROR,
+					       SECRET_ERROR_PROTOCOL,
+					       "couldn't calculate mac"));
+		return;
 	}
 
-	return result;
+	stream_task = g_task_new (self, g_task_get_cancellable (task), NULL, NULL);
+	g_task_set_task_data (stream_task, g_object_ref (task), g_object_unref);
+	g_task_run_in_thread (stream_task, write_stream_thread);
+	g_object_unref (stream_task);
 }
 
-SecretFileItem *
-_secret_file_item_decrypt (GVariant *encrypted,
-			   SecretFileCollection *collection,
-			   GError **error)
+static void
+write_journal_done (SecretFileCollection *self,
+		    GTask *task,
+		    GError *error)
 {
-	GVariant *blob;
-	gconstpointer padded;
-	gsize n_data;
-	gsize n_padded;
-	guint8 *data;
-	SecretFileItem *item;
-	GVariant *serialized_item;
-
-	g_variant_get (encrypted, "(a{say}@ay)", NULL, &blob);
+	WriteClosure *closure = g_task_get_task_data (task);
 
-	/* Decrypt the item */
-	padded = g_variant_get_fixed_array (blob, &n_padded, sizeof(guint8));
-	data = egg_secure_alloc (n_padded);
-	memcpy (data, padded, n_padded);
-	g_variant_unref (blob);
+	g_rec_mutex_lock (&self->lock);
 
-	if (n_padded < IV_SIZE + MAC_SIZE) {
-		egg_secure_free (data);
-		g_set_error (error,
-			     SECRET_ERROR,
-			     SECRET_ERROR_PROTOCOL,
-			     "couldn't calculate mac");
-		return FALSE;
+	if (error != NULL) {
+		if (!write_merge (self, task, error))
+			write_done (self, error);
+		g_rec_mutex_unlock (&self->lock);
+		return;
 	}
 
-	n_padded -= MAC_SIZE;
-	if (!egg_keyring1_verify_mac (collection->key, data, n_padded, data + n_padded)) {
-		egg_secure_free (data);
-		g_set_error (error,
-			     SECRET_ERROR,
-			     SECRET_ERROR_PROTOCOL,
-			     "couldn't calculate mac");
-		return FALSE;
-	}
+	self->journal_stamp = closure->journal_stamp;
+	self->journal_size = closure->journal_stamp.size;
 
-	n_padded -= IV_SIZE;
-	if (!egg_keyring1_decrypt (collection->key, data, n_padded)) {
-		egg_secure_free (data);
-		g_set_error (error,
-			     SECRET_ERROR,
-			     SECRET_ERROR_PROTOCOL,
-			     "couldn't decrypt item");
-		return NULL;
+	/* Fold the journal into the keyring file in the background */
+	if (journal_needs_compaction (self)) {
+		GTask *compact = g_task_new (self, NULL, NULL, NULL);
+		WriteClosure *compact_closure = g_new0 (WriteClosure, 1);
+
+		compact_closure->compact = TRUE;
+		g_task_set_task_data (compact, compact_closure, write_closure_free);
+		queue_write (self, compact);
 	}
 
-	/* Remove PKCS #7 padding */
-	n_data = n_padded - data[n_padded - 1];
-
-	serialized_item =
-		g_variant_new_from_data (G_VARIANT_TYPE ("(a{ss}sttay)"),
-					 data,
-					 n_data,
-					 TRUE,
-					 egg_secure_free,
-					 data);
-	item = secret_file_item_deserialize (serialized_item);
-	g_variant_unref (serialized_item);
-	return item;
+	write_done (self, NULL);
+	g_rec_mutex_unlock (&self->lock);
 }
 
-gboolean
-secret_file_collection_clear (SecretFileCollection *self,
-			      GHashTable *attributes,
-			      GError **error)
+/* Runs in a thread, like write_stream_thread() */
+static void
+write_journal_thread (GTask *journal_task,
+		      gpointer source_object,
+		      gpointer task_data,
+		      GCancellable *cancellable)
 {
-	GVariantBuilder builder;
-	GVariantIter items;
-	GVariant *child;
-	gboolean removed = FALSE;
-
-	ensure_up_to_date (self);
+	GTask *task = task_data;
+	WriteClosure *closure = g_task_get_task_data (task);
+	GFileOutputStream *stream;
+	GError *error = NULL;
+	gboolean created;
+	gint lock;
 
-	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(a{say}ay)"));
-	g_variant_iter_init (&items, self->items);
-	while ((child = g_variant_iter_next_value (&items)) != NULL) {
-		GVariant *hashed_attributes;
-		gboolean matched;
+	lock = lock_files (closure->file, &error);
 
-		g_variant_get (child, "(@a{say}ay)", &hashed_attributes, NULL);
-		matched = hashed_attributes_match (self,
-						   hashed_attributes,
-						   attributes);
-		g_variant_unref (hashed_attributes);
-		if (matched)
-			removed = TRUE;
-		else
-			g_variant_builder_add_value (&builder, child);
-		g_variant_unref (child);
+	/* Records appended to the journal of another keyring file would
+	 * be ignored, and the journal has to be read again anyway when
+	 * someone else appended to it */
+	if (lock >= 0 && check_file_stamps (closure, &error)) {
+		created = closure->journal_stamp.inode == 0;
+		stream = g_file_append_to (closure->journal_file,
+					   G_FILE_CREATE_PRIVATE,
+					   cancellable,
+					   &error);
+		/* The records are only synced as the keyring file would
+		 * be, see write_needs_sync() */
+		if (stream != NULL) {
+			if (g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+						       closure->contents,
+						       closure->n_contents,
+						       NULL, cancellable, &error) &&
+			    (!closure->sync ||
+			     sync_fd (g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (stream)),
+				      &error)))
+				g_output_stream_close (G_OUTPUT_STREAM (stream),
+						       cancellable, &error);
+			g_object_unref (stream);
+			if (error == NULL && closure->sync && created)
+				sync_directory (closure->journal_file);
+		}
+		get_file_stamp (closure->journal_file, &closure->journal_stamp);
 	}
 
-	g_variant_unref (self->items);
-	self->items = g_variant_builder_end (&builder);
-	g_variant_ref_sink (self->items);
+	if (lock >= 0)
+		close (lock);
 
-	return removed;
+	write_journal_done (source_object, task, error);
+	g_task_return_boolean (journal_task, TRUE);
 }
 
 static void
-on_replace_contents (GObject *source_object,
-		     GAsyncResult *result,
-		     gpointer user_data)
+write_journal (SecretFileCollection *self,
+	       GTask *task)
 {
-	GFile *file = G_FILE (source_object);
-	GTask *task = G_TASK (user_data);
-	SecretFileCollection *self = g_task_get_source_object (task);
-	GError *error = NULL;
-	gchar *etag = NULL;
+	WriteClosure *closure = g_task_get_task_data (task);
+	GTask *journal_task;
+	guint8 *p;
+	guint i;
 
-	if (!g_file_replace_contents_finish (file, result, &etag, &error)) {
-		g_task_return_error (task, error);
-		g_object_unref (task);
+	if (self->pending->len == 0) {
+		write_done (self, NULL);
 		return;
 	}
 
-	self->file_last_modified = get_file_last_modified (self);
-	g_clear_pointer (&self->etag, g_free);
-	self->etag = g_steal_pointer (&etag);
+	closure->n_contents = 0;
+	for (i = 0; i < self->pending->len; i++) {
+		GVariant *entry = g_ptr_array_index (self->pending, i);
+		closure->n_contents += 4 + g_variant_get_size (entry) + MAC_SIZE;
+	}
 
-	g_task_return_boolean (task, TRUE);
-	g_object_unref (task);
+	closure->contents = g_new (guint8, closure->n_contents);
+	p = closure->contents;
+	for (i = 0; i < self->pending->len; i++) {
+		GVariant *entry = g_ptr_array_index (self->pending, i);
+		guint32 n_data = g_variant_get_size (entry);
+		guint32 n_data_le = GUINT32_TO_LE (n_data);
+
+		memcpy (p, &n_data_le, 4);
+		p += 4;
+		g_variant_store (entry, p);
+		if (!egg_keyring1_calculate_mac (self->context, p, n_data, p + n_data)) {
+			write_done (self, g_error_new (SECRET_ERROR,
+						       SECRET_ERROR_PROTOCOL,
+						       "couldn't calculate mac"));
+			return;
+		}
+		p += n_data + MAC_SIZE;
+	}
+
+	g_ptr_array_set_size (self->pending, 0);
+	write_take_changes (self, closure);
+	closure->durability = self->durability;
+	closure->sync = write_needs_sync (self);
+
+	journal_task = g_task_new (self, g_task_get_cancellable (task), NULL, NULL);
+	g_task_set_task_data (journal_task, g_object_ref (task), g_object_unref);
+	g_task_run_in_thread (journal_task, write_journal_thread);
+	g_object_unref (journal_task);
+}
+
+static void
+write_next (SecretFileCollection *self)
+{
+	GTask *task = g_queue_peek_head (&self->writes);
+	WriteClosure *closure = g_task_get_task_data (task);
+
+	if (self->journal && self->journal_valid &&
+	    !closure->compact && !journal_needs_compaction (self))
+		write_journal (self, task);
+	else
+		write_full (self, task);
 }
 
 void
@@ -749,50 +4969,10 @@ secret_file_collection_write (SecretFileCollection *self,
 			      gpointer user_data)
 {
 	GTask *task;
-	guint8 *contents;
-	gsize n_contents;
-	guint8 *p;
-	GVariant *salt_array;
-	GVariant *variant;
-
-	salt_array = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
-						g_bytes_get_data (self->salt, NULL),
-						g_bytes_get_size (self->salt),
-						sizeof(guint8));
-	variant = g_variant_new ("(u@ayutu@a(a{say}ay))",
-				 GUINT32_TO_LE(g_bytes_get_size (self->salt)),
-				 salt_array,
-				 GUINT32_TO_LE(self->iteration_count),
-				 GUINT64_TO_LE(g_date_time_to_unix (self->modified)),
-				 GUINT32_TO_LE(self->usage_count),
-				 self->items);
-
-	g_variant_get_data (variant); /* force serialize */
-	n_contents = KEYRING_FILE_HEADER_LEN + 2 + g_variant_get_size (variant);
-	contents = g_new (guint8, n_contents);
-
-	p = contents;
-	memcpy (p, KEYRING_FILE_HEADER, KEYRING_FILE_HEADER_LEN);
-	p += KEYRING_FILE_HEADER_LEN;
-
-	*p++ = MAJOR_VERSION;
-	*p++ = MINOR_VERSION;
-
-	g_variant_store (variant, p);
-	g_variant_unref (variant);
 
 	task = g_task_new (self, cancellable, callback, user_data);
-	g_task_set_task_data (task, contents, g_free);
-	g_file_replace_contents_async (self->file,
-				       (gchar *) contents,
-				       n_contents,
-				       self->etag,
-				       TRUE,
-				       G_FILE_CREATE_PRIVATE |
-				       G_FILE_CREATE_REPLACE_DESTINATION,
-				       cancellable,
-				       on_replace_contents,
-				       task);
+	g_task_set_task_data (task, g_new0 (WriteClosure, 1), write_closure_free);
+	queue_write (self, task);
 }
 
 gboolean
@@ -22,11 +22,33 @@
 #include "secret-file-item.h"
 #include "secret-value.h"
 
+#include "egg/egg-keyring1.h"
+
 G_BEGIN_DECLS
 
+typedef enum {
+	SECRET_FILE_DURABILITY_ALWAYS,
+	SECRET_FILE_DURABILITY_BATCHED,
+	SECRET_FILE_DURABILITY_NONE
+} SecretFileDurability;
+
+/* With batched durability, the keyring file is synced at most this
+ * often, in milliseconds */
+#define DEFAULT_SYNC_INTERVAL 1000
+
+typedef struct _SecretFileWatch SecretFileWatch;
+
 #define SECRET_TYPE_FILE_COLLECTION (secret_file_collection_get_type ())
 G_DECLARE_FINAL_TYPE (SecretFileCollection, secret_file_collection, SECRET, FILE_COLLECTION, GObject)
 
+void            secret_file_collection_refresh (SecretFileCollection  *self,
+                                                GCancellable          *cancellable,
+                                                GAsyncReadyCallback    callback,
+                                                gpointer               user_data);
+gboolean        secret_file_collection_refresh_finish
+                                               (SecretFileCollection  *self,
+                                                GAsyncResult          *result,
+                                                GError               **error);
 gboolean        secret_file_collection_replace (SecretFileCollection  *self,
                                                 GHashTable            *attributes,
                                                 const gchar           *label,
@@ -34,9 +56,24 @@ gboolean        secret_file_collection_replace (SecretFileCollection  *self,
                                                 GError               **error);
 GList          *secret_file_collection_search (SecretFileCollection  *self,
                                                 GHashTable            *attributes);
+GList          *secret_file_collection_search_items
+                                               (SecretFileCollection  *self,
+                                                GHashTable            *attributes);
 gboolean        secret_file_collection_clear   (SecretFileCollection  *self,
                                                 GHashTable            *attributes,
                                                 GError               **error);
+gboolean        secret_file_collection_update  (SecretFileCollection  *self,
+                                                const gchar           *id,
+                                                SecretValue           *value,
+                                                GError               **error);
+gboolean        secret_file_collection_set_label
+                                               (SecretFileCollection  *self,
+                                                const gchar           *id,
+                                                const gchar           *label,
+                                                GError               **error);
+gboolean        secret_file_collection_delete  (SecretFileCollection  *self,
+                                                const gchar           *id,
+                                                GError               **error);
 void            secret_file_collection_write   (SecretFileCollection  *self,
                                                 GCancellable          *cancellable,
                                                 GAsyncReadyCallback    callback,
@@ -50,6 +87,37 @@ SecretFileItem *_secret_file_item_decrypt
                                                (GVariant              *encrypted,
                                                 SecretFileCollection  *collection,
                                                 GError               **error);
+SecretFileItem *_secret_file_item_decrypt_metadata
+                                               (GVariant              *encrypted,
+                                                SecretFileCollection  *collection,
+                                                GError               **error);
+SecretValue    *_secret_file_item_decrypt_value
+                                               (GVariant              *encrypted,
+                                                SecretFileCollection  *collection,
+                                                GError               **error);
+SecretFileItem *_secret_file_item_decrypt_metadata_full
+                                               (GVariant              *encrypted,
+                                                EggKeyring1Context    *context,
+                                                guint8                 minor_version,
+                                                GError               **error);
+SecretValue    *_secret_file_item_decrypt_value_full
+                                               (GVariant              *encrypted,
+                                                EggKeyring1Context    *context,
+                                                guint8                 minor_version,
+                                                GError               **error);
+gchar          *_secret_file_item_get_encrypted_id
+                                               (GVariant              *encrypted,
+                                                SecretFileCollection  *collection);
+SecretFileItem *_secret_file_item_new_deferred
+                                               (GVariant              *encrypted,
+                                                SecretFileCollection  *collection,
+                                                EggKeyring1Context    *context,
+                                                guint8                 minor_version);
+
+SecretFileWatch *_secret_file_watch_directory  (GFile                 *directory,
+                                                const gchar           *suffix);
+gboolean        _secret_file_watch_check_stale (SecretFileWatch       *watch);
+void            _secret_file_watch_free        (SecretFileWatch       *watch);
 
 G_END_DECLS
 
@@ -14,6 +14,7 @@
 
 #include "config.h"
 
+#include "secret-file-collection.h"
 #include "secret-file-item.h"
 #include "secret-retrievable.h"
 #include "secret-value.h"
@@ -26,7 +27,20 @@ struct _SecretFileItem
 	guint64 created;
 	guint64 modified;
 	SecretValue *value;
+	gchar *id;
+
+	/* the collection the item was found in, which changes it */
+	SecretFileCollection *collection;
+
+	/* Held until the item is decrypted, on first use, with the key
+	 * and format of the file the record was found in */
+	GMutex mutex;
 	GVariant *encrypted;
+	EggKeyring1Context *context;
+	guint8 minor_version;
+	/* the failure to decrypt the record, reported when the secret
+	 * is retrieved */
+	GError *error;
 };
 
 static void secret_file_item_retrievable_iface (SecretRetrievableInterface *iface);
@@ -41,12 +55,90 @@ enum {
 	PROP_LABEL,
 	PROP_CREATED,
 	PROP_MODIFIED,
-	PROP_VALUE
+	PROP_VALUE,
+	PROP_ID
 };
 
 static void
 secret_file_item_init (SecretFileItem *self)
 {
+	g_mutex_init (&self->mutex);
+}
+
+/* The encrypted record is no longer needed once both parts are known */
+static void
+release_encrypted (SecretFileItem *self)
+{
+	if (self->attributes != NULL && self->value != NULL) {
+		g_clear_pointer (&self->encrypted, g_variant_unref);
+		g_clear_pointer (&self->context, egg_keyring1_context_unref);
+	}
+}
+
+static gboolean
+ensure_metadata (SecretFileItem *self,
+		 GError **error)
+{
+	SecretFileItem *item;
+	gboolean ret = TRUE;
+
+	g_mutex_lock (&self->mutex);
+
+	if (self->attributes == NULL && self->encrypted != NULL &&
+	    self->error == NULL) {
+		item = _secret_file_item_decrypt_metadata_full (self->encrypted,
+								self->context,
+								self->minor_version,
+								&self->error);
+		if (item != NULL) {
+			self->attributes = g_steal_pointer (&item->attributes);
+			self->label = g_steal_pointer (&item->label);
+			self->created = item->created;
+			self->modified = item->modified;
+			if (self->value == NULL)
+				self->value = g_steal_pointer (&item->value);
+			g_object_unref (item);
+			release_encrypted (self);
+		}
+	}
+
+	if (self->error != NULL) {
+		if (error)
+			*error = g_error_copy (self->error);
+		ret = FALSE;
+	}
+
+	g_mutex_unlock (&self->mutex);
+
+	return ret;
+}
+
+static gboolean
+ensure_value (SecretFileItem *self,
+	      GError **error)
+{
+	gboolean ret = TRUE;
+
+	g_mutex_lock (&self->mutex);
+
+	if (self->value == NULL && self->encrypted != NULL &&
+	    self->error == NULL) {
+		self->value = _secret_file_item_decrypt_value_full (self->encrypted,
+								    self->context,
+								    self->minor_version,
+								    &self->error);
+		release_encrypted (self);
+	}
+
+	if (self->error != NULL) {
+		if (error)
+			*error = g_error_copy (self->error);
+		ret = FALSE;
+	}
+
+	g_mutex_unlock (&self->mutex);
+
+	return ret;
 }
 
 static void
@@ -87,6 +179,16 @@ secret_file_item_get_property (GObject *object,
 {
 	SecretFileItem *self = SECRET_FILE_ITEM (object);
 
+	/* The ID is known without decrypting anything */
+	if (prop_id == PROP_ID) {
+		g_value_set_string (value, self->id);
+		return;
+	}
+
+	/* A failure leaves the properties unset, and is reported once
+	 * the secret is retrieved */
+	ensure_metadata (self, NULL);
+
 	switch (prop_id) {
 	case PROP_ATTRIBUTES:
 		g_value_set_boxed (value, self->attributes);
@@ -111,9 +213,15 @@ secret_file_item_finalize (GObject *object)
 {
 	SecretFileItem *self = SECRET_FILE_ITEM (object);
 
-	g_hash_table_unref (self->attributes);
+	g_clear_pointer (&self->attributes, g_hash_table_unref);
 	g_free (self->label);
-	secret_value_unref (self->value);
+	g_clear_pointer (&self->value, secret_value_unref);
+	g_free (self->id);
+	g_clear_pointer (&self->encrypted, g_variant_unref);
+	g_clear_object (&self->collection);
+	g_clear_pointer (&self->context, egg_keyring1_context_unref);
+	g_clear_error (&self->error);
+	g_mutex_clear (&self->mutex);
 	G_OBJECT_CLASS (secret_file_item_parent_class)->finalize (object);
 }
 
@@ -132,6 +240,9 @@ secret_file_item_class_init (SecretFileItemClass *klass)
 	g_object_class_install_property (gobject_class, PROP_VALUE,
 		   g_param_spec_boxed ("value", "Value", "Value",
 				       SECRET_TYPE_VALUE, G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+	g_object_class_install_property (gobject_class, PROP_ID,
+		   g_param_spec_string ("id", "ID", "Stable identifier of the item",
+					NULL, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -142,10 +253,14 @@ secret_file_item_retrieve_secret (SecretRetrievable *retrievable,
 {
 	SecretFileItem *self = SECRET_FILE_ITEM (retrievable);
 	GTask *task = g_task_new (retrievable, cancellable, callback, user_data);
+	SecretValue *value;
+	GError *error = NULL;
 
-	g_task_return_pointer (task,
-			       secret_value_ref (self->value),
-			       secret_value_unref);
+	value = secret_file_item_retrieve_value (self, &error);
+	if (value != NULL)
+		g_task_return_pointer (task, value, secret_value_unref);
+	else
+		g_task_return_error (task, error);
 	g_object_unref (task);
 }
 
@@ -184,6 +299,28 @@ variant_to_attributes (GVariant *variant)
 	return attributes;
 }
 
+/* Creates an item which is only decrypted once its secret or one of
+ * its properties is asked for, each separately where the format allows.
+ * The record is decrypted with the given key and format even if those
+ * of the collection change in the meantime */
+SecretFileItem *
+_secret_file_item_new_deferred (GVariant *encrypted,
+				SecretFileCollection *collection,
+				EggKeyring1Context *context,
+				guint8 minor_version)
+{
+	SecretFileItem *self;
+
+	self = g_object_new (SECRET_TYPE_FILE_ITEM, NULL);
+	self->encrypted = g_variant_ref (encrypted);
+	self->collection = g_object_ref (collection);
+	self->context = egg_keyring1_context_ref (context);
+	self->minor_version = minor_version;
+	self->id = _secret_file_item_get_encrypted_id (encrypted, collection);
+
+	return self;
+}
+
 SecretFileItem *
 secret_file_item_deserialize (GVariant *serialized)
 {
@@ -221,6 +358,35 @@ secret_file_item_deserialize (GVariant *serialized)
 	return result;
 }
 
+SecretFileItem *
+secret_file_item_deserialize_metadata (GVariant *serialized,
+				       SecretValue *value)
+{
+	GVariant *attributes_variant;
+	GHashTable *attributes;
+	const gchar *label;
+	guint64 created;
+	guint64 modified;
+	SecretFileItem *result;
+
+	g_variant_get (serialized, "(@a{ss}&stt)",
+		       &attributes_variant, &label, &created, &modified);
+
+	attributes = variant_to_attributes (attributes_variant);
+	g_variant_unref (attributes_variant);
+
+	result = g_object_new (SECRET_TYPE_FILE_ITEM,
+			       "attributes", attributes,
+			       "label", label,
+			       "created", created,
+			       "modified", modified,
+			       "value", value,
+			       NULL);
+	g_hash_table_unref (attributes);
+
+	return result;
+}
+
 GVariant *
 secret_file_item_serialize (SecretFileItem *self)
 {
@@ -250,3 +416,122 @@ secret_file_item_serialize (SecretFileItem *self)
 	g_variant_get_data (variant); /* force serialize */
 	return g_variant_ref_sink (variant);
 }
+
+GVariant *
+secret_file_item_serialize_metadata (SecretFileItem *self)
+{
+	GVariantBuilder builder;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	GVariant *variant;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+	g_hash_table_iter_init (&iter, self->attributes);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_variant_builder_add (&builder, "{ss}", key, value);
+
+	variant = g_variant_new ("(@a{ss}stt)",
+				 g_variant_builder_end (&builder),
+				 self->label,
+				 self->created,
+				 self->modified);
+	g_variant_get_data (variant); /* force serialize */
+	return g_variant_ref_sink (variant);
+}
+
+SecretValue *
+secret_file_item_get_value (SecretFileItem *self)
+{
+	return self->value;
+}
+
+/* Decrypts the secret first if needed. Decrypting any part of the
+ * record may have failed, which is reported here */
+SecretValue *
+secret_file_item_retrieve_value (SecretFileItem *self,
+				 GError **error)
+{
+	if (!ensure_value (self, error))
+		return NULL;
+
+	return secret_value_ref (self->value);
+}
+
+const gchar *
+secret_file_item_get_id (SecretFileItem *self)
+{
+	return self->id;
+}
+
+void
+secret_file_item_set_id (SecretFileItem *self,
+			 const gchar *id)
+{
+	g_free (self->id);
+	self->id = g_strdup (id);
+}
+
+/* The item is changed through the collection it was found in, and
+ * found there by its ID, whichever attributes it has. The changes are
+ * written along with the others of the collection */
+gboolean
+secret_file_item_set_label (SecretFileItem *self,
+			    const gchar *label,
+			    GError **error)
+{
+	g_return_val_if_fail (self->collection != NULL, FALSE);
+	g_return_val_if_fail (label != NULL, FALSE);
+
+	/* Decrypted first, so that what is set isn't replaced afterwards */
+	if (!ensure_metadata (self, error))
+		return FALSE;
+
+	if (!secret_file_collection_set_label (self->collection, self->id,
+					       label, error))
+		return FALSE;
+
+	g_mutex_lock (&self->mutex);
+	g_free (self->label);
+	self->label = g_strdup (label);
+	self->modified = g_get_real_time () / G_USEC_PER_SEC;
+	g_mutex_unlock (&self->mutex);
+
+	return TRUE;
+}
+
+gboolean
+secret_file_item_update (SecretFileItem *self,
+			 SecretValue *value,
+			 GError **error)
+{
+	g_return_val_if_fail (self->collection != NULL, FALSE);
+	g_return_val_if_fail (value != NULL, FALSE);
+
+	if (!ensure_metadata (self, error))
+		return FALSE;
+
+	if (!secret_file_collection_update (self->collection, self->id,
+					    value, error))
+		return FALSE;
+
+	/* The secret of the record is no longer decrypted */
+	g_mutex_lock (&self->mutex);
+	g_clear_pointer (&self->value, secret_value_unref);
+	self->value = secret_value_ref (value);
+	self->modified = g_get_real_time () / G_USEC_PER_SEC;
+	release_encrypted (self);
+	g_mutex_unlock (&self->mutex);
+
+	return TRUE;
+}
+
+gboolean
+secret_file_item_delete (SecretFileItem *self,
+			 GError **error)
+{
+	g_return_val_if_fail (self->collection != NULL, FALSE);
+
+	return secret_file_collection_delete (self->collection, self->id,
+					      error);
+}
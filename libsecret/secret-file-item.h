@@ -21,6 +21,8 @@
 
 #include <glib-object.h>
 
+#include "secret-value.h"
+
 G_BEGIN_DECLS
 
 #define SECRET_TYPE_FILE_ITEM (secret_file_item_get_type ())
@@ -29,6 +31,29 @@ G_DECLARE_FINAL_TYPE (SecretFileItem, secret_file_item, SECRET, FILE_ITEM, GObje
 SecretFileItem *secret_file_item_deserialize (GVariant *serialized);
 GVariant *secret_file_item_serialize (SecretFileItem *self);
 
+/* The metadata is everything but the secret, which is kept apart */
+SecretFileItem *secret_file_item_deserialize_metadata (GVariant *serialized,
+                                                       SecretValue *value);
+GVariant *secret_file_item_serialize_metadata (SecretFileItem *self);
+SecretValue *secret_file_item_get_value (SecretFileItem *self);
+SecretValue *secret_file_item_retrieve_value (SecretFileItem *self,
+                                              GError **error);
+
+/* Stays the same across updates of the item */
+const gchar *secret_file_item_get_id (SecretFileItem *self);
+void secret_file_item_set_id (SecretFileItem *self,
+                              const gchar *id);
+
+/* Only for items found through secret_file_collection_search_items() */
+gboolean secret_file_item_set_label (SecretFileItem *self,
+                                     const gchar *label,
+                                     GError **error);
+gboolean secret_file_item_update (SecretFileItem *self,
+                                  SecretValue *value,
+                                  GError **error);
+gboolean secret_file_item_delete (SecretFileItem *self,
+                                  GError **error);
+
 G_END_DECLS
 
 #endif /* __SECRET_FILE_ITEM_H__ */
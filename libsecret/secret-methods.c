@@ -1809,6 +1809,197 @@ secret_service_clear_sync (SecretService *service,
 	return result;
 }
 
+/* Limits how many SearchItems and Delete calls are waiting on the
+ * service at once */
+#define CLEAR_MANY_IN_FLIGHT 8
+
+typedef struct {
+	GPtrArray *searches;
+	/* set of item paths, to delete each only once */
+	GHashTable *paths;
+	GQueue queue;
+	guint searched;
+	guint searching;
+	guint deleting;
+	gboolean deleted;
+	GError *error;
+} ClearManyClosure;
+
+static void
+clear_many_closure_free (gpointer data)
+{
+	ClearManyClosure *closure = data;
+	g_ptr_array_unref (closure->searches);
+	g_hash_table_unref (closure->paths);
+	g_queue_clear (&closure->queue);
+	g_clear_error (&closure->error);
+	g_free (closure);
+}
+
+static void clear_many_next (SecretService *service,
+                             GTask *task);
+
+static void on_clear_many_searched (GObject *source,
+                                    GAsyncResult *result,
+                                    gpointer user_data);
+
+static void
+on_clear_many_deleted (GObject *source,
+                       GAsyncResult *result,
+                       gpointer user_data)
+{
+	SecretService *service = SECRET_SERVICE (source);
+	GTask *task = G_TASK (user_data);
+	ClearManyClosure *closure = g_task_get_task_data (task);
+	GError *error = NULL;
+
+	closure->deleting--;
+
+	if (_secret_service_delete_path_finish (service, result, &error))
+		closure->deleted = TRUE;
+	else if (closure->error == NULL)
+		closure->error = g_steal_pointer (&error);
+	g_clear_error (&error);
+
+	clear_many_next (service, task);
+	g_object_unref (task);
+}
+
+static void
+clear_many_next (SecretService *service,
+                 GTask *task)
+{
+	ClearManyClosure *closure = g_task_get_task_data (task);
+	const gchar *path;
+
+	/* The searches go first, and the items found are deleted as
+	 * calls complete. Don't start on anything else once one has
+	 * failed */
+	while (closure->error == NULL &&
+	       closure->searching + closure->deleting < CLEAR_MANY_IN_FLIGHT) {
+		if (closure->searched < closure->searches->len) {
+			_secret_service_search_for_paths_variant (service,
+			                                          g_ptr_array_index (closure->searches, closure->searched),
+			                                          g_task_get_cancellable (task),
+			                                          on_clear_many_searched,
+			                                          g_object_ref (task));
+			closure->searched++;
+			closure->searching++;
+		} else if ((path = g_queue_pop_head (&closure->queue)) != NULL) {
+			_secret_service_delete_path (service, path, TRUE,
+			                             g_task_get_cancellable (task),
+			                             on_clear_many_deleted,
+			                             g_object_ref (task));
+			closure->deleting++;
+		} else {
+			break;
+		}
+	}
+
+	if (closure->searching > 0 || closure->deleting > 0)
+		return;
+
+	if (closure->error != NULL)
+		g_task_return_error (task, g_steal_pointer (&closure->error));
+	else
+		g_task_return_boolean (task, closure->deleted);
+}
+
+static void
+on_clear_many_searched (GObject *source,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+	SecretService *service = SECRET_SERVICE (source);
+	GTask *task = G_TASK (user_data);
+	ClearManyClosure *closure = g_task_get_task_data (task);
+	GError *error = NULL;
+	gchar **unlocked = NULL;
+	gint i;
+
+	closure->searching--;
+
+	secret_service_search_for_dbus_paths_finish (service, result, &unlocked, NULL, &error);
+	if (error == NULL) {
+		for (i = 0; unlocked[i] != NULL; i++) {
+			if (g_hash_table_contains (closure->paths, unlocked[i]))
+				continue;
+			g_hash_table_add (closure->paths, g_strdup (unlocked[i]));
+			g_queue_push_tail (&closure->queue,
+			                   g_hash_table_lookup (closure->paths, unlocked[i]));
+		}
+	} else if (closure->error == NULL) {
+		closure->error = g_steal_pointer (&error);
+	}
+	g_clear_error (&error);
+	g_strfreev (unlocked);
+
+	clear_many_next (service, task);
+	g_object_unref (task);
+}
+
+void
+_secret_service_clear_many (SecretService *service,
+                            const SecretSchema *schema,
+                            GList *attributes,
+                            GCancellable *cancellable,
+                            GAsyncReadyCallback callback,
+                            gpointer user_data)
+{
+	const gchar *schema_name = NULL;
+	ClearManyClosure *closure;
+	GTask *task;
+	GList *l;
+
+	g_return_if_fail (SECRET_IS_SERVICE (service));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	if (schema != NULL && !(schema->flags & SECRET_SCHEMA_DONT_MATCH_NAME))
+		schema_name = schema->name;
+
+	task = g_task_new (service, cancellable, callback, user_data);
+	g_task_set_source_tag (task, _secret_service_clear_many);
+	closure = g_new0 (ClearManyClosure, 1);
+	closure->searches = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+	closure->paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	g_queue_init (&closure->queue);
+	g_task_set_task_data (task, closure, clear_many_closure_free);
+
+	for (l = attributes; l != NULL; l = g_list_next (l)) {
+		GVariant *variant = _secret_attributes_to_variant (l->data, schema_name);
+
+		/* A double check to make sure we don't delete everything */
+		g_variant_ref_sink (variant);
+		g_assert (g_variant_n_children (variant) > 0);
+		g_ptr_array_add (closure->searches, variant);
+	}
+
+	if (closure->searches->len == 0) {
+		g_task_return_boolean (task, FALSE);
+		g_object_unref (task);
+		return;
+	}
+
+	clear_many_next (service, task);
+	g_object_unref (task);
+}
+
+gboolean
+_secret_service_clear_many_finish (SecretService *service,
+                                   GAsyncResult *result,
+                                   GError **error)
+{
+	g_return_val_if_fail (SECRET_IS_SERVICE (service), FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, service), FALSE);
+
+	if (!g_task_propagate_boolean (G_TASK (result), error)) {
+		_secret_util_strip_remote_error (error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 typedef struct {
 	gchar *alias;
 	gchar *collection_path;
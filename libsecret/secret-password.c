@@ -126,6 +126,25 @@ on_store (GObject *source,
 	g_object_unref (task);
 }
 
+/* Completes the task with an error when the backend lacks a method the
+ * operation needs, rather than leaving it to never complete */
+static gboolean
+backend_implements (GTask *task,
+                    SecretBackend *backend,
+                    gboolean implemented,
+                    const gchar *method)
+{
+	if (implemented)
+		return TRUE;
+
+	g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+	                         "%s doesn't implement %s",
+	                         G_OBJECT_TYPE_NAME (backend), method);
+	g_object_unref (task);
+	g_object_unref (backend);
+	return FALSE;
+}
+
 static void
 on_store_backend (GObject *source,
                   GAsyncResult *result,
@@ -145,7 +164,8 @@ on_store_backend (GObject *source,
 	}
 
 	iface = SECRET_BACKEND_GET_IFACE (backend);
-	g_return_if_fail (iface->store != NULL);
+	if (!backend_implements (task, backend, iface->store != NULL, "store"))
+		return;
 
 	iface->store (backend, store->schema, store->attributes,
 		      store->collection, store->label, store->value,
@@ -591,6 +611,449 @@ secret_password_storev_binary_sync (const SecretSchema *schema,
 	return ret;
 }
 
+/**
+ * SecretPasswordEntry:
+ *
+ * A password to store along with others using [func@password_store_many].
+ *
+ * Since: 0.22.0
+ */
+
+G_DEFINE_BOXED_TYPE (SecretPasswordEntry, secret_password_entry,
+                     secret_password_entry_ref, secret_password_entry_unref);
+
+/**
+ * secret_password_entry_new_binary:
+ * @schema: (nullable): the schema for attributes
+ * @attributes: (element-type utf8 utf8): the attribute keys and values
+ * @collection: (nullable): a collection alias, or D-Bus object path of the
+ *   collection where to store the secret
+ * @label: label for the secret
+ * @value: a [struct@Value]
+ *
+ * Create an entry to store with [func@password_store_many].
+ *
+ * Returns: (transfer full) (nullable): the new entry, or %NULL if the
+ *   attributes don't match the schema
+ *
+ * Since: 0.22.0
+ */
+SecretPasswordEntry *
+secret_password_entry_new_binary (const SecretSchema *schema,
+                                  GHashTable *attributes,
+                                  const gchar *collection,
+                                  const gchar *label,
+                                  SecretValue *value)
+{
+	SecretPasswordEntry *entry;
+
+	g_return_val_if_fail (attributes != NULL, NULL);
+	g_return_val_if_fail (label != NULL, NULL);
+	g_return_val_if_fail (value != NULL, NULL);
+
+	/* Warnings raised already */
+	if (schema != NULL && !_secret_attributes_validate (schema, attributes, G_STRFUNC, FALSE))
+		return NULL;
+
+	entry = g_new0 (SecretPasswordEntry, 1);
+	entry->refs = 1;
+	entry->schema = _secret_schema_ref_if_nonstatic (schema);
+	entry->attributes = g_hash_table_ref (attributes);
+	entry->collection = g_strdup (collection);
+	entry->label = g_strdup (label);
+	entry->value = secret_value_ref (value);
+
+	return entry;
+}
+
+/**
+ * secret_password_entry_new:
+ * @schema: (nullable): the schema for attributes
+ * @attributes: (element-type utf8 utf8): the attribute keys and values
+ * @collection: (nullable): a collection alias, or D-Bus object path of the
+ *   collection where to store the secret
+ * @label: label for the secret
+ * @password: the null-terminated password to store
+ *
+ * Create an entry to store with [func@password_store_many].
+ *
+ * Returns: (transfer full) (nullable): the new entry, or %NULL if the
+ *   attributes don't match the schema
+ *
+ * Since: 0.22.0
+ */
+SecretPasswordEntry *
+secret_password_entry_new (const SecretSchema *schema,
+                           GHashTable *attributes,
+                           const gchar *collection,
+                           const gchar *label,
+                           const gchar *password)
+{
+	SecretPasswordEntry *entry;
+	SecretValue *value;
+
+	g_return_val_if_fail (password != NULL, NULL);
+
+	value = secret_value_new (password, -1, "text/plain");
+	entry = secret_password_entry_new_binary (schema, attributes, collection,
+	                                          label, value);
+	secret_value_unref (value);
+
+	return entry;
+}
+
+/**
+ * secret_password_entry_ref:
+ * @entry: the entry
+ *
+ * Add a reference to the entry.
+ *
+ * Returns: (transfer full): the entry
+ *
+ * Since: 0.22.0
+ */
+SecretPasswordEntry *
+secret_password_entry_ref (SecretPasswordEntry *entry)
+{
+	g_return_val_if_fail (entry != NULL, NULL);
+	g_atomic_int_inc (&entry->refs);
+	return entry;
+}
+
+/**
+ * secret_password_entry_unref:
+ * @entry: (transfer full): the entry
+ *
+ * Release a reference to the entry, freeing it once the last reference
+ * is gone.
+ *
+ * Since: 0.22.0
+ */
+void
+secret_password_entry_unref (SecretPasswordEntry *entry)
+{
+	g_return_if_fail (entry != NULL);
+
+	if (!g_atomic_int_dec_and_test (&entry->refs))
+		return;
+
+	_secret_schema_unref_if_nonstatic (entry->schema);
+	g_hash_table_unref (entry->attributes);
+	g_free (entry->collection);
+	g_free (entry->label);
+	secret_value_unref (entry->value);
+	g_free (entry);
+}
+
+static void
+free_error_if_set (gpointer data)
+{
+	if (data != NULL)
+		g_error_free (data);
+}
+
+/* Limits how many entries are stored at once by a backend which
+ * can't store them all together, like CLEAR_MANY_IN_FLIGHT */
+#define STORE_MANY_IN_FLIGHT 8
+
+typedef struct {
+	GList *entries;
+	/* a GError for each entry, or NULL once it's stored */
+	GPtrArray *errors;
+	guint pending;
+	/* the backend, and the entries not yet sent to it */
+	SecretBackend *backend;
+	GList *next;
+	guint index;
+	guint storing;
+} StoreManyClosure;
+
+static void
+store_many_closure_free (gpointer data)
+{
+	StoreManyClosure *closure = data;
+	g_list_free_full (closure->entries, (GDestroyNotify) secret_password_entry_unref);
+	g_clear_pointer (&closure->errors, g_ptr_array_unref);
+	g_clear_object (&closure->backend);
+	g_free (closure);
+}
+
+static void
+on_store_many (GObject *source,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	StoreManyClosure *closure = g_task_get_task_data (task);
+	SecretBackend *backend = SECRET_BACKEND (source);
+	SecretBatchBackendInterface *iface;
+	GError *error = NULL;
+
+	iface = SECRET_BATCH_BACKEND_GET_IFACE (backend);
+	closure->errors = iface->store_many_finish (backend, result, &error);
+	if (closure->errors == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	g_task_return_boolean (task, TRUE);
+	g_object_unref (task);
+}
+
+typedef struct {
+	GTask *task;
+	guint index;
+} StoreOneClosure;
+
+static void on_store_many_one (GObject *source,
+                               GAsyncResult *result,
+                               gpointer user_data);
+
+static void
+store_many_next (GTask *task)
+{
+	StoreManyClosure *closure = g_task_get_task_data (task);
+	SecretBackendInterface *iface;
+
+	iface = SECRET_BACKEND_GET_IFACE (closure->backend);
+	while (closure->storing < STORE_MANY_IN_FLIGHT && closure->next != NULL) {
+		SecretPasswordEntry *entry = closure->next->data;
+		StoreOneClosure *one = g_new0 (StoreOneClosure, 1);
+
+		one->task = task;
+		one->index = closure->index++;
+		closure->next = g_list_next (closure->next);
+		closure->storing++;
+		iface->store (closure->backend, entry->schema, entry->attributes,
+		              entry->collection, entry->label, entry->value,
+		              g_task_get_cancellable (task),
+		              on_store_many_one, one);
+	}
+}
+
+static void
+on_store_many_one (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+	StoreOneClosure *one = user_data;
+	GTask *task = one->task;
+	StoreManyClosure *closure = g_task_get_task_data (task);
+	SecretBackend *backend = SECRET_BACKEND (source);
+	SecretBackendInterface *iface;
+	GError *error = NULL;
+
+	iface = SECRET_BACKEND_GET_IFACE (backend);
+	if (!iface->store_finish (backend, result, &error))
+		closure->errors->pdata[one->index] = error;
+	g_free (one);
+
+	closure->storing--;
+	if (--closure->pending == 0) {
+		g_task_return_boolean (task, TRUE);
+		g_object_unref (task);
+		return;
+	}
+
+	store_many_next (task);
+}
+
+static void
+on_store_many_backend (GObject *source,
+                       GAsyncResult *result,
+                       gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	StoreManyClosure *closure = g_task_get_task_data (task);
+	SecretBackend *backend;
+	SecretBackendInterface *iface;
+	SecretBatchBackendInterface *batch;
+	GError *error = NULL;
+
+	backend = secret_backend_get_finish (result, &error);
+	if (backend == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	if (SECRET_IS_BATCH_BACKEND (backend)) {
+		batch = SECRET_BATCH_BACKEND_GET_IFACE (backend);
+		if (batch->store_many != NULL) {
+			batch->store_many (backend, closure->entries,
+			                   g_task_get_cancellable (task),
+			                   on_store_many, task);
+			g_object_unref (backend);
+			return;
+		}
+	}
+
+	/* The requests are sent a few at a time, without waiting for each
+	 * other, and share the session opened along with the backend */
+	iface = SECRET_BACKEND_GET_IFACE (backend);
+	if (!backend_implements (task, backend, iface->store != NULL, "store"))
+		return;
+
+	closure->errors = g_ptr_array_new_full (closure->pending, free_error_if_set);
+	g_ptr_array_set_size (closure->errors, closure->pending);
+
+	closure->backend = backend;
+	closure->next = closure->entries;
+	store_many_next (task);
+}
+
+/**
+ * secret_password_store_many:
+ * @entries: (element-type SecretPasswordEntry): the passwords to store
+ * @cancellable: (nullable): optional cancellation object
+ * @callback: (scope async): called when the operation completes
+ * @user_data: data to be passed to the callback
+ *
+ * Store a number of passwords in the secret service at once.
+ *
+ * This is like calling [func@password_store_binary] for each of the
+ * @entries, but depending on the backend they are all written at once
+ * or sent without waiting for each other.
+ *
+ * This method will return immediately and complete asynchronously.
+ *
+ * Since: 0.22.0
+ */
+void
+secret_password_store_many (GList *entries,
+                            GCancellable *cancellable,
+                            GAsyncReadyCallback callback,
+                            gpointer user_data)
+{
+	StoreManyClosure *closure;
+	GTask *task;
+	GList *l;
+
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, secret_password_store_many);
+	closure = g_new0 (StoreManyClosure, 1);
+	for (l = entries; l != NULL; l = g_list_next (l)) {
+		closure->entries = g_list_prepend (closure->entries,
+		                                   secret_password_entry_ref (l->data));
+		closure->pending++;
+	}
+	closure->entries = g_list_reverse (closure->entries);
+	g_task_set_task_data (task, closure, store_many_closure_free);
+
+	if (closure->entries == NULL) {
+		closure->errors = g_ptr_array_new_with_free_func (free_error_if_set);
+		g_task_return_boolean (task, TRUE);
+		g_object_unref (task);
+		return;
+	}
+
+	secret_backend_get (SECRET_BACKEND_OPEN_SESSION,
+			    cancellable,
+			    on_store_many_backend, task);
+}
+
+/**
+ * secret_password_store_many_finish:
+ * @result: the asynchronous result passed to the callback
+ * @errors: (out) (optional) (nullable) (transfer full) (element-type GError):
+ *   location to place an array with an error, or %NULL if it was
+ *   stored, for each of the entries
+ * @error: location to place an error on failure
+ *
+ * Finish asynchronous operation to store a number of passwords in the
+ * secret service.
+ *
+ * If only some of the entries could not be stored, @error is set to the
+ * first of their errors, and @errors tells which ones. If nothing could
+ * be attempted, @errors is set to %NULL.
+ *
+ * Returns: whether all of the entries were stored
+ *
+ * Since: 0.22.0
+ */
+gboolean
+secret_password_store_many_finish (GAsyncResult *result,
+                                   GPtrArray **errors,
+                                   GError **error)
+{
+	StoreManyClosure *closure;
+	guint i;
+
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+	if (errors)
+		*errors = NULL;
+
+	if (!g_task_propagate_boolean (G_TASK (result), error))
+		return FALSE;
+
+	closure = g_task_get_task_data (G_TASK (result));
+	if (errors)
+		*errors = g_ptr_array_ref (closure->errors);
+
+	for (i = 0; i < closure->errors->len; i++) {
+		GError *failure = g_ptr_array_index (closure->errors, i);
+		if (failure != NULL) {
+			g_propagate_error (error, g_error_copy (failure));
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * secret_password_store_many_sync:
+ * @entries: (element-type SecretPasswordEntry): the passwords to store
+ * @cancellable: (nullable): optional cancellation object
+ * @errors: (out) (optional) (nullable) (transfer full) (element-type GError):
+ *   location to place an array with an error, or %NULL if it was
+ *   stored, for each of the entries
+ * @error: location to place an error on failure
+ *
+ * Store a number of passwords in the secret service at once.
+ *
+ * This is the synchronous version of [func@password_store_many].
+ *
+ * This method may block indefinitely and should not be used in user interface
+ * threads.
+ *
+ * Returns: whether all of the entries were stored
+ *
+ * Since: 0.22.0
+ */
+gboolean
+secret_password_store_many_sync (GList *entries,
+                                 GCancellable *cancellable,
+                                 GPtrArray **errors,
+                                 GError **error)
+{
+	SecretSync *sync;
+	gboolean ret;
+
+	g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	sync = _secret_sync_new ();
+	g_main_context_push_thread_default (sync->context);
+
+	secret_password_store_many (entries, cancellable,
+	                            _secret_sync_on_result, sync);
+
+	g_main_loop_run (sync->loop);
+
+	ret = secret_password_store_many_finish (sync->result, errors, error);
+
+	g_main_context_pop_thread_default (sync->context);
+	_secret_sync_free (sync);
+
+	return ret;
+}
+
 /**
  * secret_password_lookup: (skip)
  * @schema: the schema for the attributes
@@ -698,7 +1161,8 @@ on_lookup_backend (GObject *source,
 	}
 
 	iface = SECRET_BACKEND_GET_IFACE (backend);
-	g_return_if_fail (iface->store != NULL);
+	if (!backend_implements (task, backend, iface->lookup != NULL, "lookup"))
+		return;
 
 	iface->lookup (backend, lookup->schema, lookup->attributes,
 		       g_task_get_cancellable (task),
@@ -1240,7 +1704,8 @@ on_clear_backend (GObject *source,
 	}
 
 	iface = SECRET_BACKEND_GET_IFACE (backend);
-	g_return_if_fail (iface->clear != NULL);
+	if (!backend_implements (task, backend, iface->clear != NULL, "clear"))
+		return;
 
 	iface->clear (backend, clear->schema, clear->attributes,
 		      g_task_get_cancellable (task),
@@ -1414,6 +1879,289 @@ secret_password_clearv_sync (const SecretSchema *schema,
 	return result;
 }
 
+/* Limits how many sets of attributes are cleared at once by a backend
+ * which can't clear them all together, like STORE_MANY_IN_FLIGHT */
+#define CLEAR_MANY_IN_FLIGHT 8
+
+typedef struct {
+	const SecretSchema *schema;
+	GList *attributes;
+	guint pending;
+	gboolean cleared;
+	GError *error;
+	/* the backend, and the attributes not yet sent to it */
+	SecretBackend *backend;
+	GList *next;
+	guint clearing;
+} ClearManyClosure;
+
+static void
+clear_many_closure_free (gpointer data)
+{
+	ClearManyClosure *closure = data;
+	_secret_schema_unref_if_nonstatic (closure->schema);
+	g_list_free_full (closure->attributes, (GDestroyNotify) g_hash_table_unref);
+	g_clear_error (&closure->error);
+	g_clear_object (&closure->backend);
+	g_free (closure);
+}
+
+static void
+on_clear_many (GObject *source,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	SecretBackend *backend = SECRET_BACKEND (source);
+	SecretBatchBackendInterface *iface;
+	GError *error = NULL;
+	gboolean cleared;
+
+	iface = SECRET_BATCH_BACKEND_GET_IFACE (backend);
+	cleared = iface->clear_many_finish (backend, result, &error);
+	if (error != NULL)
+		g_task_return_error (task, error);
+	else
+		g_task_return_boolean (task, cleared);
+	g_object_unref (task);
+}
+
+static void on_clear_many_one (GObject *source,
+                               GAsyncResult *result,
+                               gpointer user_data);
+
+static void
+clear_many_next (GTask *task)
+{
+	ClearManyClosure *closure = g_task_get_task_data (task);
+	SecretBackendInterface *iface;
+
+	iface = SECRET_BACKEND_GET_IFACE (closure->backend);
+	while (closure->clearing < CLEAR_MANY_IN_FLIGHT && closure->next != NULL) {
+		GHashTable *attributes = closure->next->data;
+
+		closure->next = g_list_next (closure->next);
+		closure->clearing++;
+		iface->clear (closure->backend, closure->schema, attributes,
+		              g_task_get_cancellable (task),
+		              on_clear_many_one, task);
+	}
+}
+
+static void
+on_clear_many_one (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ClearManyClosure *closure = g_task_get_task_data (task);
+	SecretBackend *backend = SECRET_BACKEND (source);
+	SecretBackendInterface *iface;
+	GError *error = NULL;
+
+	iface = SECRET_BACKEND_GET_IFACE (backend);
+	if (iface->clear_finish (backend, result, &error))
+		closure->cleared = TRUE;
+	else if (error != NULL && closure->error == NULL)
+		closure->error = g_steal_pointer (&error);
+	g_clear_error (&error);
+
+	closure->clearing--;
+	if (--closure->pending == 0) {
+		if (closure->error != NULL)
+			g_task_return_error (task, g_steal_pointer (&closure->error));
+		else
+			g_task_return_boolean (task, closure->cleared);
+		g_object_unref (task);
+		return;
+	}
+
+	clear_many_next (task);
+}
+
+static void
+on_clear_many_backend (GObject *source,
+                       GAsyncResult *result,
+                       gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ClearManyClosure *closure = g_task_get_task_data (task);
+	SecretBackend *backend;
+	SecretBackendInterface *iface;
+	SecretBatchBackendInterface *batch;
+	GError *error = NULL;
+
+	backend = secret_backend_get_finish (result, &error);
+	if (backend == NULL) {
+		g_task_return_error (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	if (SECRET_IS_BATCH_BACKEND (backend)) {
+		batch = SECRET_BATCH_BACKEND_GET_IFACE (backend);
+		if (batch->clear_many != NULL) {
+			batch->clear_many (backend, closure->schema, closure->attributes,
+			                   g_task_get_cancellable (task),
+			                   on_clear_many, task);
+			g_object_unref (backend);
+			return;
+		}
+	}
+
+	iface = SECRET_BACKEND_GET_IFACE (backend);
+	if (!backend_implements (task, backend, iface->clear != NULL, "clear"))
+		return;
+
+	/* The requests are sent a few at a time, as for storing */
+	closure->backend = backend;
+	closure->next = closure->attributes;
+	clear_many_next (task);
+}
+
+/**
+ * secret_password_clear_many:
+ * @schema: (nullable): the schema for the attributes
+ * @attributes: (element-type GHashTable(utf8,utf8)): a list of sets of
+ *   attribute keys and values
+ * @cancellable: (nullable): optional cancellation object
+ * @callback: (scope async): called when the operation completes
+ * @user_data: data to be passed to the callback
+ *
+ * Remove unlocked passwords matching any of a number of sets of
+ * attributes from the secret service.
+ *
+ * This is like calling [func@password_clearv] for each of the sets of
+ * @attributes, but the matching items are looked up all at once and each
+ * is removed only once. None of the sets may be empty.
+ *
+ * This method will return immediately and complete asynchronously.
+ *
+ * Since: 0.22.0
+ */
+void
+secret_password_clear_many (const SecretSchema *schema,
+                            GList *attributes,
+                            GCancellable *cancellable,
+                            GAsyncReadyCallback callback,
+                            gpointer user_data)
+{
+	ClearManyClosure *closure;
+	GTask *task;
+	GList *l;
+
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	/* Warnings raised already */
+	for (l = attributes; l != NULL; l = g_list_next (l)) {
+		g_return_if_fail (l->data != NULL);
+		g_return_if_fail (g_hash_table_size (l->data) > 0);
+		if (schema != NULL && !_secret_attributes_validate (schema, l->data, G_STRFUNC, TRUE))
+			return;
+	}
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, secret_password_clear_many);
+	closure = g_new0 (ClearManyClosure, 1);
+	closure->schema = _secret_schema_ref_if_nonstatic (schema);
+	for (l = attributes; l != NULL; l = g_list_next (l)) {
+		closure->attributes = g_list_prepend (closure->attributes,
+		                                      g_hash_table_ref (l->data));
+		closure->pending++;
+	}
+	closure->attributes = g_list_reverse (closure->attributes);
+	g_task_set_task_data (task, closure, clear_many_closure_free);
+
+	if (closure->attributes == NULL) {
+		g_task_return_boolean (task, FALSE);
+		g_object_unref (task);
+		return;
+	}
+
+	secret_backend_get (SECRET_SERVICE_NONE,
+			    cancellable,
+			    on_clear_many_backend, task);
+}
+
+/**
+ * secret_password_clear_many_finish:
+ * @result: the asynchronous result passed to the callback
+ * @error: location to place an error on failure
+ *
+ * Finish an asynchronous operation to remove passwords matching a number
+ * of sets of attributes from the secret service.
+ *
+ * Returns: whether any passwords were removed
+ *
+ * Since: 0.22.0
+ */
+gboolean
+secret_password_clear_many_finish (GAsyncResult *result,
+                                   GError **error)
+{
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * secret_password_clear_many_sync:
+ * @schema: (nullable): the schema for the attributes
+ * @attributes: (element-type GHashTable(utf8,utf8)): a list of sets of
+ *   attribute keys and values
+ * @cancellable: (nullable): optional cancellation object
+ * @error: location to place an error on failure
+ *
+ * Remove unlocked passwords matching any of a number of sets of
+ * attributes from the secret service.
+ *
+ * This is the synchronous version of [func@password_clear_many].
+ *
+ * This method may block indefinitely and should not be used in user interface
+ * threads.
+ *
+ * Returns: whether any passwords were removed
+ *
+ * Since: 0.22.0
+ */
+gboolean
+secret_password_clear_many_sync (const SecretSchema *schema,
+                                 GList *attributes,
+                                 GCancellable *cancellable,
+                                 GError **error)
+{
+	SecretSync *sync;
+	gboolean result;
+	GList *l;
+
+	g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	/* Warnings raised already */
+	for (l = attributes; l != NULL; l = g_list_next (l)) {
+		g_return_val_if_fail (l->data != NULL, FALSE);
+		g_return_val_if_fail (g_hash_table_size (l->data) > 0, FALSE);
+		if (schema != NULL && !_secret_attributes_validate (schema, l->data, G_STRFUNC, TRUE))
+			return FALSE;
+	}
+
+	sync = _secret_sync_new ();
+	g_main_context_push_thread_default (sync->context);
+
+	secret_password_clear_many (schema, attributes, cancellable,
+	                            _secret_sync_on_result, sync);
+
+	g_main_loop_run (sync->loop);
+
+	result = secret_password_clear_many_finish (sync->result, error);
+
+	g_main_context_pop_thread_default (sync->context);
+	_secret_sync_free (sync);
+
+	return result;
+}
+
 /**
  * secret_password_search: (skip)
  * @schema: the schema for the attributes
@@ -1528,7 +2276,8 @@ on_search_backend (GObject *source,
 	}
 
 	iface = SECRET_BACKEND_GET_IFACE (backend);
-	g_return_if_fail (iface->search != NULL);
+	if (!backend_implements (task, backend, iface->search != NULL, "search"))
+		return;
 
 	iface->search (backend,
 		       search->schema, search->attributes, search->flags,
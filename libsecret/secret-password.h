@@ -98,6 +98,44 @@ gboolean     secret_password_storev_binary_sync        (const SecretSchema *sche
 							GCancellable *cancellable,
 							GError **error);
 
+typedef struct _SecretPasswordEntry SecretPasswordEntry;
+
+#define SECRET_TYPE_PASSWORD_ENTRY (secret_password_entry_get_type ())
+
+GType                secret_password_entry_get_type    (void) G_GNUC_CONST;
+
+SecretPasswordEntry *secret_password_entry_new         (const SecretSchema *schema,
+                                                        GHashTable *attributes,
+                                                        const gchar *collection,
+                                                        const gchar *label,
+                                                        const gchar *password);
+
+SecretPasswordEntry *secret_password_entry_new_binary  (const SecretSchema *schema,
+                                                        GHashTable *attributes,
+                                                        const gchar *collection,
+                                                        const gchar *label,
+                                                        SecretValue *value);
+
+SecretPasswordEntry *secret_password_entry_ref         (SecretPasswordEntry *entry);
+
+void                 secret_password_entry_unref       (SecretPasswordEntry *entry);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (SecretPasswordEntry, secret_password_entry_unref)
+
+void         secret_password_store_many                (GList *entries,
+                                                        GCancellable *cancellable,
+                                                        GAsyncReadyCallback callback,
+                                                        gpointer user_data);
+
+gboolean     secret_password_store_many_finish         (GAsyncResult *result,
+                                                        GPtrArray **errors,
+                                                        GError **error);
+
+gboolean     secret_password_store_many_sync           (GList *entries,
+                                                        GCancellable *cancellable,
+                                                        GPtrArray **errors,
+                                                        GError **error);
+
 void         secret_password_lookup                    (const SecretSchema *schema,
                                                         GCancellable *cancellable,
                                                         GAsyncReadyCallback callback,
@@ -171,6 +209,20 @@ gboolean     secret_password_clearv_sync               (const SecretSchema *sche
                                                         GCancellable *cancellable,
                                                         GError **error);
 
+void         secret_password_clear_many                (const SecretSchema *schema,
+                                                        GList *attributes,
+                                                        GCancellable *cancellable,
+                                                        GAsyncReadyCallback callback,
+                                                        gpointer user_data);
+
+gboolean     secret_password_clear_many_finish         (GAsyncResult *result,
+                                                        GError **error);
+
+gboolean     secret_password_clear_many_sync           (const SecretSchema *schema,
+                                                        GList *attributes,
+                                                        GCancellable *cancellable,
+                                                        GError **error);
+
 void         secret_password_search                    (const SecretSchema *schema,
                                                         SecretSearchFlags flags,
                                                         GCancellable *cancellable,
@@ -17,7 +17,9 @@
 
 #include <gio/gio.h>
 
+#include "secret-backend.h"
 #include "secret-item.h"
+#include "secret-password.h"
 #include "secret-service.h"
 #include "secret-value.h"
 
@@ -31,6 +33,51 @@ typedef struct {
 
 typedef struct _SecretSession SecretSession;
 
+struct _SecretPasswordEntry {
+	gint refs;
+	const SecretSchema *schema;
+	GHashTable *attributes;
+	gchar *collection;
+	gchar *label;
+	SecretValue *value;
+};
+
+/*
+ * Implemented by backends which store or clear a number of passwords
+ * at once, rather than one by one with SecretBackendInterface:
+ *
+ * @store_many: implementation of secret_password_store_many()
+ * @store_many_finish: returns an array with a #GError or %NULL for
+ *   each of the entries
+ * @clear_many: implementation of secret_password_clear_many()
+ * @clear_many_finish: implementation of secret_password_clear_many_finish()
+ */
+#define SECRET_TYPE_BATCH_BACKEND (_secret_batch_backend_get_type ())
+G_DECLARE_INTERFACE (SecretBatchBackend, _secret_batch_backend, SECRET, BATCH_BACKEND, GObject)
+
+struct _SecretBatchBackendInterface {
+	GTypeInterface parent_iface;
+
+	void         (*store_many)              (SecretBackend *self,
+	                                         GList *entries,
+	                                         GCancellable *cancellable,
+	                                         GAsyncReadyCallback callback,
+	                                         gpointer user_data);
+	GPtrArray *  (*store_many_finish)       (SecretBackend *self,
+	                                         GAsyncResult *result,
+	                                         GError **error);
+
+	void         (*clear_many)              (SecretBackend *self,
+	                                         const SecretSchema *schema,
+	                                         GList *attributes,
+	                                         GCancellable *cancellable,
+	                                         GAsyncReadyCallback callback,
+	                                         gpointer user_data);
+	gboolean     (*clear_many_finish)       (SecretBackend *self,
+	                                         GAsyncResult *result,
+	                                         GError **error);
+};
+
 #define              SECRET_ALIAS_PREFIX                      "/org/freedesktop/secrets/aliases/"
 
 #define              SECRET_SERVICE_PATH                      "/org/freedesktop/secrets"
@@ -146,6 +193,17 @@ void                 _secret_service_search_for_paths_variant (SecretService *se
                                                                GAsyncReadyCallback callback,
                                                                gpointer user_data);
 
+void                 _secret_service_clear_many               (SecretService *service,
+                                                               const SecretSchema *schema,
+                                                               GList *attributes,
+                                                               GCancellable *cancellable,
+                                                               GAsyncReadyCallback callback,
+                                                               gpointer user_data);
+
+gboolean             _secret_service_clear_many_finish        (SecretService *service,
+                                                               GAsyncResult *result,
+                                                               GError **error);
+
 SecretItem *         _secret_service_find_item_instance       (SecretService *self,
                                                                const gchar *item_path);
 
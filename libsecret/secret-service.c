@@ -142,11 +142,14 @@ static void   secret_service_async_initable_iface   (GAsyncInitableIface *iface)
 
 static void   secret_service_backend_iface          (SecretBackendInterface *iface);
 
+static void   secret_service_batch_backend_iface    (SecretBatchBackendInterface *iface);
+
 G_DEFINE_TYPE_WITH_CODE (SecretService, secret_service, G_TYPE_DBUS_PROXY,
                          G_ADD_PRIVATE (SecretService)
                          G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, secret_service_initable_iface);
                          G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE, secret_service_async_initable_iface);
 			 G_IMPLEMENT_INTERFACE (SECRET_TYPE_BACKEND, secret_service_backend_iface);
+			 G_IMPLEMENT_INTERFACE (SECRET_TYPE_BATCH_BACKEND, secret_service_batch_backend_iface);
 			 _secret_backend_ensure_extension_point ();
 			 g_io_extension_point_implement (SECRET_BACKEND_EXTENSION_POINT_NAME,
                                                          g_define_type_id,
@@ -926,6 +929,31 @@ secret_service_real_clear_finish (SecretBackend *self,
 					    result, error);
 }
 
+static void
+secret_service_real_clear_many (SecretBackend *self,
+				const SecretSchema *schema,
+				GList *attributes,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	g_return_if_fail (SECRET_IS_SERVICE (self));
+
+	_secret_service_clear_many (SECRET_SERVICE (self), schema, attributes,
+				    cancellable, callback, user_data);
+}
+
+static gboolean
+secret_service_real_clear_many_finish (SecretBackend *self,
+				       GAsyncResult *result,
+				       GError **error)
+{
+	g_return_val_if_fail (SECRET_IS_SERVICE (self), FALSE);
+
+	return _secret_service_clear_many_finish (SECRET_SERVICE (self),
+						  result, error);
+}
+
 static void
 secret_service_real_search (SecretBackend *self,
 			    const SecretSchema *schema,
@@ -969,6 +997,13 @@ secret_service_backend_iface (SecretBackendInterface *iface)
 	iface->search_finish = secret_service_real_search_finish;
 }
 
+static void
+secret_service_batch_backend_iface (SecretBatchBackendInterface *iface)
+{
+	iface->clear_many = secret_service_real_clear_many;
+	iface->clear_many_finish = secret_service_real_clear_many_finish;
+}
+
 /**
  * secret_service_get:
  * @flags: flags for which service functionality to ensure is initialized
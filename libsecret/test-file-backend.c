@@ -0,0 +1,570 @@
+/* libsecret - GLib wrapper for Secret Service
+ *
+ * Copyright 2019 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#undef G_DISABLE_ASSERT
+
+#include "secret-attributes.h"
+#include "secret-backend.h"
+#include "secret-password.h"
+
+#include "egg/egg-testing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const SecretSchema MOCK_SCHEMA = {
+	"org.mock.Schema",
+	SECRET_SCHEMA_NONE,
+	{
+		{ "number", SECRET_SCHEMA_ATTRIBUTE_INTEGER },
+		{ "string", SECRET_SCHEMA_ATTRIBUTE_STRING },
+	}
+};
+
+typedef struct {
+	gchar *directory;
+	GMainLoop *loop;
+	guint pending;
+	/* commits of the backend, and the changes they wrote */
+	guint commits;
+	guint committed;
+} Test;
+
+static void
+setup (Test *test,
+       gconstpointer unused)
+{
+	gchar *path;
+
+	test->directory = egg_tests_create_scratch_directory (NULL, NULL);
+	test->loop = g_main_loop_new (NULL, TRUE);
+
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	g_setenv ("SECRET_FILE_TEST_PATH", path, TRUE);
+	g_free (path);
+}
+
+static void
+teardown (Test *test,
+          gconstpointer unused)
+{
+	_secret_backend_uncache_instance ();
+
+	egg_tests_remove_scratch_directory (test->directory);
+	g_free (test->directory);
+
+	g_main_loop_unref (test->loop);
+}
+
+static void
+on_store (GObject *source,
+	  GAsyncResult *result,
+	  gpointer user_data)
+{
+	Test *test = user_data;
+	GError *error = NULL;
+	gboolean ret;
+
+	ret = secret_password_store_finish (result, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	g_assert_cmpuint (test->pending, >, 0);
+	if (--test->pending == 0)
+		g_main_loop_quit (test->loop);
+}
+
+static void
+on_debug (const gchar *log_domain,
+	  GLogLevelFlags log_level,
+	  const gchar *message,
+	  gpointer user_data)
+{
+	Test *test = user_data;
+	guint changes;
+
+	if (sscanf (message, "writing %u changes", &changes) == 1) {
+		test->commits++;
+		test->committed += changes;
+	}
+}
+
+static void
+test_store_concurrent (Test *test,
+		       gconstpointer unused)
+{
+	GError *error = NULL;
+	gchar *password;
+	gchar *label;
+	guint handler;
+	gint i;
+
+	handler = g_log_set_handler (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG, on_debug, test);
+
+	/* Changes made while a write is in progress wait for the next
+	 * one, so these take fewer writes than there are changes */
+	for (i = 0; i < 20; i++) {
+		label = g_strdup_printf ("Label %d", i);
+		password = g_strdup_printf ("password %d", i);
+		test->pending++;
+		secret_password_store (&MOCK_SCHEMA, NULL, label, password,
+				       NULL, on_store, test,
+				       "number", i,
+				       "string", "concurrent",
+				       NULL);
+		g_free (password);
+		g_free (label);
+	}
+
+	g_main_loop_run (test->loop);
+	g_assert_cmpuint (test->pending, ==, 0);
+
+	g_log_remove_handler (G_LOG_DOMAIN, handler);
+	g_assert_cmpuint (test->committed, ==, 20);
+	g_assert_cmpuint (test->commits, >, 0);
+	g_assert_cmpuint (test->commits, <, 20);
+
+	/* Read everything back from the file */
+	_secret_backend_uncache_instance ();
+
+	for (i = 0; i < 20; i++) {
+		gchar *expected = g_strdup_printf ("password %d", i);
+
+		password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+							"number", i,
+							"string", "concurrent",
+							NULL);
+		g_assert_no_error (error);
+		g_assert_cmpstr (password, ==, expected);
+		secret_password_free (password);
+		g_free (expected);
+	}
+}
+
+static void
+test_store_sync (Test *test,
+		 gconstpointer unused)
+{
+	GError *error = NULL;
+	gchar *password;
+	gboolean ret;
+
+	ret = secret_password_store_sync (&MOCK_SCHEMA, NULL, "Label", "secret",
+					  NULL, &error,
+					  "number", 1,
+					  "string", "sync",
+					  NULL);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	ret = secret_password_clear_sync (&MOCK_SCHEMA, NULL, &error,
+					  "number", 1,
+					  "string", "sync",
+					  NULL);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	_secret_backend_uncache_instance ();
+
+	password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+						"number", 1,
+						"string", "sync",
+						NULL);
+	g_assert_no_error (error);
+	g_assert_null (password);
+}
+
+static void
+test_sync_during_async (Test *test,
+			gconstpointer unused)
+{
+	GError *error = NULL;
+	gchar *password;
+	gboolean ret;
+	gint i;
+
+	/* Opens the collection */
+	ret = secret_password_store_sync (&MOCK_SCHEMA, NULL, "Label", "first",
+					  NULL, &error,
+					  "number", 0,
+					  "string", "interleaved",
+					  NULL);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	test->pending++;
+	secret_password_store (&MOCK_SCHEMA, NULL, "Label", "async",
+			       NULL, on_store, test,
+			       "number", 1,
+			       "string", "interleaved",
+			       NULL);
+
+	/* Synchronous calls from the same thread don't wait for the main
+	 * context to run, whatever stage the store above is at, including
+	 * while its write is in progress */
+	for (i = 2; test->pending > 0; i++) {
+		ret = secret_password_store_sync (&MOCK_SCHEMA, NULL, "Label", "sync",
+						  NULL, &error,
+						  "number", i,
+						  "string", "interleaved",
+						  NULL);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+
+		ret = secret_password_clear_sync (&MOCK_SCHEMA, NULL, &error,
+						  "number", i,
+						  "string", "interleaved",
+						  NULL);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+
+		g_main_context_iteration (NULL, FALSE);
+	}
+
+	_secret_backend_uncache_instance ();
+
+	password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+						"number", 1,
+						"string", "interleaved",
+						NULL);
+	g_assert_no_error (error);
+	g_assert_cmpstr (password, ==, "async");
+	secret_password_free (password);
+}
+
+static void
+test_open_during_async (Test *test,
+			gconstpointer unused)
+{
+	GError *error = NULL;
+	gchar *password;
+
+	/* Starts opening the collection */
+	test->pending++;
+	secret_password_store (&MOCK_SCHEMA, NULL, "Label", "async",
+			       NULL, on_store, test,
+			       "number", 1,
+			       "string", "opening",
+			       NULL);
+
+	/* Doesn't wait for the main context to finish opening it */
+	password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+						"number", 1,
+						"string", "opening",
+						NULL);
+	g_assert_no_error (error);
+	g_assert_null (password);
+
+	g_main_loop_run (test->loop);
+	g_assert_cmpuint (test->pending, ==, 0);
+}
+
+static void
+test_collections (Test *test,
+		  gconstpointer unused)
+{
+	GError *error = NULL;
+	gchar *password;
+	gchar *path;
+	gboolean ret;
+
+	ret = secret_password_store_sync (&MOCK_SCHEMA, "work", "Label", "secret",
+					  NULL, &error,
+					  "number", 1,
+					  "string", "work",
+					  NULL);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	/* Each collection lives in its own file */
+	path = g_build_filename (test->directory, "work.keyring", NULL);
+	g_assert_true (g_file_test (path, G_FILE_TEST_IS_REGULAR));
+	g_free (path);
+
+	_secret_backend_uncache_instance ();
+
+	/* Found without opening the collection explicitly */
+	password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+						"number", 1,
+						"string", "work",
+						NULL);
+	g_assert_no_error (error);
+	g_assert_cmpstr (password, ==, "secret");
+	secret_password_free (password);
+
+	ret = secret_password_clear_sync (&MOCK_SCHEMA, NULL, &error,
+					  "number", 1,
+					  "string", "work",
+					  NULL);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	_secret_backend_uncache_instance ();
+
+	password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+						"number", 1,
+						"string", "work",
+						NULL);
+	g_assert_no_error (error);
+	g_assert_null (password);
+
+	/* Collection names can't point outside the directory */
+	ret = secret_password_store_sync (&MOCK_SCHEMA, "../other", "Label", "secret",
+					  NULL, &error,
+					  "number", 1,
+					  NULL);
+	g_assert_error (error, SECRET_ERROR, SECRET_ERROR_NO_SUCH_OBJECT);
+	g_assert_false (ret);
+	g_clear_error (&error);
+}
+
+static void
+test_broken_collection (Test *test,
+			gconstpointer unused)
+{
+	GError *error = NULL;
+	gchar *password;
+	gchar *path;
+	gboolean ret;
+
+	/* Such as a keyring of gnome-keyring in the same directory */
+	path = g_build_filename (test->directory, "login.keyring", NULL);
+	g_file_set_contents (path, "GnomeKeyring\n\r\0\n\0\0", 18, &error);
+	g_assert_no_error (error);
+	g_free (path);
+
+	ret = secret_password_store_sync (&MOCK_SCHEMA, NULL, "Label", "secret",
+					  NULL, &error,
+					  "number", 1,
+					  NULL);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	/* The collections which could be opened are still searched, both
+	 * before and after the directory was listed */
+	password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+						"number", 1,
+						NULL);
+	g_assert_no_error (error);
+	g_assert_cmpstr (password, ==, "secret");
+	secret_password_free (password);
+
+	password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+						"number", 1,
+						NULL);
+	g_assert_no_error (error);
+	g_assert_cmpstr (password, ==, "secret");
+	secret_password_free (password);
+
+	ret = secret_password_clear_sync (&MOCK_SCHEMA, NULL, &error,
+					  "number", 1,
+					  NULL);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+}
+
+static void
+test_store_many (Test *test,
+		 gconstpointer unused)
+{
+	GList *entries = NULL;
+	GHashTable *attributes;
+	GPtrArray *errors = NULL;
+	GError *error = NULL;
+	gchar *password;
+	gchar *label;
+	gboolean ret;
+	gint i;
+
+	for (i = 0; i < 20; i++) {
+		attributes = secret_attributes_build (&MOCK_SCHEMA,
+						      "number", i,
+						      "string", "many",
+						      NULL);
+		label = g_strdup_printf ("Label %d", i);
+		password = g_strdup_printf ("password %d", i);
+		entries = g_list_append (entries,
+					 secret_password_entry_new (&MOCK_SCHEMA, attributes,
+								    i % 2 ? "work" : NULL,
+								    label, password));
+		g_free (password);
+		g_free (label);
+		g_hash_table_unref (attributes);
+	}
+
+	/* Doesn't keep the others from being stored */
+	attributes = secret_attributes_build (&MOCK_SCHEMA, "number", 20, NULL);
+	entries = g_list_append (entries,
+				 secret_password_entry_new (&MOCK_SCHEMA, attributes,
+							    "../other", "Label", "secret"));
+	g_hash_table_unref (attributes);
+
+	ret = secret_password_store_many_sync (entries, NULL, &errors, &error);
+	g_list_free_full (entries, (GDestroyNotify) secret_password_entry_unref);
+	g_assert_error (error, SECRET_ERROR, SECRET_ERROR_NO_SUCH_OBJECT);
+	g_assert_false (ret);
+	g_clear_error (&error);
+
+	g_assert_cmpuint (errors->len, ==, 21);
+	for (i = 0; i < 20; i++)
+		g_assert_null (g_ptr_array_index (errors, i));
+	g_assert_nonnull (g_ptr_array_index (errors, 20));
+	g_ptr_array_unref (errors);
+
+	_secret_backend_uncache_instance ();
+
+	for (i = 0; i < 20; i++) {
+		gchar *expected = g_strdup_printf ("password %d", i);
+
+		password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+							"number", i,
+							"string", "many",
+							NULL);
+		g_assert_no_error (error);
+		g_assert_cmpstr (password, ==, expected);
+		secret_password_free (password);
+		g_free (expected);
+	}
+}
+
+static void
+test_clear_many (Test *test,
+		 gconstpointer unused)
+{
+	GList *attributes = NULL;
+	GError *error = NULL;
+	gchar *password;
+	gboolean ret;
+	gint i;
+
+	for (i = 0; i < 10; i++) {
+		password = g_strdup_printf ("password %d", i);
+		ret = secret_password_store_sync (&MOCK_SCHEMA, i % 2 ? "work" : NULL,
+						  "Label", password, NULL, &error,
+						  "number", i,
+						  "string", "clear",
+						  NULL);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+		g_free (password);
+	}
+
+	for (i = 0; i < 5; i++)
+		attributes = g_list_append (attributes,
+					    secret_attributes_build (&MOCK_SCHEMA,
+								     "number", i,
+								     NULL));
+
+	ret = secret_password_clear_many_sync (&MOCK_SCHEMA, attributes, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	/* Nothing left to remove */
+	ret = secret_password_clear_many_sync (&MOCK_SCHEMA, attributes, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_false (ret);
+	g_list_free_full (attributes, (GDestroyNotify) g_hash_table_unref);
+
+	_secret_backend_uncache_instance ();
+
+	for (i = 0; i < 10; i++) {
+		password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+							"number", i,
+							"string", "clear",
+							NULL);
+		g_assert_no_error (error);
+		if (i < 5)
+			g_assert_null (password);
+		else
+			g_assert_nonnull (password);
+		secret_password_free (password);
+	}
+}
+
+typedef struct {
+	GMainContext *context;
+	gboolean done;
+	gchar *password;
+} ContextClosure;
+
+static void
+on_lookup_context (GObject *source,
+		   GAsyncResult *result,
+		   gpointer user_data)
+{
+	ContextClosure *closure = user_data;
+	GError *error = NULL;
+
+	/* The work is done in a thread, but the result comes back here */
+	g_assert_true (g_main_context_get_thread_default () == closure->context);
+
+	closure->password = secret_password_lookup_finish (result, &error);
+	g_assert_no_error (error);
+	closure->done = TRUE;
+}
+
+static void
+test_thread_default (Test *test,
+		     gconstpointer unused)
+{
+	ContextClosure closure = { NULL, FALSE, NULL };
+	GError *error = NULL;
+	gboolean ret;
+
+	ret = secret_password_store_sync (&MOCK_SCHEMA, NULL, "Label", "secret",
+					  NULL, &error,
+					  "number", 1,
+					  "string", "context",
+					  NULL);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	closure.context = g_main_context_new ();
+	g_main_context_push_thread_default (closure.context);
+
+	secret_password_lookup (&MOCK_SCHEMA, NULL, on_lookup_context, &closure,
+				"number", 1,
+				"string", "context",
+				NULL);
+	while (!closure.done)
+		g_main_context_iteration (closure.context, TRUE);
+
+	g_main_context_pop_thread_default (closure.context);
+	g_main_context_unref (closure.context);
+
+	g_assert_cmpstr (closure.password, ==, "secret");
+	secret_password_free (closure.password);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-file-backend");
+
+	g_setenv ("SECRET_BACKEND", "file", TRUE);
+	g_setenv ("SECRET_FILE_TEST_PASSWORD", "password", TRUE);
+
+	g_test_add ("/file-backend/store-concurrent", Test, NULL, setup, test_store_concurrent, teardown);
+	g_test_add ("/file-backend/store-sync", Test, NULL, setup, test_store_sync, teardown);
+	g_test_add ("/file-backend/sync-during-async", Test, NULL, setup, test_sync_during_async, teardown);
+	g_test_add ("/file-backend/open-during-async", Test, NULL, setup, test_open_during_async, teardown);
+	g_test_add ("/file-backend/store-many", Test, NULL, setup, test_store_many, teardown);
+	g_test_add ("/file-backend/clear-many", Test, NULL, setup, test_clear_many, teardown);
+	g_test_add ("/file-backend/collections", Test, NULL, setup, test_collections, teardown);
+	g_test_add ("/file-backend/broken-collection", Test, NULL, setup, test_broken_collection, teardown);
+	g_test_add ("/file-backend/thread-default", Test, NULL, setup, test_thread_default, teardown);
+
+	return egg_tests_run_with_loop ();
+}
@@ -3,12 +3,14 @@
 
 #undef G_DISABLE_ASSERT
 
+#include "egg/egg-keyring1.h"
 #include "egg/egg-testing.h"
 #include "secret-file-collection.h"
 #include "secret-retrievable.h"
 #include "secret-schema.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 typedef struct {
 	gchar *directory;
@@ -189,6 +191,152 @@ test_search (Test *test,
 	g_hash_table_unref (attributes);
 }
 
+static void
+assert_labels (Test *test,
+	       GList *matches,
+	       const gchar **labels)
+{
+	GError *error = NULL;
+	SecretFileItem *item;
+	gchar *label;
+	GList *l;
+	gsize i = 0;
+
+	for (l = matches; l != NULL; l = g_list_next (l), i++) {
+		item = _secret_file_item_decrypt ((GVariant *)l->data,
+						  test->collection,
+						  &error);
+		g_assert_no_error (error);
+		g_object_get (item, "label", &label, NULL);
+		g_assert_cmpstr (label, ==, labels[i]);
+		g_free (label);
+		g_object_unref (item);
+	}
+	g_assert_null (labels[i]);
+}
+
+static void
+test_search_order (Test *test,
+		   gconstpointer unused)
+{
+	const gchar *stored[] = { "label1", "label2", "label3", NULL };
+	const gchar *replaced[] = { "label1", "label3", "label2", NULL };
+	GHashTable *attributes;
+	GHashTable *query;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	gchar *name;
+	gboolean ret;
+	gsize i;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+	value = secret_value_new ("test", -1, "text/plain");
+
+	for (i = 0; stored[i] != NULL; i++) {
+		name = g_strdup_printf ("%" G_GSIZE_FORMAT, i);
+		g_hash_table_insert (attributes, g_strdup ("bar"), name);
+		ret = secret_file_collection_replace (test->collection,
+						      attributes, stored[i], value,
+						      &error);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+	}
+
+	/* Items are found in the order they were stored */
+	query = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (query, g_strdup ("foo"), g_strdup ("a"));
+	matches = secret_file_collection_search (test->collection, query);
+	assert_labels (test, matches, stored);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	/* Replacing an item moves it to the end */
+	g_hash_table_insert (attributes, g_strdup ("bar"), g_strdup ("1"));
+	ret = secret_file_collection_replace (test->collection,
+					      attributes, "label2", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	matches = secret_file_collection_search (test->collection, query);
+	assert_labels (test, matches, replaced);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	secret_value_unref (value);
+	g_hash_table_unref (query);
+	g_hash_table_unref (attributes);
+}
+
+static void
+test_search_index (Test *test,
+		   gconstpointer unused)
+{
+	GHashTable *attributes;
+	GHashTable *query;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	gboolean ret;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+	g_hash_table_insert (attributes, g_strdup ("bar"), g_strdup ("b"));
+
+	value = secret_value_new ("test1", -1, "text/plain");
+	ret = secret_file_collection_replace (test->collection,
+					      attributes, "label", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	/* Overwriting must not leave a stale entry behind */
+	ret = secret_file_collection_replace (test->collection,
+					      attributes, "label", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	g_hash_table_insert (attributes, g_strdup ("bar"), g_strdup ("c"));
+	ret = secret_file_collection_replace (test->collection,
+					      attributes, "label", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	secret_value_unref (value);
+
+	query = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (query, g_strdup ("foo"), g_strdup ("a"));
+	matches = secret_file_collection_search (test->collection, query);
+	g_assert_cmpint (g_list_length (matches), ==, 2);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	g_hash_table_insert (query, g_strdup ("bar"), g_strdup ("b"));
+	matches = secret_file_collection_search (test->collection, query);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	g_hash_table_insert (query, g_strdup ("baz"), g_strdup ("b"));
+	matches = secret_file_collection_search (test->collection, query);
+	g_assert_null (matches);
+	g_hash_table_remove (query, "baz");
+
+	ret = secret_file_collection_clear (test->collection, query, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	matches = secret_file_collection_search (test->collection, query);
+	g_assert_null (matches);
+
+	g_hash_table_remove (query, "bar");
+	matches = secret_file_collection_search (test->collection, query);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	g_hash_table_unref (query);
+	g_hash_table_unref (attributes);
+}
+
 static void
 test_decrypt (Test *test,
 	      gconstpointer unused)
@@ -308,49 +456,1519 @@ test_write (Test *test,
 	g_main_loop_run (test->loop);
 }
 
+static SecretFileCollection *
+open_collection (Test *test,
+		 gboolean journal,
+		 gboolean upgrade)
+{
+	GFile *file;
+	gchar *path;
+	SecretValue *password;
+
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	file = g_file_new_for_path (path);
+	g_free (path);
+
+	password = secret_value_new ("password", -1, "text/plain");
+
+	g_async_initable_new_async (SECRET_TYPE_FILE_COLLECTION,
+				    G_PRIORITY_DEFAULT,
+				    NULL,
+				    on_new_async,
+				    test,
+				    "file", file,
+				    "password", password,
+				    "journal", journal,
+				    "upgrade", upgrade,
+				    NULL);
+
+	g_object_unref (file);
+	secret_value_unref (password);
+
+	g_main_loop_run (test->loop);
+
+	return g_steal_pointer (&test->collection);
+}
+
 static void
-test_read (Test *test,
-	   gconstpointer unused)
+test_write_large (Test *test,
+		  gconstpointer unused)
 {
+	SecretFileCollection *collection;
+	SecretFileCollection *original;
 	GHashTable *attributes;
 	SecretValue *value;
 	GError *error = NULL;
+	GVariant *variant;
 	GList *matches;
-	SecretFileItem *item;
-	const gchar *secret;
-	gsize n_secret;
-	gchar *label;
+	gchar *contents;
+	GBytes *bytes;
+	GBytes *data;
+	gchar *secret;
+	gchar *path;
+	gsize length;
+	gboolean ret;
+	gint i;
+
+	original = g_steal_pointer (&test->collection);
+	collection = open_collection (test, FALSE, FALSE);
 
+	/* Large enough for 4 byte framing offsets */
+	secret = g_strnfill (512, 'x');
 	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
-	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+	for (i = 0; i < 200; i++) {
+		g_hash_table_insert (attributes, g_strdup ("number"), g_strdup_printf ("%d", i));
+		value = secret_value_new (secret, -1, "text/plain");
+		ret = secret_file_collection_replace (collection,
+						      attributes, "label", value,
+						      &error);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+		secret_value_unref (value);
+	}
+	g_free (secret);
 
-	matches = secret_file_collection_search (test->collection, attributes);
-	g_assert_cmpint (g_list_length (matches), ==, 1);
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_object_unref (collection);
 
-	item = _secret_file_item_decrypt ((GVariant *)matches->data,
-					  test->collection,
-					  &error);
+	/* What's streamed out is what GVariant would have serialized */
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	ret = g_file_get_contents (path, &contents, &length, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_free (path);
+
+	g_assert_cmpuint (length, >, G_MAXUINT16);
+	bytes = g_bytes_new_take (contents, length);
+	data = g_bytes_new_from_bytes (bytes, 18, length - 18);
+	variant = g_variant_new_from_bytes (G_VARIANT_TYPE ("(uayutua(a{say}ay))"),
+					    data, FALSE);
+	g_assert_true (g_variant_is_normal_form (variant));
+	g_variant_unref (variant);
+	g_bytes_unref (data);
+	g_bytes_unref (bytes);
+
+	collection = open_collection (test, FALSE, FALSE);
+	g_hash_table_remove_all (attributes);
+	matches = secret_file_collection_search (collection, attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 200);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	g_object_unref (collection);
+	g_hash_table_unref (attributes);
+	test->collection = original;
+}
+
+static void
+replace_items (SecretFileCollection *collection,
+	       const gchar *stage)
+{
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	gboolean ret;
+	gint i;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("stage"), g_strdup (stage));
+	for (i = 0; i < 20; i++) {
+		g_hash_table_insert (attributes, g_strdup ("number"), g_strdup_printf ("%d", i));
+		value = secret_value_new ("secret", -1, "text/plain");
+		ret = secret_file_collection_replace (collection,
+						      attributes, "label", value,
+						      &error);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+		secret_value_unref (value);
+	}
+	g_hash_table_unref (attributes);
+}
+
+/* Short enough for the batched syncs to happen between the writes */
+#define SYNC_INTERVAL 10
+
+static SecretFileCollection *
+open_durable_collection (Test *test,
+			 SecretFileDurability durability,
+			 gboolean journal)
+{
+	GFile *file;
+	gchar *path;
+	SecretValue *password;
+
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	file = g_file_new_for_path (path);
+	g_free (path);
+
+	password = secret_value_new ("password", -1, "text/plain");
+
+	g_async_initable_new_async (SECRET_TYPE_FILE_COLLECTION,
+				    G_PRIORITY_DEFAULT,
+				    NULL,
+				    on_new_async,
+				    test,
+				    "file", file,
+				    "password", password,
+				    "journal", journal,
+				    "durability", durability,
+				    "sync-interval", SYNC_INTERVAL,
+				    NULL);
+
+	g_object_unref (file);
+	secret_value_unref (password);
+
+	g_main_loop_run (test->loop);
+
+	return g_steal_pointer (&test->collection);
+}
+
+static guint
+count_stage (SecretFileCollection *collection,
+	     const gchar *stage)
+{
+	GHashTable *attributes;
+	GList *matches;
+	guint count;
+
+	attributes = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (attributes, "stage", (gpointer) stage);
+	matches = secret_file_collection_search (collection, attributes);
+	count = g_list_length (matches);
 	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+	g_hash_table_unref (attributes);
+
+	return count;
+}
+
+/* Reads the files as another process would, which must find either
+ * all of the items of @stage or none of them, and once the write is
+ * complete, nothing left behind by it */
+static gboolean
+check_files (Test *test,
+	     const gchar *previous,
+	     const gchar *stage,
+	     gboolean complete)
+{
+	SecretFileCollection *collection;
+	SecretValue *password;
+	GError *error = NULL;
+	GFile *file;
+	GDir *dir;
+	const gchar *name;
+	gchar *path;
+	guint count;
+
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	file = g_file_new_for_path (path);
+	g_free (path);
+
+	password = secret_value_new ("password", -1, "text/plain");
+	collection = g_initable_new (SECRET_TYPE_FILE_COLLECTION, NULL, &error,
+				     "file", file,
+				     "password", password,
+				     NULL);
 	g_assert_no_error (error);
-	g_assert_nonnull (item);
+	g_object_unref (file);
+	secret_value_unref (password);
 
-	g_object_get (item, "label", &label, NULL);
-	g_assert_cmpstr (label, ==, "label1");
-	g_free (label);
+	if (previous != NULL)
+		g_assert_cmpuint (count_stage (collection, previous), ==, 20);
+	count = count_stage (collection, stage);
+	g_assert_true (count == 0 || count == 20);
+	g_object_unref (collection);
 
-	value = secret_retrievable_retrieve_secret_sync (SECRET_RETRIEVABLE (item),
-							 NULL,
-							 &error);
+	if (!complete)
+		return count == 20;
+
+	dir = g_dir_open (test->directory, 0, &error);
 	g_assert_no_error (error);
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		if (!g_str_equal (name, "default.keyring") &&
+		    !g_str_equal (name, "default.keyring.journal") &&
+		    !g_str_equal (name, "default.keyring.lock"))
+			g_assert_cmpstr (name, ==, NULL);
+	}
+	g_dir_close (dir);
 
-	secret = secret_value_get (value, &n_secret);
-	g_assert_cmpstr (secret, ==, "test1");
+	return count == 20;
+}
+
+/* Whatever the durability, each write leaves the files either as they
+ * were or as they are once it completed */
+static void
+test_durability (Test *test,
+		 SecretFileDurability durability)
+{
+	SecretFileCollection *collection;
+	gchar *previous = NULL;
+	gchar *stage;
+	gboolean journal;
+	gint i;
+
+	/* The journal is only appended to once the keyring file exists */
+	for (journal = FALSE; journal <= TRUE; journal++) {
+		collection = open_durable_collection (test, durability, journal);
+
+		for (i = 0; i < 4; i++) {
+			stage = g_strdup_printf ("%s %d", journal ? "journal" : "full", i);
+			replace_items (collection, stage);
+
+			/* The write happens in a thread while the files are
+			 * read. A new keyring file may be created in place,
+			 * and records appended to the journal are only whole
+			 * on their own, not as a batch */
+			secret_file_collection_write (collection, NULL, on_write, test);
+			if (previous != NULL && !journal)
+				check_files (test, previous, stage, FALSE);
+			g_main_loop_run (test->loop);
+			g_assert_true (check_files (test, previous, stage, TRUE));
+
+			/* Alternate between writes within the sync interval
+			 * and writes after the batched sync happened */
+			if (i % 2 == 1)
+				g_usleep (2 * SYNC_INTERVAL * G_TIME_SPAN_MILLISECOND);
+
+			g_free (previous);
+			previous = stage;
+		}
+
+		g_object_unref (collection);
+	}
+
+	g_free (previous);
+}
+
+static void
+test_durability_always (Test *test,
+			gconstpointer unused)
+{
+	test_durability (test, SECRET_FILE_DURABILITY_ALWAYS);
+}
+
+static void
+test_durability_batched (Test *test,
+			 gconstpointer unused)
+{
+	test_durability (test, SECRET_FILE_DURABILITY_BATCHED);
+}
+
+static void
+test_durability_none (Test *test,
+		      gconstpointer unused)
+{
+	test_durability (test, SECRET_FILE_DURABILITY_NONE);
+}
+
+static void
+replace_item (SecretFileCollection *collection,
+	      const gchar *name,
+	      const gchar *secret)
+{
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	gboolean ret;
 
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("name"), g_strdup (name));
+	value = secret_value_new (secret, -1, "text/plain");
+	ret = secret_file_collection_replace (collection,
+					      attributes, "label", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
 	secret_value_unref (value);
-	g_object_unref (item);
 	g_hash_table_unref (attributes);
 }
 
+static gchar *
+lookup_item (SecretFileCollection *collection,
+	     const gchar *name)
+{
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	gchar *secret;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("name"), g_strdup (name));
+	matches = secret_file_collection_search (collection, attributes);
+	g_hash_table_unref (attributes);
+
+	if (matches == NULL)
+		return NULL;
+
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	value = _secret_file_item_decrypt_value (matches->data, collection, &error);
+	g_assert_no_error (error);
+	secret = g_strdup (secret_value_get_text (value));
+	secret_value_unref (value);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	return secret;
+}
+
+/* Two collections writing the same file, each of them unaware of what
+ * the other did, end up with the changes of both */
+static void
+test_merge_full (Test *test,
+		 gboolean journal)
+{
+	SecretFileCollection *original;
+	SecretFileCollection *first;
+	SecretFileCollection *second;
+	GHashTable *attributes;
+	GError *error = NULL;
+	gchar *secret;
+	gboolean ret;
+
+	original = g_steal_pointer (&test->collection);
+
+	first = open_collection (test, journal, FALSE);
+	replace_item (first, "shared", "original");
+	replace_item (first, "both", "original");
+	secret_file_collection_write (first, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	second = open_collection (test, journal, FALSE);
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("name"), g_strdup ("shared"));
+	ret = secret_file_collection_clear (first, attributes, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_hash_table_unref (attributes);
+	replace_item (first, "first", "first");
+	replace_item (first, "both", "first");
+
+	replace_item (second, "second", "second");
+	replace_item (second, "both", "second");
+
+	secret_file_collection_write (first, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	/* Finds the file changed, and merges instead of failing */
+	secret_file_collection_write (second, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	g_object_unref (first);
+	g_object_unref (second);
+
+	first = open_collection (test, FALSE, FALSE);
+
+	/* Not brought back by the collection which didn't touch it */
+	secret = lookup_item (first, "shared");
+	g_assert_null (secret);
+
+	secret = lookup_item (first, "first");
+	g_assert_cmpstr (secret, ==, "first");
+	g_free (secret);
+
+	secret = lookup_item (first, "second");
+	g_assert_cmpstr (secret, ==, "second");
+	g_free (secret);
+
+	/* Changed by both, the last write wins */
+	secret = lookup_item (first, "both");
+	g_assert_cmpstr (secret, ==, "second");
+	g_free (secret);
+
+	g_object_unref (first);
+	test->collection = original;
+}
+
+static void
+test_merge (Test *test,
+	    gconstpointer unused)
+{
+	test_merge_full (test, FALSE);
+}
+
+static void
+test_merge_journal (Test *test,
+		    gconstpointer unused)
+{
+	test_merge_full (test, TRUE);
+}
+
+static gchar *
+read_keyring (Test *test,
+	      gsize *length)
+{
+	GError *error = NULL;
+	gchar *contents;
+	gchar *path;
+	gboolean ret;
+
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	ret = g_file_get_contents (path, &contents, length, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_free (path);
+
+	return contents;
+}
+
+static void
+test_journal (Test *test,
+	      gconstpointer unused)
+{
+	SecretFileCollection *collection;
+	SecretFileCollection *original;
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	gchar *contents;
+	gsize length;
+	gchar *path;
+	gboolean ret;
+
+	original = g_steal_pointer (&test->collection);
+	collection = open_collection (test, TRUE, FALSE);
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+
+	value = secret_value_new ("test1", -1, "text/plain");
+	ret = secret_file_collection_replace (collection,
+					      attributes, "label1", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	secret_value_unref (value);
+
+	/* The first write replaces the keyring file and starts the journal */
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	path = g_build_filename (test->directory, "default.keyring.journal", NULL);
+	g_assert_true (g_file_test (path, G_FILE_TEST_EXISTS));
+
+	/* Which older versions must not ignore */
+	contents = read_keyring (test, &length);
+	g_assert_cmpint (contents[17] & 0x10, ==, 0x10);
+	g_free (contents);
+
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("b"));
+	value = secret_value_new ("test2", -1, "text/plain");
+	ret = secret_file_collection_replace (collection,
+					      attributes, "label2", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	secret_value_unref (value);
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+	ret = secret_file_collection_clear (collection, attributes, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	g_object_unref (collection);
+
+	/* The appended changes are replayed when loading */
+	collection = open_collection (test, FALSE, FALSE);
+
+	matches = secret_file_collection_search (collection, attributes);
+	g_assert_null (matches);
+
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("b"));
+	matches = secret_file_collection_search (collection, attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	/* Writing without a journal gets rid of it, and of the mark */
+	value = secret_value_new ("test3", -1, "text/plain");
+	ret = secret_file_collection_replace (collection,
+					      attributes, "label3", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	secret_value_unref (value);
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	g_assert_false (g_file_test (path, G_FILE_TEST_EXISTS));
+	contents = read_keyring (test, &length);
+	g_assert_cmpint (contents[17] & 0x10, ==, 0);
+	g_free (contents);
+
+	g_free (path);
+	g_object_unref (collection);
+	g_hash_table_unref (attributes);
+	test->collection = original;
+}
+
+static gboolean
+wait_for_match (SecretFileCollection *collection,
+		GHashTable *attributes)
+{
+	GList *matches;
+	gint i;
+
+	/* Changes are noticed once the file monitor reports them */
+	for (i = 0; i < 500; i++) {
+		matches = secret_file_collection_search (collection, attributes);
+		if (matches != NULL) {
+			g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+			return TRUE;
+		}
+		g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+	}
+
+	return FALSE;
+}
+
+static void
+test_watch (Test *test,
+	    gconstpointer unused)
+{
+	SecretFileCollection *original;
+	SecretFileCollection *collection;
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	gboolean ret;
+
+	/* Another process writes to the file the test collection uses */
+	original = g_steal_pointer (&test->collection);
+	collection = open_collection (test, FALSE, FALSE);
+	test->collection = original;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	value = secret_value_new ("test1", -1, "text/plain");
+
+	/* Both writes most likely happen within the same second */
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+	ret = secret_file_collection_replace (collection,
+					      attributes, "label1", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	g_assert_true (wait_for_match (test->collection, attributes));
+
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("b"));
+	ret = secret_file_collection_replace (collection,
+					      attributes, "label2", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	g_assert_true (wait_for_match (test->collection, attributes));
+
+	secret_value_unref (value);
+	g_hash_table_unref (attributes);
+	g_object_unref (collection);
+}
+
+static void
+on_refresh (GObject *source_object,
+	    GAsyncResult *result,
+	    gpointer user_data)
+{
+	SecretFileCollection *collection =
+		SECRET_FILE_COLLECTION (source_object);
+	Test *test = user_data;
+	GError *error = NULL;
+	gboolean ret;
+
+	ret = secret_file_collection_refresh_finish (collection,
+						     result,
+						     &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	g_main_loop_quit (test->loop);
+}
+
+static void
+test_refresh (Test *test,
+	      gconstpointer unused)
+{
+	SecretFileCollection *original;
+	SecretFileCollection *collection;
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches = NULL;
+	gboolean ret;
+	gint i;
+
+	/* Another process writes to the file the test collection uses */
+	original = g_steal_pointer (&test->collection);
+	collection = open_collection (test, FALSE, FALSE);
+	test->collection = original;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+
+	value = secret_value_new ("test1", -1, "text/plain");
+	ret = secret_file_collection_replace (collection,
+					      attributes, "label1", value,
+					      &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	secret_value_unref (value);
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+
+	/* Reloading happens in the background */
+	for (i = 0; i < 500 && matches == NULL; i++) {
+		secret_file_collection_refresh (test->collection, NULL,
+						on_refresh, test);
+		g_main_loop_run (test->loop);
+
+		matches = secret_file_collection_search (test->collection, attributes);
+		if (matches == NULL)
+			g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+	}
+
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	g_hash_table_unref (attributes);
+	g_object_unref (collection);
+}
+
+static void
+test_read (Test *test,
+	   gconstpointer unused)
+{
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	SecretFileItem *item;
+	const gchar *secret;
+	gsize n_secret;
+	gchar *label;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+
+	matches = secret_file_collection_search (test->collection, attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+
+	item = _secret_file_item_decrypt ((GVariant *)matches->data,
+					  test->collection,
+					  &error);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+	g_assert_no_error (error);
+	g_assert_nonnull (item);
+
+	g_object_get (item, "label", &label, NULL);
+	g_assert_cmpstr (label, ==, "label1");
+	g_free (label);
+
+	value = secret_retrievable_retrieve_secret_sync (SECRET_RETRIEVABLE (item),
+							 NULL,
+							 &error);
+	g_assert_no_error (error);
+
+	secret = secret_value_get (value, &n_secret);
+	g_assert_cmpstr (secret, ==, "test1");
+
+	secret_value_unref (value);
+	g_object_unref (item);
+	g_hash_table_unref (attributes);
+}
+
+static void
+test_deferred (Test *test,
+	       gconstpointer unused)
+{
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	SecretFileItem *item;
+	gchar *label;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+
+	/* Retrieving the secret decrypts the item */
+	matches = secret_file_collection_search_items (test->collection, attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	item = matches->data;
+	value = secret_retrievable_retrieve_secret_sync (SECRET_RETRIEVABLE (item),
+							 NULL,
+							 &error);
+	g_assert_no_error (error);
+	g_assert_cmpstr (secret_value_get_text (value), ==, "test1");
+	secret_value_unref (value);
+
+	g_object_get (item, "label", &label, NULL);
+	g_assert_cmpstr (label, ==, "label1");
+	g_free (label);
+	g_list_free_full (matches, g_object_unref);
+
+	/* So does reading a property */
+	matches = secret_file_collection_search_items (test->collection, attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	item = matches->data;
+
+	g_object_get (item, "label", &label, NULL);
+	g_assert_cmpstr (label, ==, "label1");
+	g_free (label);
+	g_list_free_full (matches, g_object_unref);
+
+	g_hash_table_unref (attributes);
+}
+
+static void
+test_deferred_reload (Test *test,
+		      gconstpointer unused)
+{
+	SecretFileCollection *collection;
+	SecretFileCollection *original;
+	GHashTable *attributes;
+	GHashTable *other;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	GList *found = NULL;
+	gchar *label;
+	gboolean ret;
+	gint i;
+
+	/* The fixture is in the 1.0 format */
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+	matches = secret_file_collection_search_items (test->collection, attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+
+	/* Another process rewrites the file in the latest format */
+	original = g_steal_pointer (&test->collection);
+	collection = open_collection (test, FALSE, TRUE);
+	test->collection = original;
+	other = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (other, g_strdup ("foo"), g_strdup ("other"));
+	value = secret_value_new ("test2", -1, "text/plain");
+	ret = secret_file_collection_replace (collection, other, "label2",
+					      value, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	secret_value_unref (value);
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_object_unref (collection);
+
+	for (i = 0; i < 500 && found == NULL; i++) {
+		secret_file_collection_refresh (test->collection, NULL,
+						on_refresh, test);
+		g_main_loop_run (test->loop);
+
+		found = secret_file_collection_search (test->collection, other);
+		if (found == NULL)
+			g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+	}
+	g_assert_cmpint (g_list_length (found), ==, 1);
+	g_list_free_full (found, (GDestroyNotify)g_variant_unref);
+
+	/* The item found before is decrypted as it was stored then */
+	g_object_get (matches->data, "label", &label, NULL);
+	g_assert_cmpstr (label, ==, "label1");
+	g_free (label);
+	value = secret_retrievable_retrieve_secret_sync (matches->data, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_cmpstr (secret_value_get_text (value), ==, "test1");
+	secret_value_unref (value);
+
+	g_list_free_full (matches, g_object_unref);
+	g_hash_table_unref (other);
+	g_hash_table_unref (attributes);
+}
+
+static void
+assert_read_item (SecretFileCollection *collection)
+{
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	SecretFileItem *item;
+	gchar *label;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+
+	matches = secret_file_collection_search (collection, attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+
+	item = _secret_file_item_decrypt ((GVariant *)matches->data,
+					  collection,
+					  &error);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+	g_assert_no_error (error);
+	g_assert_nonnull (item);
+
+	g_object_get (item, "label", &label, NULL);
+	g_assert_cmpstr (label, ==, "label1");
+	g_free (label);
+
+	value = secret_retrievable_retrieve_secret_sync (SECRET_RETRIEVABLE (item),
+							 NULL,
+							 &error);
+	g_assert_no_error (error);
+	g_assert_cmpstr (secret_value_get_text (value), ==, "test1");
+
+	secret_value_unref (value);
+	g_object_unref (item);
+	g_hash_table_unref (attributes);
+}
+
+static void
+test_upgrade (Test *test,
+	      gconstpointer unused)
+{
+	SecretFileCollection *collection;
+	gchar *path;
+	gchar *contents;
+	gsize length;
+	GError *error = NULL;
+
+	/* The fixture is in the 1.0 format */
+	g_clear_object (&test->collection);
+	collection = open_collection (test, FALSE, TRUE);
+	assert_read_item (collection);
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_object_unref (collection);
+
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	g_file_get_contents (path, &contents, &length, &error);
+	g_assert_no_error (error);
+	g_assert_cmpuint (length, >, 18);
+	g_assert_cmpint (contents[16], ==, 1);
+	g_assert_cmpint (contents[17] & 0x0f, ==, 2);
+	g_free (contents);
+	g_free (path);
+
+	/* Files in the newer format are read regardless */
+	collection = open_collection (test, FALSE, FALSE);
+	assert_read_item (collection);
+	g_object_unref (collection);
+}
+
+static void
+test_split (Test *test,
+	    gconstpointer unused)
+{
+	SecretFileCollection *collection;
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	SecretFileItem *item;
+	gchar *label;
+	gboolean ret;
+
+	/* New files are created in the latest format when upgrading */
+	g_clear_object (&test->collection);
+	collection = open_collection (test, FALSE, TRUE);
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("foo"), g_strdup ("a"));
+
+	value = secret_value_new ("test1", -1, "text/plain");
+	ret = secret_file_collection_replace (collection, attributes, "label1",
+					      value, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	secret_value_unref (value);
+
+	matches = secret_file_collection_search (collection, attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+
+	/* The metadata can be decrypted without the secret */
+	item = _secret_file_item_decrypt_metadata ((GVariant *)matches->data,
+						   collection, &error);
+	g_assert_no_error (error);
+	g_assert_null (secret_file_item_get_value (item));
+	g_object_get (item, "label", &label, NULL);
+	g_assert_cmpstr (label, ==, "label1");
+	g_free (label);
+	g_object_unref (item);
+
+	/* And the other way around */
+	value = _secret_file_item_decrypt_value ((GVariant *)matches->data,
+						 collection, &error);
+	g_assert_no_error (error);
+	g_assert_cmpstr (secret_value_get_text (value), ==, "test1");
+	secret_value_unref (value);
+
+	item = _secret_file_item_decrypt ((GVariant *)matches->data,
+					  collection, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (secret_file_item_get_value (item));
+	g_object_unref (item);
+
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+	g_hash_table_unref (attributes);
+	g_object_unref (collection);
+}
+
+static SecretFileCollection *
+open_indexed_collection (Test *test,
+			 gboolean index)
+{
+	GFile *file;
+	gchar *path;
+	SecretValue *password;
+
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	file = g_file_new_for_path (path);
+	g_free (path);
+
+	password = secret_value_new ("password", -1, "text/plain");
+
+	g_async_initable_new_async (SECRET_TYPE_FILE_COLLECTION,
+				    G_PRIORITY_DEFAULT,
+				    NULL,
+				    on_new_async,
+				    test,
+				    "file", file,
+				    "password", password,
+				    "index", index,
+				    NULL);
+
+	g_object_unref (file);
+	secret_value_unref (password);
+
+	g_main_loop_run (test->loop);
+
+	return g_steal_pointer (&test->collection);
+}
+
+static guint
+count_matches (SecretFileCollection *collection,
+	       const gchar *name,
+	       const gchar *value)
+{
+	GHashTable *attributes;
+	GList *matches;
+	guint count;
+
+	attributes = g_hash_table_new (g_str_hash, g_str_equal);
+	if (name != NULL)
+		g_hash_table_insert (attributes, (gchar *) name, (gchar *) value);
+	matches = secret_file_collection_search (collection, attributes);
+	count = g_list_length (matches);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+	g_hash_table_unref (attributes);
+
+	return count;
+}
+
+static void
+check_index (SecretFileCollection *collection)
+{
+	gchar *secret;
+
+	secret = lookup_item (collection, "item 7");
+	g_assert_cmpstr (secret, ==, "secret 7");
+	g_free (secret);
+
+	g_assert_null (lookup_item (collection, "missing"));
+	g_assert_cmpuint (count_matches (collection, "parity", "even"), ==, 25);
+	g_assert_cmpuint (count_matches (collection, NULL, NULL), ==, 50);
+}
+
+static void
+test_index (Test *test,
+	    gconstpointer unused)
+{
+	SecretFileCollection *collection;
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	gchar *path;
+	gchar *contents;
+	gsize length;
+	guint64 contents_size;
+	guint32 n_entries;
+	gsize offset;
+	gboolean ret;
+	guint i;
+
+	g_clear_object (&test->collection);
+	collection = open_indexed_collection (test, TRUE);
+
+	for (i = 0; i < 50; i++) {
+		gchar *secret = g_strdup_printf ("secret %u", i);
+
+		attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+		g_hash_table_insert (attributes, g_strdup ("name"), g_strdup_printf ("item %u", i));
+		g_hash_table_insert (attributes, g_strdup ("parity"), g_strdup (i % 2 ? "odd" : "even"));
+		value = secret_value_new (secret, -1, "text/plain");
+		ret = secret_file_collection_replace (collection, attributes, "label",
+						      value, &error);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+		secret_value_unref (value);
+		g_hash_table_unref (attributes);
+		g_free (secret);
+	}
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_object_unref (collection);
+
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	ret = g_file_get_contents (path, &contents, &length, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_assert_cmpuint (length, >, 18 + 8);
+	g_assert_cmpint (contents[17] & 0x80, !=, 0);
+
+	/* Searches with attributes are answered from the index */
+	collection = open_indexed_collection (test, TRUE);
+	check_index (collection);
+	g_object_unref (collection);
+
+	/* A damaged entry is noticed and all of the items are loaded */
+	memcpy (&contents_size, contents + length - 8, 8);
+	contents_size = GUINT64_FROM_LE (contents_size);
+	offset = 18 + contents_size;
+	memcpy (&n_entries, contents + offset, 4);
+	n_entries = GUINT32_FROM_LE (n_entries);
+	g_assert_cmpuint (n_entries, >, 0);
+	for (i = 0; i < n_entries; i++)
+		contents[offset + 4 + (i + 1) * (16 + 2 * MAC_SIZE) - 1] ^= 0xff;
+	ret = g_file_set_contents (path, contents, length, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_free (contents);
+
+	collection = open_indexed_collection (test, FALSE);
+	check_index (collection);
+
+	/* And written out without the index again */
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_object_unref (collection);
+
+	ret = g_file_get_contents (path, &contents, &length, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_assert_cmpint (contents[17] & 0x80, ==, 0);
+	g_free (contents);
+
+	collection = open_indexed_collection (test, FALSE);
+	check_index (collection);
+	g_object_unref (collection);
+	g_free (path);
+}
+
+static gchar *
+lookup_item_id (SecretFileCollection *collection,
+		const gchar *name)
+{
+	GHashTable *attributes;
+	GList *matches;
+	gchar *id;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("name"), g_strdup (name));
+	matches = secret_file_collection_search (collection, attributes);
+	g_hash_table_unref (attributes);
+
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	id = _secret_file_item_get_encrypted_id (matches->data, collection);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	return id;
+}
+
+static gboolean
+has_stored_id (SecretFileCollection *collection,
+	       const gchar *name)
+{
+	GHashTable *attributes;
+	GVariant *hashed_attributes;
+	GVariant *variant;
+	GList *matches;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("name"), g_strdup (name));
+	matches = secret_file_collection_search (collection, attributes);
+	g_hash_table_unref (attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+
+	hashed_attributes = g_variant_get_child_value (matches->data, 0);
+	variant = g_variant_lookup_value (hashed_attributes, "xdg:id",
+					  G_VARIANT_TYPE_BYTESTRING);
+	g_variant_unref (hashed_attributes);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	if (variant == NULL)
+		return FALSE;
+	g_variant_unref (variant);
+	return TRUE;
+}
+
+static void
+test_item_id (Test *test,
+	      gconstpointer unused)
+{
+	SecretFileCollection *collection;
+	SecretFileItem *item;
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	GList *matches;
+	gchar *contents;
+	gsize length;
+	gchar *id;
+	gchar *other;
+	gchar *label;
+	gchar *secret;
+	gboolean ret;
+
+	replace_item (test->collection, "one", "secret 1");
+	replace_item (test->collection, "two", "secret 2");
+
+	id = lookup_item_id (test->collection, "one");
+	g_assert_cmpuint (strlen (id), ==, 32);
+	other = lookup_item_id (test->collection, "two");
+	g_assert_cmpstr (id, !=, other);
+	g_free (other);
+
+	/* The same whether the item is decrypted now or later */
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("name"), g_strdup ("one"));
+	matches = secret_file_collection_search (test->collection, attributes);
+	g_hash_table_unref (attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	item = _secret_file_item_decrypt (matches->data, test->collection, &error);
+	g_assert_no_error (error);
+	g_assert_cmpstr (secret_file_item_get_id (item), ==, id);
+	g_object_unref (item);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("name"), g_strdup ("one"));
+	matches = secret_file_collection_search_items (test->collection, attributes);
+	g_hash_table_unref (attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	g_object_get (matches->data, "id", &other, NULL);
+	g_assert_cmpstr (other, ==, id);
+	g_free (other);
+	g_list_free_full (matches, g_object_unref);
+
+	/* Kept when the item is replaced, without being stored in a file
+	 * older versions of libsecret can still read */
+	replace_item (test->collection, "one", "secret 3");
+	other = lookup_item_id (test->collection, "one");
+	g_assert_cmpstr (other, ==, id);
+	g_free (other);
+	g_assert_false (has_stored_id (test->collection, "one"));
+
+	/* Or changed through it */
+	ret = secret_file_collection_set_label (test->collection, id, "label 1", &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	other = lookup_item_id (test->collection, "one");
+	g_assert_cmpstr (other, ==, id);
+	g_free (other);
+	g_assert_false (has_stored_id (test->collection, "one"));
+
+	secret_file_collection_write (test->collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_clear_object (&test->collection);
+
+	contents = read_keyring (test, &length);
+	g_assert_cmpint (contents[17] & 0x20, ==, 0);
+	g_free (contents);
+
+	/* Only stored once the file is upgraded, and marked as such */
+	collection = open_collection (test, FALSE, TRUE);
+	g_assert_true (has_stored_id (collection, "one"));
+	g_free (id);
+	id = lookup_item_id (collection, "one");
+
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_object_unref (collection);
+
+	contents = read_keyring (test, &length);
+	g_assert_cmpint (contents[17] & 0x20, ==, 0x20);
+	g_free (contents);
+
+	/* And across writes, even without upgrading */
+	collection = open_collection (test, FALSE, FALSE);
+	other = lookup_item_id (collection, "one");
+	g_assert_cmpstr (other, ==, id);
+	g_free (other);
+
+	/* Items are changed through their ID */
+	ret = secret_file_collection_set_label (collection, id, "new label", &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	value = secret_value_new ("secret 4", -1, "text/plain");
+	ret = secret_file_collection_update (collection, id, value, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	secret_value_unref (value);
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("name"), g_strdup ("one"));
+	matches = secret_file_collection_search_items (collection, attributes);
+	g_hash_table_unref (attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+	item = matches->data;
+	g_object_get (item, "label", &label, "id", &other, NULL);
+	g_assert_cmpstr (label, ==, "new label");
+	g_assert_cmpstr (other, ==, id);
+	g_free (label);
+	g_free (other);
+	secret = lookup_item (collection, "one");
+	g_assert_cmpstr (secret, ==, "secret 4");
+	g_free (secret);
+
+	/* Or through the items found */
+	ret = secret_file_item_set_label (item, "item label", &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_object_get (item, "label", &label, NULL);
+	g_assert_cmpstr (label, ==, "item label");
+	g_free (label);
+	value = secret_value_new ("secret 5", -1, "text/plain");
+	ret = secret_file_item_update (item, value, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	secret_value_unref (value);
+	secret = lookup_item (collection, "one");
+	g_assert_cmpstr (secret, ==, "secret 5");
+	g_free (secret);
+
+	ret = secret_file_item_delete (item, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_list_free_full (matches, g_object_unref);
+	g_assert_null (lookup_item (collection, "one"));
+	secret = lookup_item (collection, "two");
+	g_assert_cmpstr (secret, ==, "secret 2");
+	g_free (secret);
+
+	ret = secret_file_collection_delete (collection, id, &error);
+	g_assert_error (error, SECRET_ERROR, SECRET_ERROR_NO_SUCH_OBJECT);
+	g_assert_false (ret);
+	g_clear_error (&error);
+	g_free (id);
+
+	/* The attribute holding the ID can't be set */
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("xdg:id"), g_strdup ("0"));
+	value = secret_value_new ("secret", -1, "text/plain");
+	ret = secret_file_collection_replace (collection, attributes, "label",
+					      value, &error);
+	g_assert_error (error, SECRET_ERROR, SECRET_ERROR_PROTOCOL);
+	g_assert_false (ret);
+	g_clear_error (&error);
+	secret_value_unref (value);
+	g_hash_table_unref (attributes);
+
+	g_object_unref (collection);
+}
+
+static guint64
+lookup_created (SecretFileCollection *collection,
+		const gchar *name,
+		guint64 *stored)
+{
+	GHashTable *attributes;
+	GVariant *hashed_attributes;
+	GVariant *variant;
+	SecretFileItem *item;
+	GError *error = NULL;
+	GList *matches;
+	guint64 created;
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("name"), g_strdup (name));
+	matches = secret_file_collection_search (collection, attributes);
+	g_hash_table_unref (attributes);
+	g_assert_cmpint (g_list_length (matches), ==, 1);
+
+	/* Readable without decrypting the item */
+	hashed_attributes = g_variant_get_child_value (matches->data, 0);
+	variant = g_variant_lookup_value (hashed_attributes, "xdg:created",
+					  G_VARIANT_TYPE_BYTESTRING);
+	g_assert_nonnull (variant);
+	g_assert_cmpuint (g_variant_get_size (variant), ==, 8);
+	memcpy (stored, g_variant_get_data (variant), 8);
+	*stored = GUINT64_FROM_LE (*stored);
+	g_variant_unref (variant);
+	g_variant_unref (hashed_attributes);
+
+	item = _secret_file_item_decrypt (matches->data, collection, &error);
+	g_assert_no_error (error);
+	g_object_get (item, "created", &created, NULL);
+	g_object_unref (item);
+	g_list_free_full (matches, (GDestroyNotify)g_variant_unref);
+
+	return created;
+}
+
+static void
+test_replace_created (Test *test,
+		      gconstpointer unused)
+{
+	SecretFileCollection *collection;
+	GHashTable *attributes;
+	SecretValue *value;
+	GError *error = NULL;
+	guint64 created;
+	guint64 stored;
+	gboolean ret;
+
+	/* Only stored in the clear in a file marked as holding it */
+	g_clear_object (&test->collection);
+	collection = open_collection (test, FALSE, TRUE);
+
+	replace_item (collection, "one", "secret 1");
+	created = lookup_created (collection, "one", &stored);
+	g_assert_cmpuint (stored, ==, created);
+
+	/* Kept across a replace, a second later */
+	g_usleep (G_USEC_PER_SEC);
+	replace_item (collection, "one", "secret 2");
+	g_assert_cmpuint (lookup_created (collection, "one", &stored), ==, created);
+	g_assert_cmpuint (stored, ==, created);
+
+	attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_insert (attributes, g_strdup ("xdg:created"), g_strdup ("0"));
+	value = secret_value_new ("secret", -1, "text/plain");
+	ret = secret_file_collection_replace (collection, attributes, "label",
+					      value, &error);
+	g_assert_error (error, SECRET_ERROR, SECRET_ERROR_PROTOCOL);
+	g_assert_false (ret);
+	g_clear_error (&error);
+	secret_value_unref (value);
+	g_hash_table_unref (attributes);
+
+	g_object_unref (collection);
+}
+
+static SecretFileCollection *
+open_compressed_collection (Test *test,
+			    gboolean compress)
+{
+	GFile *file;
+	gchar *path;
+	SecretValue *password;
+
+	path = g_build_filename (test->directory, "default.keyring", NULL);
+	file = g_file_new_for_path (path);
+	g_free (path);
+
+	password = secret_value_new ("password", -1, "text/plain");
+
+	g_async_initable_new_async (SECRET_TYPE_FILE_COLLECTION,
+				    G_PRIORITY_DEFAULT,
+				    NULL,
+				    on_new_async,
+				    test,
+				    "file", file,
+				    "password", password,
+				    "journal", TRUE,
+				    "upgrade", TRUE,
+				    "compress", compress,
+				    NULL);
+
+	g_object_unref (file);
+	secret_value_unref (password);
+
+	g_main_loop_run (test->loop);
+
+	return g_steal_pointer (&test->collection);
+}
+
+static void
+test_compress (Test *test,
+	       gconstpointer unused)
+{
+	SecretFileCollection *collection;
+	GString *large;
+	gchar *contents;
+	gchar *secret;
+	gsize length;
+	guint i;
+
+	large = g_string_new (NULL);
+	for (i = 0; i < 200; i++)
+		g_string_append_printf (large, "{\"line\": %u, \"token\": \"abcdef\"}\n", i);
+
+	g_clear_object (&test->collection);
+	collection = open_compressed_collection (test, FALSE);
+	replace_item (collection, "small", "secret");
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_object_unref (collection);
+
+	contents = read_keyring (test, &length);
+	g_assert_cmpint (contents[17] & 0x40, ==, 0);
+	g_free (contents);
+
+	/* Marks the file, and so rewrites it rather than the journal */
+	collection = open_compressed_collection (test, TRUE);
+	replace_item (collection, "large", large->str);
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_object_unref (collection);
+
+	contents = read_keyring (test, &length);
+	g_assert_cmpint (contents[17] & 0x40, !=, 0);
+	g_assert_cmpuint (length, <, large->len);
+	g_free (contents);
+
+	/* Still readable, and still marked, without compression */
+	collection = open_compressed_collection (test, FALSE);
+	secret = lookup_item (collection, "large");
+	g_assert_cmpstr (secret, ==, large->str);
+	g_free (secret);
+	secret = lookup_item (collection, "small");
+	g_assert_cmpstr (secret, ==, "secret");
+	g_free (secret);
+
+	replace_item (collection, "small", "other secret");
+	secret_file_collection_write (collection, NULL, on_write, test);
+	g_main_loop_run (test->loop);
+	g_object_unref (collection);
+
+	contents = read_keyring (test, &length);
+	g_assert_cmpint (contents[17] & 0x40, !=, 0);
+	g_free (contents);
+
+	collection = open_compressed_collection (test, FALSE);
+	secret = lookup_item (collection, "large");
+	g_assert_cmpstr (secret, ==, large->str);
+	g_free (secret);
+	g_object_unref (collection);
+
+	g_string_free (large, TRUE);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -360,9 +1978,28 @@ main (int argc, char **argv)
 	g_test_add ("/file-collection/replace", Test, NULL, setup, test_replace, teardown);
 	g_test_add ("/file-collection/clear", Test, NULL, setup, test_clear, teardown);
 	g_test_add ("/file-collection/search", Test, NULL, setup, test_search, teardown);
+	g_test_add ("/file-collection/search-order", Test, NULL, setup, test_search_order, teardown);
+	g_test_add ("/file-collection/search-index", Test, NULL, setup, test_search_index, teardown);
 	g_test_add ("/file-collection/decrypt", Test, NULL, setup, test_decrypt, teardown);
 	g_test_add ("/file-collection/write", Test, NULL, setup, test_write, teardown);
+	g_test_add ("/file-collection/write-large", Test, NULL, setup, test_write_large, teardown);
+	g_test_add ("/file-collection/durability/always", Test, NULL, setup, test_durability_always, teardown);
+	g_test_add ("/file-collection/durability/batched", Test, NULL, setup, test_durability_batched, teardown);
+	g_test_add ("/file-collection/durability/none", Test, NULL, setup, test_durability_none, teardown);
+	g_test_add ("/file-collection/journal", Test, NULL, setup, test_journal, teardown);
+	g_test_add ("/file-collection/merge", Test, NULL, setup, test_merge, teardown);
+	g_test_add ("/file-collection/merge-journal", Test, NULL, setup, test_merge_journal, teardown);
+	g_test_add ("/file-collection/watch", Test, NULL, setup, test_watch, teardown);
+	g_test_add ("/file-collection/refresh", Test, NULL, setup, test_refresh, teardown);
 	g_test_add ("/file-collection/read", Test, "default.keyring", setup, test_read, teardown);
+	g_test_add ("/file-collection/deferred", Test, "default.keyring", setup, test_deferred, teardown);
+	g_test_add ("/file-collection/deferred-reload", Test, "default.keyring", setup, test_deferred_reload, teardown);
+	g_test_add ("/file-collection/split", Test, NULL, setup, test_split, teardown);
+	g_test_add ("/file-collection/index", Test, NULL, setup, test_index, teardown);
+	g_test_add ("/file-collection/item-id", Test, NULL, setup, test_item_id, teardown);
+	g_test_add ("/file-collection/replace-created", Test, NULL, setup, test_replace_created, teardown);
+	g_test_add ("/file-collection/compress", Test, NULL, setup, test_compress, teardown);
+	g_test_add ("/file-collection/upgrade", Test, "default.keyring", setup, test_upgrade, teardown);
 
 	return egg_tests_run_with_loop ();
 }
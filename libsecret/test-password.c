@@ -16,6 +16,7 @@
 
 #undef G_DISABLE_ASSERT
 
+#include "secret-attributes.h"
 #include "secret-password.h"
 #include "secret-paths.h"
 #include "secret-private.h"
@@ -181,6 +182,114 @@ test_store_sync (Test *test,
 	secret_password_free (password);
 }
 
+static void
+test_store_many (Test *test,
+                 gconstpointer used)
+{
+	const gchar *collection_path = "/org/freedesktop/secrets/collection/english";
+	const gchar *missing_path = "/org/freedesktop/secrets/collection/nonexistent";
+	GList *entries = NULL;
+	GHashTable *attributes;
+	GPtrArray *errors = NULL;
+	GError *error = NULL;
+	gchar *password;
+	gboolean ret;
+
+	attributes = secret_attributes_build (&MOCK_SCHEMA,
+	                                      "string", "twelve",
+	                                      "number", 12,
+	                                      NULL);
+	entries = g_list_append (entries, secret_password_entry_new (&MOCK_SCHEMA, attributes,
+	                                                             collection_path, "Twelve",
+	                                                             "the password"));
+	g_hash_table_unref (attributes);
+
+	attributes = secret_attributes_build (&MOCK_SCHEMA,
+	                                      "string", "thirteen",
+	                                      "number", 13,
+	                                      NULL);
+	entries = g_list_append (entries, secret_password_entry_new (&MOCK_SCHEMA, attributes,
+	                                                             missing_path, "Thirteen",
+	                                                             "unlucky"));
+	g_hash_table_unref (attributes);
+
+	ret = secret_password_store_many_sync (entries, NULL, &errors, &error);
+	g_list_free_full (entries, (GDestroyNotify) secret_password_entry_unref);
+
+	/* Only the entry for the missing collection fails */
+	g_assert_nonnull (error);
+	g_assert_false (ret);
+	g_clear_error (&error);
+	g_assert_nonnull (errors);
+	g_assert_cmpuint (errors->len, ==, 2);
+	g_assert_null (g_ptr_array_index (errors, 0));
+	g_assert_nonnull (g_ptr_array_index (errors, 1));
+	g_ptr_array_unref (errors);
+
+	password = secret_password_lookup_nonpageable_sync (&MOCK_SCHEMA, NULL, &error,
+	                                                    "string", "twelve",
+	                                                    NULL);
+
+	g_assert_no_error (error);
+	g_assert_cmpstr (password, ==, "the password");
+
+	secret_password_free (password);
+}
+
+/* More entries than are sent at once, each with its own outcome */
+static void
+test_store_many_more (Test *test,
+                      gconstpointer used)
+{
+	const gchar *collection_path = "/org/freedesktop/secrets/collection/english";
+	const gchar *missing_path = "/org/freedesktop/secrets/collection/nonexistent";
+	GList *entries = NULL;
+	GHashTable *attributes;
+	GPtrArray *errors = NULL;
+	GError *error = NULL;
+	gchar *password;
+	gchar *label;
+	gboolean ret;
+	gint i;
+
+	for (i = 0; i < 20; i++) {
+		attributes = secret_attributes_build (&MOCK_SCHEMA,
+		                                      "string", "many",
+		                                      "number", i,
+		                                      NULL);
+		label = g_strdup_printf ("Many %d", i);
+		entries = g_list_append (entries, secret_password_entry_new (&MOCK_SCHEMA, attributes,
+		                                                             i == 13 ? missing_path : collection_path,
+		                                                             label, label));
+		g_free (label);
+		g_hash_table_unref (attributes);
+	}
+
+	ret = secret_password_store_many_sync (entries, NULL, &errors, &error);
+	g_list_free_full (entries, (GDestroyNotify) secret_password_entry_unref);
+
+	g_assert_nonnull (error);
+	g_assert_false (ret);
+	g_clear_error (&error);
+	g_assert_nonnull (errors);
+	g_assert_cmpuint (errors->len, ==, 20);
+	for (i = 0; i < 20; i++) {
+		if (i == 13)
+			g_assert_nonnull (g_ptr_array_index (errors, i));
+		else
+			g_assert_null (g_ptr_array_index (errors, i));
+	}
+	g_ptr_array_unref (errors);
+
+	password = secret_password_lookup_sync (&MOCK_SCHEMA, NULL, &error,
+	                                        "string", "many",
+	                                        "number", 19,
+	                                        NULL);
+	g_assert_no_error (error);
+	g_assert_cmpstr (password, ==, "Many 19");
+	secret_password_free (password);
+}
+
 static void
 test_store_async (Test *test,
                   gconstpointer used)
@@ -298,6 +407,36 @@ test_delete_sync (Test *test,
 	g_assert_true (ret);
 }
 
+static void
+test_clear_many (Test *test,
+                 gconstpointer used)
+{
+	GList *attributes = NULL;
+	GError *error = NULL;
+	gboolean ret;
+
+	/* Both match the same item, which is only deleted once */
+	attributes = g_list_append (attributes,
+	                            secret_attributes_build (&MOCK_SCHEMA,
+	                                                     "string", "one",
+	                                                     "number", 1,
+	                                                     NULL));
+	attributes = g_list_append (attributes,
+	                            secret_attributes_build (&MOCK_SCHEMA,
+	                                                     "string", "one",
+	                                                     NULL));
+
+	ret = secret_password_clear_many_sync (&MOCK_SCHEMA, attributes, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	ret = secret_password_clear_many_sync (&MOCK_SCHEMA, attributes, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_false (ret);
+
+	g_list_free_full (attributes, (GDestroyNotify) g_hash_table_unref);
+}
+
 static void
 test_delete_async (Test *test,
                    gconstpointer used)
@@ -528,10 +667,13 @@ main (int argc, char **argv)
 
 	g_test_add ("/password/store-sync", Test, "mock-service-normal.py", setup, test_store_sync, teardown);
 	g_test_add ("/password/store-async", Test, "mock-service-normal.py", setup, test_store_async, teardown);
+	g_test_add ("/password/store-many", Test, "mock-service-normal.py", setup, test_store_many, teardown);
+	g_test_add ("/password/store-many-more", Test, "mock-service-normal.py", setup, test_store_many_more, teardown);
 	g_test_add ("/password/store-unlock", Test, "mock-service-normal.py", setup, test_store_unlock, teardown);
 
 	g_test_add ("/password/delete-sync", Test, "mock-service-delete.py", setup, test_delete_sync, teardown);
 	g_test_add ("/password/delete-async", Test, "mock-service-delete.py", setup, test_delete_async, teardown);
+	g_test_add ("/password/clear-many", Test, "mock-service-delete.py", setup, test_clear_many, teardown);
 	g_test_add ("/password/clear-no-name", Test, "mock-service-delete.py", setup, test_clear_no_name, teardown);
 
 	g_test_add ("/password/search-sync", Test, "mock-service-normal.py", setup, test_search_sync, teardown);
@@ -397,6 +397,7 @@ on_retrieve_secret (GObject *source_object,
 	gchar *label;
 	const gchar *part;
 	const gchar *path;
+	gchar *id;
 	GError *error;
 
 	error = NULL;
@@ -415,6 +416,11 @@ on_retrieve_secret (GObject *source_object,
 		if (part == NULL)
 			part = path;
 		g_print ("[%s]\n", part);
+	} else if (g_object_class_find_property (G_OBJECT_GET_CLASS (item), "id")) {
+		/* Items of the file backend have no object path */
+		g_object_get (item, "id", &id, NULL);
+		g_print ("[/file/%s]\n", id);
+		g_free (id);
 	} else {
 		g_print ("[no path]\n");
 	}
@@ -49,17 +49,17 @@ else
 fi
 
 cat > search.exp <<EOF
-[no path]
+[/file/ID]
 label = label1
 secret = test1
 
-[no path]
+[/file/ID]
 label = label2
 secret = test2
 
 EOF
 
-${SECRET_TOOL} search foo bar | sed '/^created\|^modified/d' > search.out
+${SECRET_TOOL} search foo bar | sed -e '/^created\|^modified/d' -e 's|^\[/file/[0-9a-f]\{32\}\]$|[/file/ID]|' > search.out
 if test $? -ne 0; then
   echo "not ok 4 /secret-tool/search"
   exit 1
@@ -81,13 +81,13 @@ else
 fi
 
 cat > search-after-clear.exp <<EOF
-[no path]
+[/file/ID]
 label = label1
 secret = test1
 
 EOF
 
-${SECRET_TOOL} search foo bar | sed '/^created\|^modified/d' > search-after-clear.out
+${SECRET_TOOL} search foo bar | sed -e '/^created\|^modified/d' -e 's|^\[/file/[0-9a-f]\{32\}\]$|[/file/ID]|' > search-after-clear.out
 if test $? -ne 0; then
   echo "not ok 6 /secret-tool/search-after-clear"
   exit 1